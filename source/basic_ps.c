@@ -12,18 +12,35 @@ typedef struct Ps_Output {
 
 const uint scene_tex_id = 0;
 const uint env_tex_id = 1;
+const uint scene_sampler_id = 0;
 
-static void ps_main(const void *p_fragment_input_data, void *p_fragment_output_data, const void **pp_shader_resource_views, i256 mask) {
+void basic_ps_main(const void *p_fragment_input_data, void *p_fragment_output_data, const void **pp_shader_resource_views, const SamplerState **pp_samplers, i256 mask) {
 	Ps_Input *p_in = (Ps_Input*)p_fragment_input_data;
 	Ps_Output *p_out = (Ps_Output*)p_fragment_output_data;
 	Texture2D scene_tex = *((Texture2D*)pp_shader_resource_views[scene_tex_id]);
 
 	//v3f256 normal = v3f256_normalize(p_in->NORMAL);
 	//v3f256 color = (v3f256) { p_in->UV.x, p_in->UV.x, _mm256_set1_ps(0) };
-	v3f256 color = sample_2D_u_x8(scene_tex, p_in->UV, mask).xyz;
+	v3f256 color = sample_2D_u_x8(scene_tex, pp_samplers[scene_sampler_id], p_in->UV, mask).xyz;
 	color = v3f256_srgb_from_linear_approx(color);
 
 	p_out->SV_TARGET.xyz = color;
 }
 
-struct PixelShader basic_ps = { ps_main };
\ No newline at end of file
+void basic_ps_tile_main(const PixelTile *p_tile, void *p_tile_output_data, const void **pp_shader_resource_views, const SamplerState **pp_samplers) {
+	Ps_Output *p_out = (Ps_Output*)p_tile_output_data;
+	Texture2D scene_tex = *((Texture2D*)pp_shader_resource_views[scene_tex_id]);
+	const SamplerState *p_scene_sampler = pp_samplers[scene_sampler_id];
+
+	for(uint row_index = 0; row_index < PIXEL_TILE_ROW_COUNT; ++row_index) {
+		if(!(p_tile->active_row_mask & (1 << row_index))) continue;
+		const Ps_Input *p_in = (const Ps_Input*)((const u8*)p_tile->p_row_inputs + row_index * p_tile->row_input_stride);
+
+		v3f256 color = sample_2D_u_x8(scene_tex, p_scene_sampler, p_in->UV, p_tile->a_row_masks[row_index]).xyz;
+		color = v3f256_srgb_from_linear_approx(color);
+
+		p_out[row_index].SV_TARGET.xyz = color;
+	}
+}
+
+struct PixelShader basic_ps = { basic_ps_main, basic_ps_tile_main };
\ No newline at end of file
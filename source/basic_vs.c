@@ -10,7 +10,6 @@ typedef struct Vs_Output {
 	v4f256 SV_POSITION;
 	v3f256 NORMAL;
 	v2f256 UV;
-	f256 _pad[3];
 }Vs_Output;
 
 typedef struct ConstantBuffer {
@@ -19,7 +18,7 @@ typedef struct ConstantBuffer {
 	float4x4 world_from_view;
 } ConstantBuffer;
 
-static void vs_main(const void *p_vertex_input_data, void *p_vertex_output_data, const void **pp_constant_buffers, const void **pp_shader_resource_views) {
+void basic_vs_main(const void *p_vertex_input_data, void *p_vertex_output_data, const void **pp_constant_buffers, const void **pp_shader_resource_views, const SamplerState **pp_samplers) {
 	Vs_Input *p_in = ((Vs_Input*)p_vertex_input_data);
 	Vs_Output *p_out = ((Vs_Output*)p_vertex_output_data);
 	ConstantBuffer *p_cb = (ConstantBuffer*)(pp_constant_buffers[0]);
@@ -32,4 +31,4 @@ static void vs_main(const void *p_vertex_input_data, void *p_vertex_output_data,
 	p_out->UV = (v2f256) { p_in->UV.x, p_in->UV.y };
 }
 
-VertexShader basic_vs = { sizeof(Vs_Input), sizeof(Vs_Output), vs_main };
\ No newline at end of file
+VertexShader basic_vs = { sizeof(Vs_Input), sizeof(Vs_Output), basic_vs_main };
\ No newline at end of file
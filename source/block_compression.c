@@ -0,0 +1,561 @@
+#include "common_shader_core.h"
+#include <string.h>
+#include <assert.h>
+#include <intrin.h>
+
+// BC1/BC3/BC7/BC6H block decoders and the per-thread cache of decoded 4x4 blocks the samplers fetch from.
+// Block compressed textures stay compressed in memory, a block is decoded the first time a thread samples it and
+// stays in that thread's cache until another block of the same texture maps to its slot.
+
+#define BLOCK_TEXEL_COUNT (TEXTURE_BLOCK_DIM*TEXTURE_BLOCK_DIM)
+
+//----------------------------------------  BLOCK DECODERS  ----------------------------------------------------------------------------------------------------------------------------------------------//
+
+// Decoded texels are written in row-major order, R8G8B8A8 texels use the same packing as encode_color_as_u32
+
+typedef struct BlockBitReader {
+	u64 lo;
+	u64 hi;
+	u32 position;
+} BlockBitReader;
+
+static inline BlockBitReader make_block_bit_reader(const u8 *p_block) {
+	BlockBitReader reader;
+	memcpy(&reader.lo, p_block, sizeof(u64));
+	memcpy(&reader.hi, p_block + sizeof(u64), sizeof(u64));
+	reader.position = 0;
+	return reader;
+}
+
+// Reads count (<= 16) bits, least significant bit first
+static inline u32 read_bits(BlockBitReader *p_reader, u32 count) {
+	u32 position = p_reader->position;
+	u64 bits;
+	if(position >= 64) {
+		bits = p_reader->hi >> (position - 64);
+	}
+	else {
+		bits = p_reader->lo >> position;
+		if(position + count > 64) bits |= p_reader->hi << (64 - position);
+	}
+	p_reader->position += count;
+	return (u32)(bits & ((1ull << count) - 1));
+}
+
+static inline u32 pack_rgba8(u32 r, u32 g, u32 b, u32 a) {
+	return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+static void decode_bc1_color_block(const u8 *p_block, u32 *p_texels, bool is_3_color_mode_allowed) {
+	u32 color_0 = p_block[0] | (p_block[1] << 8);
+	u32 color_1 = p_block[2] | (p_block[3] << 8);
+	u32 indices = p_block[4] | (p_block[5] << 8) | (p_block[6] << 16) | ((u32)p_block[7] << 24);
+
+	u32 r_0 = (color_0 >> 11) & 0x1F, g_0 = (color_0 >> 5) & 0x3F, b_0 = color_0 & 0x1F;
+	u32 r_1 = (color_1 >> 11) & 0x1F, g_1 = (color_1 >> 5) & 0x3F, b_1 = color_1 & 0x1F;
+	r_0 = (r_0 << 3) | (r_0 >> 2); g_0 = (g_0 << 2) | (g_0 >> 4); b_0 = (b_0 << 3) | (b_0 >> 2);
+	r_1 = (r_1 << 3) | (r_1 >> 2); g_1 = (g_1 << 2) | (g_1 >> 4); b_1 = (b_1 << 3) | (b_1 >> 2);
+
+	u32 a_palette[4];
+	a_palette[0] = pack_rgba8(r_0, g_0, b_0, 255);
+	a_palette[1] = pack_rgba8(r_1, g_1, b_1, 255);
+	if(color_0 > color_1 || !is_3_color_mode_allowed) {
+		a_palette[2] = pack_rgba8((2 * r_0 + r_1) / 3, (2 * g_0 + g_1) / 3, (2 * b_0 + b_1) / 3, 255);
+		a_palette[3] = pack_rgba8((r_0 + 2 * r_1) / 3, (g_0 + 2 * g_1) / 3, (b_0 + 2 * b_1) / 3, 255);
+	}
+	else {
+		a_palette[2] = pack_rgba8((r_0 + r_1) / 2, (g_0 + g_1) / 2, (b_0 + b_1) / 2, 255);
+		a_palette[3] = 0;
+	}
+
+	for(u32 i = 0; i < BLOCK_TEXEL_COUNT; ++i) {
+		p_texels[i] = a_palette[(indices >> (2 * i)) & 0x3];
+	}
+}
+
+static void decode_bc1_block(const u8 *p_block, u32 *p_texels) {
+	decode_bc1_color_block(p_block, p_texels, true);
+}
+
+static void decode_bc3_block(const u8 *p_block, u32 *p_texels) {
+	decode_bc1_color_block(p_block + 8, p_texels, false);
+
+	u32 alpha_0 = p_block[0];
+	u32 alpha_1 = p_block[1];
+	u32 a_alphas[8] = { alpha_0, alpha_1 };
+	if(alpha_0 > alpha_1) {
+		for(u32 i = 1; i < 7; ++i) a_alphas[i + 1] = ((7 - i) * alpha_0 + i * alpha_1) / 7;
+	}
+	else {
+		for(u32 i = 1; i < 5; ++i) a_alphas[i + 1] = ((5 - i) * alpha_0 + i * alpha_1) / 5;
+		a_alphas[6] = 0;
+		a_alphas[7] = 255;
+	}
+
+	u64 indices = 0;
+	memcpy(&indices, p_block + 2, 6);
+	for(u32 i = 0; i < BLOCK_TEXEL_COUNT; ++i) {
+		p_texels[i] = (p_texels[i] & 0x00FFFFFF) | (a_alphas[(indices >> (3 * i)) & 0x7] << 24);
+	}
+}
+
+// Partition tables shared by BC7 and BC6H, bit i of a 2 subset partition is the subset of texel i
+static const u16 a_partitions_2[64] = {
+	0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+	0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE, 0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+	0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A, 0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+	0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C, 0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22
+};
+
+static const u8 a_partitions_3[64][BLOCK_TEXEL_COUNT] = {
+	{ 0,0,1,1, 0,0,1,1, 0,2,2,1, 2,2,2,2 }, { 0,0,0,1, 0,0,1,1, 2,2,1,1, 2,2,2,1 }, { 0,0,0,0, 2,0,0,1, 2,2,1,1, 2,2,1,1 }, { 0,2,2,2, 0,0,2,2, 0,0,1,1, 0,1,1,1 },
+	{ 0,0,0,0, 0,0,0,0, 1,1,2,2, 1,1,2,2 }, { 0,0,1,1, 0,0,1,1, 0,0,2,2, 0,0,2,2 }, { 0,0,2,2, 0,0,2,2, 1,1,1,1, 1,1,1,1 }, { 0,0,1,1, 0,0,1,1, 2,2,1,1, 2,2,1,1 },
+	{ 0,0,0,0, 0,0,0,0, 1,1,1,1, 2,2,2,2 }, { 0,0,0,0, 1,1,1,1, 1,1,1,1, 2,2,2,2 }, { 0,0,0,0, 1,1,1,1, 2,2,2,2, 2,2,2,2 }, { 0,0,1,2, 0,0,1,2, 0,0,1,2, 0,0,1,2 },
+	{ 0,1,1,2, 0,1,1,2, 0,1,1,2, 0,1,1,2 }, { 0,1,2,2, 0,1,2,2, 0,1,2,2, 0,1,2,2 }, { 0,0,1,1, 0,1,1,2, 1,1,2,2, 1,2,2,2 }, { 0,0,1,1, 2,0,0,1, 2,2,0,0, 2,2,2,0 },
+	{ 0,0,0,1, 0,0,1,1, 0,1,1,2, 1,1,2,2 }, { 0,1,1,1, 0,0,1,1, 2,0,0,1, 2,2,0,0 }, { 0,0,0,0, 1,1,2,2, 1,1,2,2, 1,1,2,2 }, { 0,0,2,2, 0,0,2,2, 0,0,2,2, 1,1,1,1 },
+	{ 0,1,1,1, 0,1,1,1, 0,2,2,2, 0,2,2,2 }, { 0,0,0,1, 0,0,0,1, 2,2,2,1, 2,2,2,1 }, { 0,0,0,0, 0,0,1,1, 0,1,2,2, 0,1,2,2 }, { 0,0,0,0, 1,1,0,0, 2,2,1,0, 2,2,1,0 },
+	{ 0,1,2,2, 0,1,2,2, 0,0,1,1, 0,0,0,0 }, { 0,0,1,2, 0,0,1,2, 1,1,2,2, 2,2,2,2 }, { 0,1,1,0, 1,2,2,1, 1,2,2,1, 0,1,1,0 }, { 0,0,0,0, 0,1,1,0, 1,2,2,1, 1,2,2,1 },
+	{ 0,0,2,2, 1,1,0,2, 1,1,0,2, 0,0,2,2 }, { 0,1,1,0, 0,1,1,0, 2,0,0,2, 2,2,2,2 }, { 0,0,1,1, 0,1,2,2, 0,1,2,2, 0,0,1,1 }, { 0,0,0,0, 2,0,0,0, 2,2,1,1, 2,2,2,1 },
+	{ 0,0,0,0, 0,0,0,2, 1,1,2,2, 1,2,2,2 }, { 0,2,2,2, 0,0,2,2, 0,0,1,2, 0,0,1,1 }, { 0,0,1,1, 0,0,1,2, 0,0,2,2, 0,2,2,2 }, { 0,1,2,0, 0,1,2,0, 0,1,2,0, 0,1,2,0 },
+	{ 0,0,0,0, 1,1,1,1, 2,2,2,2, 0,0,0,0 }, { 0,1,2,0, 1,2,0,1, 2,0,1,2, 0,1,2,0 }, { 0,1,2,0, 2,0,1,2, 1,2,0,1, 0,1,2,0 }, { 0,0,1,1, 2,2,0,0, 1,1,2,2, 0,0,1,1 },
+	{ 0,0,1,1, 1,1,2,2, 2,2,0,0, 0,0,1,1 }, { 0,1,0,1, 0,1,0,1, 2,2,2,2, 2,2,2,2 }, { 0,0,0,0, 0,0,0,0, 2,1,2,1, 2,1,2,1 }, { 0,0,2,2, 1,1,2,2, 0,0,2,2, 1,1,2,2 },
+	{ 0,0,2,2, 0,0,1,1, 0,0,2,2, 0,0,1,1 }, { 0,2,2,0, 1,2,2,1, 0,2,2,0, 1,2,2,1 }, { 0,1,0,1, 2,2,2,2, 2,2,2,2, 0,1,0,1 }, { 0,0,0,0, 2,1,2,1, 2,1,2,1, 2,1,2,1 },
+	{ 0,1,0,1, 0,1,0,1, 0,1,0,1, 2,2,2,2 }, { 0,2,2,2, 0,1,1,1, 0,2,2,2, 0,1,1,1 }, { 0,0,0,2, 1,1,1,2, 0,0,0,2, 1,1,1,2 }, { 0,0,0,0, 2,1,1,2, 2,1,1,2, 2,1,1,2 },
+	{ 0,2,2,2, 0,1,1,1, 0,1,1,1, 0,2,2,2 }, { 0,0,0,2, 1,1,1,2, 1,1,1,2, 0,0,0,2 }, { 0,1,1,0, 0,1,1,0, 0,1,1,0, 2,2,2,2 }, { 0,0,0,0, 0,0,0,0, 2,1,1,2, 2,1,1,2 },
+	{ 0,1,1,0, 0,1,1,0, 2,2,2,2, 2,2,2,2 }, { 0,0,2,2, 0,0,1,1, 0,0,1,1, 0,0,2,2 }, { 0,0,2,2, 1,1,2,2, 1,1,2,2, 0,0,2,2 }, { 0,0,0,0, 0,0,0,0, 0,0,0,0, 2,1,1,2 },
+	{ 0,0,0,2, 0,0,0,1, 0,0,0,2, 0,0,0,1 }, { 0,2,2,2, 1,2,2,2, 0,2,2,2, 1,2,2,2 }, { 0,1,0,1, 2,2,2,2, 2,2,2,2, 2,2,2,2 }, { 0,1,1,1, 2,0,1,1, 2,2,0,1, 2,2,2,0 }
+};
+
+// Texels whose index is stored with one bit less, texel 0 is the anchor of subset 0 in every partition
+static const u8 a_anchors_2_of_2[64] = {
+	15,15,15,15,15,15,15,15, 15,15,15,15,15,15,15,15, 15, 2, 8, 2, 2, 8, 8,15,  2, 8, 2, 2, 8, 8, 2, 2,
+	15,15, 6, 8, 2, 8,15,15,  2, 8, 2, 2, 2,15,15, 6,  6, 2, 6, 8,15,15, 2, 2, 15,15,15,15,15, 2, 2,15
+};
+static const u8 a_anchors_2_of_3[64] = {
+	 3, 3,15,15, 8, 3,15,15,  8, 8, 6, 6, 6, 5, 3, 3,  3, 3, 8,15, 3, 3, 6,10,  5, 8, 8, 6, 8, 5,15,15,
+	 8,15, 3, 5, 6,10, 8,15, 15, 3,15, 5,15,15,15,15,  3,15, 5, 5, 5, 8, 5,10,  5,10, 8,13,15,12, 3, 3
+};
+static const u8 a_anchors_3_of_3[64] = {
+	15, 8, 8, 3,15,15, 3, 8, 15,15,15,15,15,15,15, 8, 15, 8,15, 3,15, 8,15, 8,  3,15, 6,10,15,15,10, 8,
+	15, 3,15,10,10, 8, 9,10,  6,15, 8,15, 3, 6, 6, 8, 15, 3,15,15,15,15,15,15, 15,15,15,15, 3,15,15, 8
+};
+
+static const u8 a_weights_2[4] = { 0, 21, 43, 64 };
+static const u8 a_weights_3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const u8 a_weights_4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static inline const u8* get_weights(u32 index_bit_count) {
+	return (index_bit_count == 2) ? a_weights_2 : ((index_bit_count == 3) ? a_weights_3 : a_weights_4);
+}
+
+static inline u32 get_subset_index(u32 subset_count, u32 partition, u32 texel_index) {
+	if(subset_count == 2) return (a_partitions_2[partition] >> texel_index) & 0x1;
+	if(subset_count == 3) return a_partitions_3[partition][texel_index];
+	return 0;
+}
+
+static inline bool is_anchor_texel(u32 subset_count, u32 partition, u32 texel_index) {
+	if(texel_index == 0) return true;
+	if(subset_count == 2) return texel_index == a_anchors_2_of_2[partition];
+	if(subset_count == 3) return texel_index == a_anchors_2_of_3[partition] || texel_index == a_anchors_3_of_3[partition];
+	return false;
+}
+
+typedef struct Bc7Mode {
+	u8 subset_count;
+	u8 partition_bit_count;
+	u8 rotation_bit_count;
+	u8 index_selection_bit_count;
+	u8 color_bit_count;
+	u8 alpha_bit_count;
+	u8 has_endpoint_p_bits;
+	u8 has_shared_p_bits;
+	u8 index_bit_count;
+	u8 secondary_index_bit_count;
+} Bc7Mode;
+
+static const Bc7Mode a_bc7_modes[8] = {
+	{ 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+	{ 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+	{ 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+	{ 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+	{ 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+	{ 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+	{ 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+	{ 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 }
+};
+
+static void decode_bc7_block(const u8 *p_block, u32 *p_texels) {
+	BlockBitReader reader = make_block_bit_reader(p_block);
+
+	u32 mode_index = 0;
+	while(mode_index < 8 && !read_bits(&reader, 1)) ++mode_index;
+	if(mode_index == 8) { // reserved mode
+		memset(p_texels, 0, BLOCK_TEXEL_COUNT * sizeof(u32));
+		return;
+	}
+	const Bc7Mode *p_mode = a_bc7_modes + mode_index;
+
+	u32 partition = read_bits(&reader, p_mode->partition_bit_count);
+	u32 rotation = read_bits(&reader, p_mode->rotation_bit_count);
+	u32 index_selection = read_bits(&reader, p_mode->index_selection_bit_count);
+
+	// endpoints are stored channel by channel: all reds, all greens, all blues, then all alphas
+	u32 a_endpoints[3][2][4] = { 0 }; // [subset][endpoint][channel]
+	for(u32 channel = 0; channel < 4; ++channel) {
+		u32 bit_count = (channel < 3) ? p_mode->color_bit_count : p_mode->alpha_bit_count;
+		for(u32 subset = 0; subset < p_mode->subset_count; ++subset) {
+			a_endpoints[subset][0][channel] = read_bits(&reader, bit_count);
+			a_endpoints[subset][1][channel] = read_bits(&reader, bit_count);
+		}
+	}
+
+	u32 color_bit_count = p_mode->color_bit_count;
+	u32 alpha_bit_count = p_mode->alpha_bit_count;
+	if(p_mode->has_endpoint_p_bits || p_mode->has_shared_p_bits) {
+		for(u32 subset = 0; subset < p_mode->subset_count; ++subset) {
+			u32 p_bit = 0;
+			for(u32 endpoint = 0; endpoint < 2; ++endpoint) {
+				if(p_mode->has_endpoint_p_bits || endpoint == 0) p_bit = read_bits(&reader, 1);
+				for(u32 channel = 0; channel < 4; ++channel) {
+					a_endpoints[subset][endpoint][channel] = (a_endpoints[subset][endpoint][channel] << 1) | p_bit;
+				}
+			}
+		}
+		color_bit_count++;
+		if(alpha_bit_count) alpha_bit_count++;
+	}
+
+	for(u32 subset = 0; subset < p_mode->subset_count; ++subset) {
+		for(u32 endpoint = 0; endpoint < 2; ++endpoint) {
+			for(u32 channel = 0; channel < 4; ++channel) {
+				u32 bit_count = (channel < 3) ? color_bit_count : alpha_bit_count;
+				u32 value = a_endpoints[subset][endpoint][channel];
+				a_endpoints[subset][endpoint][channel] = bit_count ? ((value << (8 - bit_count)) | (value >> (2 * bit_count - 8))) : 255;
+			}
+		}
+	}
+
+	u32 a_indices[BLOCK_TEXEL_COUNT];
+	u32 a_secondary_indices[BLOCK_TEXEL_COUNT];
+	for(u32 i = 0; i < BLOCK_TEXEL_COUNT; ++i) {
+		a_indices[i] = read_bits(&reader, p_mode->index_bit_count - is_anchor_texel(p_mode->subset_count, partition, i));
+	}
+	for(u32 i = 0; p_mode->secondary_index_bit_count && i < BLOCK_TEXEL_COUNT; ++i) {
+		a_secondary_indices[i] = read_bits(&reader, p_mode->secondary_index_bit_count - (i == 0));
+	}
+
+	for(u32 i = 0; i < BLOCK_TEXEL_COUNT; ++i) {
+		u32 subset = get_subset_index(p_mode->subset_count, partition, i);
+		u32 color_weight, alpha_weight;
+		if(!p_mode->secondary_index_bit_count) {
+			color_weight = alpha_weight = get_weights(p_mode->index_bit_count)[a_indices[i]];
+		}
+		else if(index_selection == 0) {
+			color_weight = get_weights(p_mode->index_bit_count)[a_indices[i]];
+			alpha_weight = get_weights(p_mode->secondary_index_bit_count)[a_secondary_indices[i]];
+		}
+		else {
+			color_weight = get_weights(p_mode->secondary_index_bit_count)[a_secondary_indices[i]];
+			alpha_weight = get_weights(p_mode->index_bit_count)[a_indices[i]];
+		}
+
+		u32 a_color[4];
+		for(u32 channel = 0; channel < 4; ++channel) {
+			u32 weight = (channel < 3) ? color_weight : alpha_weight;
+			a_color[channel] = ((64 - weight) * a_endpoints[subset][0][channel] + weight * a_endpoints[subset][1][channel] + 32) >> 6;
+		}
+		if(rotation) {
+			u32 temp = a_color[3];
+			a_color[3] = a_color[rotation - 1];
+			a_color[rotation - 1] = temp;
+		}
+		p_texels[i] = pack_rgba8(a_color[0], a_color[1], a_color[2], a_color[3]);
+	}
+}
+
+// BC6H header layouts, as runs of bits copied into the endpoint fields in stream order.
+// Fields are w, x, y, z (endpoints 0 and 1 of subset 0, then subset 1), each with r, g, b.
+typedef enum Bc6hField {
+	BC6H_RW = 0, BC6H_GW, BC6H_BW,
+	BC6H_RX, BC6H_GX, BC6H_BX,
+	BC6H_RY, BC6H_GY, BC6H_BY,
+	BC6H_RZ, BC6H_GZ, BC6H_BZ
+} Bc6hField;
+
+typedef struct Bc6hBitRun {
+	u8 field;
+	u8 first_bit;
+	u8 bit_count;
+} Bc6hBitRun;
+
+#define BC6H_MAX_BIT_RUN_COUNT 24
+
+typedef struct Bc6hMode {
+	u8 mode_bits;
+	u8 is_transformed;
+	u8 endpoint_bit_count;
+	u8 a_delta_bit_counts[3];
+	u8 subset_count;
+	Bc6hBitRun a_bit_runs[BC6H_MAX_BIT_RUN_COUNT];
+} Bc6hMode;
+
+static const Bc6hMode a_bc6h_modes[14] = {
+	{ 0x00, 1, 10, { 5, 5, 5 }, 2, {
+		{ BC6H_GY, 4, 1 }, { BC6H_BY, 4, 1 }, { BC6H_BZ, 4, 1 }, { BC6H_RW, 0, 10 }, { BC6H_GW, 0, 10 }, { BC6H_BW, 0, 10 },
+		{ BC6H_RX, 0, 5 }, { BC6H_GZ, 4, 1 }, { BC6H_GY, 0, 4 }, { BC6H_GX, 0, 5 }, { BC6H_BZ, 0, 1 }, { BC6H_GZ, 0, 4 },
+		{ BC6H_BX, 0, 5 }, { BC6H_BZ, 1, 1 }, { BC6H_BY, 0, 4 }, { BC6H_RY, 0, 5 }, { BC6H_BZ, 2, 1 }, { BC6H_RZ, 0, 5 }, { BC6H_BZ, 3, 1 } } },
+	{ 0x01, 1, 7, { 6, 6, 6 }, 2, {
+		{ BC6H_GY, 5, 1 }, { BC6H_GZ, 4, 2 }, { BC6H_RW, 0, 7 }, { BC6H_BZ, 0, 2 }, { BC6H_BY, 4, 1 }, { BC6H_GW, 0, 7 },
+		{ BC6H_BY, 5, 1 }, { BC6H_BZ, 2, 1 }, { BC6H_GY, 4, 1 }, { BC6H_BW, 0, 7 }, { BC6H_BZ, 3, 1 }, { BC6H_BZ, 5, 1 },
+		{ BC6H_BZ, 4, 1 }, { BC6H_RX, 0, 6 }, { BC6H_GY, 0, 4 }, { BC6H_GX, 0, 6 }, { BC6H_GZ, 0, 4 }, { BC6H_BX, 0, 6 },
+		{ BC6H_BY, 0, 4 }, { BC6H_RY, 0, 6 }, { BC6H_RZ, 0, 6 } } },
+	{ 0x02, 1, 11, { 5, 4, 4 }, 2, {
+		{ BC6H_RW, 0, 10 }, { BC6H_GW, 0, 10 }, { BC6H_BW, 0, 10 }, { BC6H_RX, 0, 5 }, { BC6H_RW, 10, 1 }, { BC6H_GY, 0, 4 },
+		{ BC6H_GX, 0, 4 }, { BC6H_GW, 10, 1 }, { BC6H_BZ, 0, 1 }, { BC6H_GZ, 0, 4 }, { BC6H_BX, 0, 4 }, { BC6H_BW, 10, 1 },
+		{ BC6H_BZ, 1, 1 }, { BC6H_BY, 0, 4 }, { BC6H_RY, 0, 5 }, { BC6H_BZ, 2, 1 }, { BC6H_RZ, 0, 5 }, { BC6H_BZ, 3, 1 } } },
+	{ 0x06, 1, 11, { 4, 5, 4 }, 2, {
+		{ BC6H_RW, 0, 10 }, { BC6H_GW, 0, 10 }, { BC6H_BW, 0, 10 }, { BC6H_RX, 0, 4 }, { BC6H_RW, 10, 1 }, { BC6H_GZ, 4, 1 },
+		{ BC6H_GY, 0, 4 }, { BC6H_GX, 0, 5 }, { BC6H_GW, 10, 1 }, { BC6H_GZ, 0, 4 }, { BC6H_BX, 0, 4 }, { BC6H_BW, 10, 1 },
+		{ BC6H_BZ, 1, 1 }, { BC6H_BY, 0, 4 }, { BC6H_RY, 0, 4 }, { BC6H_BZ, 0, 1 }, { BC6H_BZ, 2, 1 }, { BC6H_RZ, 0, 4 },
+		{ BC6H_GY, 4, 1 }, { BC6H_BZ, 3, 1 } } },
+	{ 0x0A, 1, 11, { 4, 4, 5 }, 2, {
+		{ BC6H_RW, 0, 10 }, { BC6H_GW, 0, 10 }, { BC6H_BW, 0, 10 }, { BC6H_RX, 0, 4 }, { BC6H_RW, 10, 1 }, { BC6H_BY, 4, 1 },
+		{ BC6H_GY, 0, 4 }, { BC6H_GX, 0, 4 }, { BC6H_GW, 10, 1 }, { BC6H_BZ, 0, 1 }, { BC6H_GZ, 0, 4 }, { BC6H_BX, 0, 5 },
+		{ BC6H_BW, 10, 1 }, { BC6H_BY, 0, 4 }, { BC6H_RY, 0, 4 }, { BC6H_BZ, 1, 2 }, { BC6H_RZ, 0, 4 }, { BC6H_BZ, 4, 1 },
+		{ BC6H_BZ, 3, 1 } } },
+	{ 0x0E, 1, 9, { 5, 5, 5 }, 2, {
+		{ BC6H_RW, 0, 9 }, { BC6H_BY, 4, 1 }, { BC6H_GW, 0, 9 }, { BC6H_GY, 4, 1 }, { BC6H_BW, 0, 9 }, { BC6H_BZ, 4, 1 },
+		{ BC6H_RX, 0, 5 }, { BC6H_GZ, 4, 1 }, { BC6H_GY, 0, 4 }, { BC6H_GX, 0, 5 }, { BC6H_BZ, 0, 1 }, { BC6H_GZ, 0, 4 },
+		{ BC6H_BX, 0, 5 }, { BC6H_BZ, 1, 1 }, { BC6H_BY, 0, 4 }, { BC6H_RY, 0, 5 }, { BC6H_BZ, 2, 1 }, { BC6H_RZ, 0, 5 }, { BC6H_BZ, 3, 1 } } },
+	{ 0x12, 1, 8, { 6, 5, 5 }, 2, {
+		{ BC6H_RW, 0, 8 }, { BC6H_GZ, 4, 1 }, { BC6H_BY, 4, 1 }, { BC6H_GW, 0, 8 }, { BC6H_BZ, 2, 1 }, { BC6H_GY, 4, 1 },
+		{ BC6H_BW, 0, 8 }, { BC6H_BZ, 3, 2 }, { BC6H_RX, 0, 6 }, { BC6H_GY, 0, 4 }, { BC6H_GX, 0, 5 }, { BC6H_BZ, 0, 1 },
+		{ BC6H_GZ, 0, 4 }, { BC6H_BX, 0, 5 }, { BC6H_BZ, 1, 1 }, { BC6H_BY, 0, 4 }, { BC6H_RY, 0, 6 }, { BC6H_RZ, 0, 6 } } },
+	{ 0x16, 1, 8, { 5, 6, 5 }, 2, {
+		{ BC6H_RW, 0, 8 }, { BC6H_BZ, 0, 1 }, { BC6H_BY, 4, 1 }, { BC6H_GW, 0, 8 }, { BC6H_GY, 5, 1 }, { BC6H_GY, 4, 1 },
+		{ BC6H_BW, 0, 8 }, { BC6H_GZ, 5, 1 }, { BC6H_BZ, 4, 1 }, { BC6H_RX, 0, 5 }, { BC6H_GZ, 4, 1 }, { BC6H_GY, 0, 4 },
+		{ BC6H_GX, 0, 6 }, { BC6H_GZ, 0, 4 }, { BC6H_BX, 0, 5 }, { BC6H_BZ, 1, 1 }, { BC6H_BY, 0, 4 }, { BC6H_RY, 0, 5 },
+		{ BC6H_BZ, 2, 1 }, { BC6H_RZ, 0, 5 }, { BC6H_BZ, 3, 1 } } },
+	{ 0x1A, 1, 8, { 5, 5, 6 }, 2, {
+		{ BC6H_RW, 0, 8 }, { BC6H_BZ, 1, 1 }, { BC6H_BY, 4, 1 }, { BC6H_GW, 0, 8 }, { BC6H_BY, 5, 1 }, { BC6H_GY, 4, 1 },
+		{ BC6H_BW, 0, 8 }, { BC6H_BZ, 5, 1 }, { BC6H_BZ, 4, 1 }, { BC6H_RX, 0, 5 }, { BC6H_GZ, 4, 1 }, { BC6H_GY, 0, 4 },
+		{ BC6H_GX, 0, 5 }, { BC6H_BZ, 0, 1 }, { BC6H_GZ, 0, 4 }, { BC6H_BX, 0, 6 }, { BC6H_BY, 0, 4 }, { BC6H_RY, 0, 5 },
+		{ BC6H_BZ, 2, 1 }, { BC6H_RZ, 0, 5 }, { BC6H_BZ, 3, 1 } } },
+	{ 0x1E, 0, 6, { 6, 6, 6 }, 2, {
+		{ BC6H_RW, 0, 6 }, { BC6H_GZ, 4, 1 }, { BC6H_BZ, 0, 2 }, { BC6H_BY, 4, 1 }, { BC6H_GW, 0, 6 }, { BC6H_GY, 5, 1 },
+		{ BC6H_BY, 5, 1 }, { BC6H_BZ, 2, 1 }, { BC6H_GY, 4, 1 }, { BC6H_BW, 0, 6 }, { BC6H_GZ, 5, 1 }, { BC6H_BZ, 3, 1 },
+		{ BC6H_BZ, 5, 1 }, { BC6H_BZ, 4, 1 }, { BC6H_RX, 0, 6 }, { BC6H_GY, 0, 4 }, { BC6H_GX, 0, 6 }, { BC6H_GZ, 0, 4 },
+		{ BC6H_BX, 0, 6 }, { BC6H_BY, 0, 4 }, { BC6H_RY, 0, 6 }, { BC6H_RZ, 0, 6 } } },
+	{ 0x03, 0, 10, { 10, 10, 10 }, 1, {
+		{ BC6H_RW, 0, 10 }, { BC6H_GW, 0, 10 }, { BC6H_BW, 0, 10 }, { BC6H_RX, 0, 10 }, { BC6H_GX, 0, 10 }, { BC6H_BX, 0, 10 } } },
+	{ 0x07, 1, 11, { 9, 9, 9 }, 1, {
+		{ BC6H_RW, 0, 10 }, { BC6H_GW, 0, 10 }, { BC6H_BW, 0, 10 }, { BC6H_RX, 0, 9 }, { BC6H_RW, 10, 1 }, { BC6H_GX, 0, 9 },
+		{ BC6H_GW, 10, 1 }, { BC6H_BX, 0, 9 }, { BC6H_BW, 10, 1 } } },
+	{ 0x0B, 1, 12, { 8, 8, 8 }, 1, { // the high bits of w are stored reversed
+		{ BC6H_RW, 0, 10 }, { BC6H_GW, 0, 10 }, { BC6H_BW, 0, 10 }, { BC6H_RX, 0, 8 }, { BC6H_RW, 11, 1 }, { BC6H_RW, 10, 1 },
+		{ BC6H_GX, 0, 8 }, { BC6H_GW, 11, 1 }, { BC6H_GW, 10, 1 }, { BC6H_BX, 0, 8 }, { BC6H_BW, 11, 1 }, { BC6H_BW, 10, 1 } } },
+	{ 0x0F, 1, 16, { 4, 4, 4 }, 1, {
+		{ BC6H_RW, 0, 10 }, { BC6H_GW, 0, 10 }, { BC6H_BW, 0, 10 }, { BC6H_RX, 0, 4 },
+		{ BC6H_RW, 15, 1 }, { BC6H_RW, 14, 1 }, { BC6H_RW, 13, 1 }, { BC6H_RW, 12, 1 }, { BC6H_RW, 11, 1 }, { BC6H_RW, 10, 1 }, { BC6H_GX, 0, 4 },
+		{ BC6H_GW, 15, 1 }, { BC6H_GW, 14, 1 }, { BC6H_GW, 13, 1 }, { BC6H_GW, 12, 1 }, { BC6H_GW, 11, 1 }, { BC6H_GW, 10, 1 }, { BC6H_BX, 0, 4 },
+		{ BC6H_BW, 15, 1 }, { BC6H_BW, 14, 1 }, { BC6H_BW, 13, 1 }, { BC6H_BW, 12, 1 }, { BC6H_BW, 11, 1 }, { BC6H_BW, 10, 1 } } }
+};
+
+static inline i32 sign_extend(u32 value, u32 bit_count) {
+	return (i32)(value << (32 - bit_count)) >> (32 - bit_count);
+}
+
+static inline u32 unquantize_bc6h_uf16(u32 value, u32 bit_count) {
+	if(bit_count >= 15) return value;
+	if(value == 0) return 0;
+	if(value == ((1u << bit_count) - 1)) return 0xFFFF;
+	return ((value << 16) + 0x8000) >> bit_count;
+}
+
+static inline f32 f32_from_half(u32 half) {
+	return _mm_cvtss_f32(_mm_cvtph_ps(_mm_cvtsi32_si128(half)));
+}
+
+static void decode_bc6h_uf16_block(const u8 *p_block, float4 *p_texels) {
+	BlockBitReader reader = make_block_bit_reader(p_block);
+
+	u32 mode_bits = read_bits(&reader, 2);
+	if(mode_bits > 1) mode_bits |= read_bits(&reader, 3) << 2;
+
+	const Bc6hMode *p_mode = NULL;
+	for(u32 i = 0; i < sizeof(a_bc6h_modes) / sizeof(a_bc6h_modes[0]); ++i) {
+		if(a_bc6h_modes[i].mode_bits == mode_bits) { p_mode = a_bc6h_modes + i; break; }
+	}
+	if(!p_mode) { // reserved mode
+		memset(p_texels, 0, BLOCK_TEXEL_COUNT * sizeof(float4));
+		return;
+	}
+
+	u32 a_fields[12] = { 0 };
+	for(u32 i = 0; i < BC6H_MAX_BIT_RUN_COUNT && p_mode->a_bit_runs[i].bit_count; ++i) {
+		const Bc6hBitRun *p_run = p_mode->a_bit_runs + i;
+		a_fields[p_run->field] |= read_bits(&reader, p_run->bit_count) << p_run->first_bit;
+	}
+	u32 partition = (p_mode->subset_count == 2) ? read_bits(&reader, 5) : 0;
+
+	// a_endpoints[subset][endpoint][channel], the deltas of transformed modes are relative to w
+	u32 a_endpoints[2][2][3];
+	u32 endpoint_mask = (1u << p_mode->endpoint_bit_count) - 1;
+	for(u32 channel = 0; channel < 3; ++channel) {
+		u32 w = a_fields[BC6H_RW + channel];
+		u32 a_others[3] = { a_fields[BC6H_RX + channel], a_fields[BC6H_RY + channel], a_fields[BC6H_RZ + channel] };
+		if(p_mode->is_transformed) {
+			for(u32 i = 0; i < 3; ++i) a_others[i] = (w + sign_extend(a_others[i], p_mode->a_delta_bit_counts[channel])) & endpoint_mask;
+		}
+		a_endpoints[0][0][channel] = unquantize_bc6h_uf16(w, p_mode->endpoint_bit_count);
+		a_endpoints[0][1][channel] = unquantize_bc6h_uf16(a_others[0], p_mode->endpoint_bit_count);
+		a_endpoints[1][0][channel] = unquantize_bc6h_uf16(a_others[1], p_mode->endpoint_bit_count);
+		a_endpoints[1][1][channel] = unquantize_bc6h_uf16(a_others[2], p_mode->endpoint_bit_count);
+	}
+
+	u32 index_bit_count = (p_mode->subset_count == 2) ? 3 : 4;
+	const u8 *p_weights = get_weights(index_bit_count);
+	for(u32 i = 0; i < BLOCK_TEXEL_COUNT; ++i) {
+		u32 index = read_bits(&reader, index_bit_count - is_anchor_texel(p_mode->subset_count, partition, i));
+		u32 subset = get_subset_index(p_mode->subset_count, partition, i);
+		u32 weight = p_weights[index];
+		f32 a_color[3];
+		for(u32 channel = 0; channel < 3; ++channel) {
+			u32 value = ((64 - weight) * a_endpoints[subset][0][channel] + weight * a_endpoints[subset][1][channel] + 32) >> 6;
+			a_color[channel] = f32_from_half((value * 31) >> 6);
+		}
+		p_texels[i] = (float4) { a_color[0], a_color[1], a_color[2], 1.f };
+	}
+}
+
+//----------------------------------------  DECODED BLOCK CACHE  ---------------------------------------------------------------------------------------------------------------------------------------//
+
+#define DECODED_BLOCK_CACHE_COUNT 4			// textures a thread keeps blocks of at the same time
+#define DECODED_BLOCK_CACHE_SIZE (16*1024)	// 256 R8G8B8A8 or 64 R32G32B32A32 blocks
+#define DECODED_BLOCK_CACHE_MAX_ENTRY_COUNT (DECODED_BLOCK_CACHE_SIZE/(BLOCK_TEXEL_COUNT*sizeof(u32)))
+
+// Direct mapped on the block index
+typedef struct DecodedBlockCache {
+	__declspec(align(64)) u8 a_texels[DECODED_BLOCK_CACHE_SIZE];
+	i32 a_tags[DECODED_BLOCK_CACHE_MAX_ENTRY_COUNT];	// block index, -1 if empty
+	const void *p_blocks;								// texture the entries belong to
+	long epoch;											// of decoded_block_cache_epoch when they were decoded
+	u32 last_use;
+} DecodedBlockCache;
+
+static __declspec(thread) DecodedBlockCache a_decoded_block_caches[DECODED_BLOCK_CACHE_COUNT];
+static __declspec(thread) u32 decoded_block_cache_clock;
+static volatile long decoded_block_cache_epoch;
+
+u32 get_block_size(TextureFormat format) {
+	return (format == TEXTURE_FORMAT_BC1_UNORM || format == TEXTURE_FORMAT_BC1_UNORM_SRGB) ? 8 : 16;
+}
+
+static inline u32 get_decoded_texel_size(TextureFormat format) {
+	return (format == TEXTURE_FORMAT_BC6H_UF16) ? sizeof(float4) : sizeof(u32);
+}
+
+void invalidate_decoded_block_caches(void) {
+	_InterlockedIncrement(&decoded_block_cache_epoch);
+}
+
+static DecodedBlockCache* get_decoded_block_cache(Texture2D tex) {
+	long epoch = decoded_block_cache_epoch;
+	DecodedBlockCache *p_victim = a_decoded_block_caches;
+	for(u32 i = 0; i < DECODED_BLOCK_CACHE_COUNT; ++i) {
+		DecodedBlockCache *p_cache = a_decoded_block_caches + i;
+		if(p_cache->p_blocks == tex.p_data && p_cache->epoch == epoch) {
+			p_cache->last_use = ++decoded_block_cache_clock;
+			return p_cache;
+		}
+		if(p_cache->last_use < p_victim->last_use) p_victim = p_cache;
+	}
+	memset(p_victim->a_tags, 0xFF, sizeof(p_victim->a_tags));
+	p_victim->p_blocks = tex.p_data;
+	p_victim->epoch = epoch;
+	p_victim->last_use = ++decoded_block_cache_clock;
+	return p_victim;
+}
+
+static void decode_block(Texture2D tex, u32 block_index, void *p_texels) {
+	const u8 *p_block = (const u8*)tex.p_data + block_index * get_block_size(tex.format);
+	switch(tex.format) {
+		case TEXTURE_FORMAT_BC1_UNORM:
+		case TEXTURE_FORMAT_BC1_UNORM_SRGB: decode_bc1_block(p_block, p_texels); break;
+		case TEXTURE_FORMAT_BC3_UNORM:
+		case TEXTURE_FORMAT_BC3_UNORM_SRGB: decode_bc3_block(p_block, p_texels); break;
+		case TEXTURE_FORMAT_BC7_UNORM:
+		case TEXTURE_FORMAT_BC7_UNORM_SRGB: decode_bc7_block(p_block, p_texels); break;
+		case TEXTURE_FORMAT_BC6H_UF16: decode_bc6h_uf16_block(p_block, p_texels); break;
+		default: assert(false);
+	}
+
+	// same conversion as the uncompressed srgb textures get at load time, alpha is kept linear
+	if(tex.format == TEXTURE_FORMAT_BC1_UNORM_SRGB || tex.format == TEXTURE_FORMAT_BC3_UNORM_SRGB || tex.format == TEXTURE_FORMAT_BC7_UNORM_SRGB) {
+		u32 *p_colors = (u32*)p_texels;
+		for(u32 i = 0; i < BLOCK_TEXEL_COUNT; ++i) {
+			u32 color = p_colors[i];
+			p_colors[i] = pack_rgba8(a_linear_from_srgb_u32[color & 0xFF], a_linear_from_srgb_u32[(color >> 8) & 0xFF], a_linear_from_srgb_u32[(color >> 16) & 0xFF], color >> 24);
+		}
+	}
+}
+
+// Returns the lanes of pending whose blocks are in the cache. If there are none, the block of the first pending lane is
+// decoded first, so every call makes progress even when several blocks of the same row map to the same entry.
+static inline i256 get_cached_lanes_x8(DecodedBlockCache *p_cache, Texture2D tex, i256 block_index, i256 entry_index, i256 pending) {
+	i256 tags = _mm256_mask_i32gather_epi32(_mm256_set1_epi32(-1), p_cache->a_tags, entry_index, pending, 4);
+	i256 hit = _mm256_and_si256(_mm256_cmpeq_epi32(tags, block_index), pending);
+	if(!_mm256_testz_si256(hit, hit)) return hit;
+
+	__declspec(align(32)) i32 a_block_indices[8];
+	__declspec(align(32)) i32 a_entry_indices[8];
+	_mm256_store_si256((i256*)a_block_indices, block_index);
+	_mm256_store_si256((i256*)a_entry_indices, entry_index);
+	u32 lane = _tzcnt_u32(_mm256_movemask_ps(_mm256_castsi256_ps(pending)));
+	i32 entry = a_entry_indices[lane];
+	decode_block(tex, a_block_indices[lane], p_cache->a_texels + entry * BLOCK_TEXEL_COUNT * get_decoded_texel_size(tex.format));
+	p_cache->a_tags[entry] = a_block_indices[lane];
+
+	return _mm256_and_si256(_mm256_cmpeq_epi32(block_index, _mm256_set1_epi32(a_block_indices[lane])), pending);
+}
+
+// Block index, cache entry and texel index within the cache's texel array of the 8 lanes
+#define COMPUTE_BLOCK_CACHE_INDICES_X8(tex, s, t, entry_count) \
+	i256 block_index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(t, 2), _mm256_set1_epi32(tex.width_in_blocks)), _mm256_srli_epi32(s, 2)); \
+	i256 entry_index = _mm256_and_si256(block_index, _mm256_set1_epi32(entry_count - 1)); \
+	i256 texel_in_block = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(t, _mm256_set1_epi32(3)), 2), _mm256_and_si256(s, _mm256_set1_epi32(3))); \
+	i256 texel_index = _mm256_or_si256(_mm256_slli_epi32(entry_index, 4), texel_in_block);
+
+i256 fetch_block_compressed_unorm8_x8(Texture2D tex, i256 s, i256 t, i256 mask) {
+	DecodedBlockCache *p_cache = get_decoded_block_cache(tex);
+	COMPUTE_BLOCK_CACHE_INDICES_X8(tex, s, t, DECODED_BLOCK_CACHE_SIZE / (BLOCK_TEXEL_COUNT * sizeof(u32)));
+
+	i256 texels = _mm256_setzero_si256();
+	i256 pending = mask;
+	while(!_mm256_testz_si256(pending, pending)) {
+		i256 hit = get_cached_lanes_x8(p_cache, tex, block_index, entry_index, pending);
+		texels = _mm256_mask_i32gather_epi32(texels, (const int*)p_cache->a_texels, texel_index, hit, 4);
+		pending = _mm256_andnot_si256(hit, pending);
+	}
+	return texels;
+}
+
+v4f256 fetch_block_compressed_float4_x8(Texture2D tex, i256 s, i256 t, i256 mask) {
+	DecodedBlockCache *p_cache = get_decoded_block_cache(tex);
+	COMPUTE_BLOCK_CACHE_INDICES_X8(tex, s, t, DECODED_BLOCK_CACHE_SIZE / (BLOCK_TEXEL_COUNT * sizeof(float4)));
+	texel_index = _mm256_slli_epi32(texel_index, 2);
+
+	v4f256 texels = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+	i256 pending = mask;
+	while(!_mm256_testz_si256(pending, pending)) {
+		f256 hit = _mm256_castsi256_ps(get_cached_lanes_x8(p_cache, tex, block_index, entry_index, pending));
+		const f32 *p_texels = (const f32*)p_cache->a_texels;
+		texels.x = _mm256_mask_i32gather_ps(texels.x, p_texels + 0, texel_index, hit, 4);
+		texels.y = _mm256_mask_i32gather_ps(texels.y, p_texels + 1, texel_index, hit, 4);
+		texels.z = _mm256_mask_i32gather_ps(texels.z, p_texels + 2, texel_index, hit, 4);
+		texels.w = _mm256_mask_i32gather_ps(texels.w, p_texels + 3, texel_index, hit, 4);
+		pending = _mm256_andnot_si256(_mm256_castps_si256(hit), pending);
+	}
+	return texels;
+}
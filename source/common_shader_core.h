@@ -1,4 +1,5 @@
 #pragma once
+#include <stdbool.h>
 #include "math.h"
 
 typedef v2f32 float2;
@@ -7,42 +8,183 @@ typedef v4f32 float4;
 typedef uint32_t uint;
 typedef m4x4f32 float4x4;
 
+// Vertex shader outputs are tightly packed f256 components with SV_POSITION in the first four, so out_vertex_size is
+// the output signature: out_vertex_size / sizeof(f256) components get clipped and interpolated. Pixel shader inputs
+// have to be a prefix of it.
 typedef struct VertexShader {
 	unsigned int in_vertex_size;
 	unsigned int out_vertex_size;
 	void(*vs_main)();
 }VertexShader;
 
+#define PIXEL_TILE_ROW_COUNT 8
+
+// One triangle's fragments inside an 8x8 tile, handed to a pixel shader in a single call
+typedef struct PixelTile {
+	i256 a_row_masks[PIXEL_TILE_ROW_COUNT];
+	const void *p_row_inputs;	// PIXEL_TILE_ROW_COUNT rows of interpolated pixel shader inputs
+	uint row_input_stride;		// in bytes
+	uint active_row_mask;		// bit i is set if row i has any fragment that passed the depth test
+} PixelTile;
+
 typedef struct PixelShader {
 	void(*ps_main)();
+	void(*ps_tile_main)(); // optional, writes PIXEL_TILE_ROW_COUNT rows of outputs
 } PixelShader;
 
+typedef enum TextureLayout {
+	TEXTURE_LAYOUT_LINEAR = 0,
+	TEXTURE_LAYOUT_TILED_4X4	// 4x4 texel blocks stored contiguously, blocks in row-major order
+} TextureLayout;
+
+#define TEXTURE_BLOCK_DIM 4
+
+typedef enum TextureFormat {
+	TEXTURE_FORMAT_R8G8B8A8_UNORM = 0,
+	TEXTURE_FORMAT_R32G32B32A32_FLOAT,
+	TEXTURE_FORMAT_R16G16B16A16_FLOAT,
+	TEXTURE_FORMAT_BC1_UNORM,
+	TEXTURE_FORMAT_BC1_UNORM_SRGB,
+	TEXTURE_FORMAT_BC3_UNORM,
+	TEXTURE_FORMAT_BC3_UNORM_SRGB,
+	TEXTURE_FORMAT_BC7_UNORM,
+	TEXTURE_FORMAT_BC7_UNORM_SRGB,
+	TEXTURE_FORMAT_BC6H_UF16
+} TextureFormat;
+
 typedef struct Texture2D {
 	void *p_data;
 	uint width;
 	uint height;
+	TextureLayout layout;
+	uint width_in_blocks;	// row pitch of TEXTURE_LAYOUT_TILED_4X4 and block compressed textures
+	TextureFormat format;
 } Texture2D;
 
+// The 6 faces are stacked vertically in +X, -X, +Y, -Y, +Z, -Z order, in a face_size x 6*face_size texture.
+// Faces are addressed like D3D's: on +Z, u goes along +X and v along -Y.
+typedef struct TextureCube {
+	Texture2D faces;
+	uint face_size;
+} TextureCube;
+
+inline bool is_block_compressed(TextureFormat format) {
+	return format >= TEXTURE_FORMAT_BC1_UNORM;
+}
+
+// Block compressed textures are sampled through a per-thread cache of decoded blocks (see block_compression.c).
+// BC1/BC3/BC7 decode to R8G8B8A8 texels, BC6H to R32G32B32A32 ones. s and t have to be in range already.
+uint get_block_size(TextureFormat format);
+i256 fetch_block_compressed_unorm8_x8(Texture2D tex, i256 s, i256 t, i256 mask);
+v4f256 fetch_block_compressed_float4_x8(Texture2D tex, i256 s, i256 t, i256 mask);
+// 8-bit srgb to 8-bit linear, filled by init before any texture is loaded. The srgb block formats are linearized with it
+// as they are decoded.
+extern u32 a_linear_from_srgb_u32[256];
+// The caches are keyed by the address of the blocks. Call it whenever a texture is freed, so a texture that is loaded at
+// the same address later doesn't get the blocks of the freed one.
+void invalidate_decoded_block_caches(void);
+
+typedef enum Filter {
+	FILTER_POINT = 0,
+	FILTER_LINEAR,
+	FILTER_COUNT
+} Filter;
+
+typedef enum TextureAddressMode {
+	TEXTURE_ADDRESS_WRAP = 0,
+	TEXTURE_ADDRESS_MIRROR,
+	TEXTURE_ADDRESS_CLAMP,
+	TEXTURE_ADDRESS_BORDER,
+	TEXTURE_ADDRESS_COUNT
+} TextureAddressMode;
+
+typedef struct SamplerDesc {
+	Filter filter;
+	TextureAddressMode address_u;
+	TextureAddressMode address_v;
+	f32 border_color[4];
+} SamplerDesc;
+
+// Immutable after creation, the kernels are specialized for the desc's filter and address modes (see sampler.c)
+typedef struct SamplerState {
+	SamplerDesc desc;
+	v4f256(*sample_unorm8_x8)(Texture2D tex, const struct SamplerState *p_sampler, f256 u, f256 v, i256 mask);	// R8G8B8A8, BC1, BC3 and BC7 textures
+	v4f256(*sample_float4_x8)(Texture2D tex, const struct SamplerState *p_sampler, f256 u, f256 v, i256 mask);	// R32G32B32A32, R16G16B16A16 and BC6H textures
+	v4f256(*sample_cube_x8)(TextureCube tex, const struct SamplerState *p_sampler, v3f256 dir, i256 mask);	// float cubes, clamped at the face edges
+} SamplerState;
+
+void create_sampler_state(const SamplerDesc *p_desc, SamplerState *p_sampler);
+
+inline uint get_texel_index(Texture2D tex, i32 s, i32 t) {
+	if(tex.layout == TEXTURE_LAYOUT_TILED_4X4) {
+		uint block_index = (t / TEXTURE_BLOCK_DIM) * tex.width_in_blocks + (s / TEXTURE_BLOCK_DIM);
+		return block_index * TEXTURE_BLOCK_DIM * TEXTURE_BLOCK_DIM + (t % TEXTURE_BLOCK_DIM) * TEXTURE_BLOCK_DIM + (s % TEXTURE_BLOCK_DIM);
+	}
+	return t * tex.width + s;
+}
+
+// s and t have to be in range already
+inline i256 get_texel_index_x8(Texture2D tex, i256 s, i256 t) {
+	if(tex.layout == TEXTURE_LAYOUT_TILED_4X4) {
+		i256 block_index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(t, 2), _mm256_set1_epi32(tex.width_in_blocks)), _mm256_srli_epi32(s, 2));
+		i256 texel_in_block = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(t, _mm256_set1_epi32(3)), 2), _mm256_and_si256(s, _mm256_set1_epi32(3)));
+		return _mm256_or_si256(_mm256_slli_epi32(block_index, 4), texel_in_block);
+	}
+	return _mm256_add_epi32(_mm256_mullo_epi32(t, _mm256_set1_epi32(tex.width)), s);
+}
+
 inline uint get_texel_u(Texture2D tex, i32 s, i32 t) {
-	return *(((uint*)tex.p_data) + MAX(MIN(t, tex.height - 1), 0) * tex.width + MAX(MIN(s, tex.width - 1), 0));
+	return *(((uint*)tex.p_data) + get_texel_index(tex, MAX(MIN(s, (i32)tex.width - 1), 0), MAX(MIN(t, (i32)tex.height - 1), 0)));
 }
 
 inline i256 get_texel_u_x8(Texture2D tex, i256 s, i256 t) {
 	s = _mm256_max_epi32(_mm256_min_epi32(s, _mm256_set1_epi32(tex.width  - 1)), _mm256_set1_epi32(0));
 	t = _mm256_max_epi32(_mm256_min_epi32(t, _mm256_set1_epi32(tex.height - 1)), _mm256_set1_epi32(0));
-	s = _mm256_add_epi32(_mm256_mullo_epi32(t, _mm256_set1_epi32(tex.width)), s);
+	s = get_texel_index_x8(tex, s, t);
 	i256 result = _mm256_i32gather_epi32(tex.p_data, s, 4);
 	return result;
 }
 
+// Gathers 8 R16G16B16A16 texels with two 64-bit gathers and converts them to 4 f32 registers
+inline v4f256 gather_r16g16b16a16_x8(const void *p_data, i256 index, i256 mask) {
+	i256 texels_0123 = _mm256_mask_i32gather_epi64(_mm256_setzero_si256(), (const long long*)p_data, _mm256_castsi256_si128(index), _mm256_cvtepi32_epi64(_mm256_castsi256_si128(mask)), 8);
+	i256 texels_4567 = _mm256_mask_i32gather_epi64(_mm256_setzero_si256(), (const long long*)p_data, _mm256_extracti128_si256(index, 1), _mm256_cvtepi32_epi64(_mm256_extracti128_si256(mask, 1)), 8);
+
+	// rgba rgba per 128-bit lane -> rr gg bb aa
+	const i256 channel_pairs = _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15, 0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+	texels_0123 = _mm256_shuffle_epi8(texels_0123, channel_pairs);
+	texels_4567 = _mm256_shuffle_epi8(texels_4567, channel_pairs);
+	// r01 r23 g01 g23 | b01 b23 a01 a23
+	const i256 channel_quads = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	texels_0123 = _mm256_permutevar8x32_epi32(texels_0123, channel_quads);
+	texels_4567 = _mm256_permutevar8x32_epi32(texels_4567, channel_quads);
+	// r0-7 | b0-7 and g0-7 | a0-7
+	i256 red_blue = _mm256_unpacklo_epi64(texels_0123, texels_4567);
+	i256 green_alpha = _mm256_unpackhi_epi64(texels_0123, texels_4567);
+
+	v4f256 result;
+	result.x = _mm256_cvtph_ps(_mm256_castsi256_si128(red_blue));
+	result.y = _mm256_cvtph_ps(_mm256_castsi256_si128(green_alpha));
+	result.z = _mm256_cvtph_ps(_mm256_extracti128_si256(red_blue, 1));
+	result.w = _mm256_cvtph_ps(_mm256_extracti128_si256(green_alpha, 1));
+	return result;
+}
+
 inline float4 get_texel_f(Texture2D tex, i32 s, i32 t) {
-	return *(((float4*)tex.p_data) + MAX(MIN(t, tex.height - 1), 0) * tex.width + MAX(MIN(s, tex.width - 1), 0));
+	uint index = get_texel_index(tex, MAX(MIN(s, (i32)tex.width - 1), 0), MAX(MIN(t, (i32)tex.height - 1), 0));
+	if(tex.format == TEXTURE_FORMAT_R16G16B16A16_FLOAT) {
+		float4 texel;
+		_mm_storeu_ps((f32*)&texel, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)((u64*)tex.p_data + index))));
+		return texel;
+	}
+	return *(((float4*)tex.p_data) + index);
 }
 
 inline v4f256 get_texel_f_x8(Texture2D tex, i256 s, i256 t) {
 	s = _mm256_max_epi32(_mm256_min_epi32(s, _mm256_set1_epi32(tex.width - 1)), _mm256_set1_epi32(0));
 	t = _mm256_max_epi32(_mm256_min_epi32(t, _mm256_set1_epi32(tex.height - 1)), _mm256_set1_epi32(0));
-	s = _mm256_add_epi32(_mm256_mullo_epi32(t, _mm256_set1_epi32(tex.width)), s);
+	s = get_texel_index_x8(tex, s, t);
+	if(tex.format == TEXTURE_FORMAT_R16G16B16A16_FLOAT) return gather_r16g16b16a16_x8(tex.p_data, s, _mm256_set1_epi32(-1));
 	s = _mm256_mullo_epi32(s, _mm256_set1_epi32(4));
 	v4f256 result;
 	result.x = _mm256_i32gather_ps(tex.p_data, s, 4);
@@ -59,13 +201,6 @@ inline v4f32 point_u(Texture2D tex, f32 u, f32 v) {
 	return texel;
 }
 
-inline v4f256 point_u_x8(Texture2D tex, f256 u, f256 v) {
-	i256 s = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_set1_ps((f32)tex.width), u));
-	i256 t = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_set1_ps((f32)tex.height), _mm256_sub_ps(_mm256_set1_ps(1.0), v)));
-	v4f256 texel = decode_u32_as_color_x8(get_texel_u_x8(tex, s, t));
-	return texel;
-}
-
 inline v4f32 point_f(Texture2D tex, f32 u, f32 v) {
 	i32 s = (i32)(tex.width * u);
 	i32 t = (i32)(tex.height * (1.0 - v));
@@ -73,13 +208,6 @@ inline v4f32 point_f(Texture2D tex, f32 u, f32 v) {
 	return texel;
 }
 
-inline v4f256 point_f_x8(Texture2D tex, f256 u, f256 v) {
-	i256 s = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_set1_ps((f32)tex.width), u));
-	i256 t = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_set1_ps((f32)tex.height), _mm256_sub_ps(_mm256_set1_ps(1.0), v)));
-	v4f256 texel = get_texel_f_x8(tex, s, t);
-	return texel;
-}
-
 inline v4f32 bilinear_u(Texture2D tex, f32 u, f32 v) {
 	f32 s_f32 = tex.width * u - 0.5;
 	f32 t_f32 = tex.height * (1.0 - v) - 0.5;
@@ -100,26 +228,6 @@ inline v4f32 bilinear_u(Texture2D tex, f32 u, f32 v) {
 	return result;
 }
 
-inline v4f256 bilinear_u_x8(Texture2D tex, f256 u, f256 v) {
-	f256 s_f32 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps((f32)tex.width), u), _mm256_set1_ps(-0.5));
-	f256 t_f32 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps((f32)tex.height), _mm256_sub_ps(_mm256_set1_ps(1.0),  v)), _mm256_set1_ps(-0.5));
-	i256 s = _mm256_cvtps_epi32(_mm256_floor_ps(s_f32));
-	i256 t = _mm256_cvtps_epi32(_mm256_floor_ps(t_f32));
-	f256 frac_s = _mm256_sub_ps(s_f32, _mm256_cvtepi32_ps(s));
-	f256 frac_t = _mm256_sub_ps(t_f32, _mm256_cvtepi32_ps(t));
-
-	v4f256 texel_00 = decode_u32_as_color_x8(get_texel_u_x8(tex, s, t));
-	v4f256 texel_10 = decode_u32_as_color_x8(get_texel_u_x8(tex, _mm256_add_epi32(s, _mm256_set1_epi32(1)), t));
-	v4f256 texel_0010 = v4f256_lerp(texel_00, texel_10, frac_s);
-	
-	v4f256 texel_01 = decode_u32_as_color_x8(get_texel_u_x8(tex, s, _mm256_add_epi32(t, _mm256_set1_epi32(1))));
-	v4f256 texel_11 = decode_u32_as_color_x8(get_texel_u_x8(tex, _mm256_add_epi32(s, _mm256_set1_epi32(1)), _mm256_add_epi32(t, _mm256_set1_epi32(1))));
-	v4f256 texel_0111 = v4f256_lerp(texel_01, texel_11, frac_s);
-
-	v4f256 result = v4f256_lerp(texel_0010, texel_0111, frac_t);
-	return result;
-}
-
 inline v4f32 bilinear_f(Texture2D tex, f32 u, f32 v) {
 	f32 s_f32 = tex.width * u - 0.5;
 	f32 t_f32 = tex.height * (1.0 - v) - 0.5;
@@ -140,68 +248,22 @@ inline v4f32 bilinear_f(Texture2D tex, f32 u, f32 v) {
 	return result;
 }
 
-inline v4f256 bilinear_f_x8(Texture2D tex, f256 u, f256 v) {
-	f256 s_f32 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps((f32)tex.width), u), _mm256_set1_ps(-0.5));
-	f256 t_f32 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps((f32)tex.height), _mm256_sub_ps(_mm256_set1_ps(1.0), v)), _mm256_set1_ps(-0.5));
-	i256 s = _mm256_cvtps_epi32(_mm256_floor_ps(s_f32));
-	i256 t = _mm256_cvtps_epi32(_mm256_floor_ps(t_f32));
-	f256 frac_s = _mm256_sub_ps(s_f32, _mm256_cvtepi32_ps(s));
-	f256 frac_t = _mm256_sub_ps(t_f32, _mm256_cvtepi32_ps(t));
-
-	v4f256 texel_00 = get_texel_f_x8(tex, s, t);
-	v4f256 texel_10 = get_texel_f_x8(tex, _mm256_add_epi32(s, _mm256_set1_epi32(1)), t);
-	v4f256 texel_0010 = v4f256_lerp(texel_00, texel_10, frac_s);
-
-	v4f256 texel_01 = get_texel_f_x8(tex, s, _mm256_add_epi32(t, _mm256_set1_epi32(1)));
-	v4f256 texel_11 = get_texel_f_x8(tex, _mm256_add_epi32(s, _mm256_set1_epi32(1)), _mm256_add_epi32(t, _mm256_set1_epi32(1)));
-	v4f256 texel_0111 = v4f256_lerp(texel_01, texel_11, frac_s);
-
-	v4f256 result = v4f256_lerp(texel_0010, texel_0111, frac_t);
-	return result;
-}
-
 inline float4 sample_2D(Texture2D tex, float2 tex_coord) {
 	float4 texel = get_texel_f(tex, tex_coord.x, tex_coord.y);
 	return texel;
 }
 
-inline v4f256 sample_2D_x8_masked(Texture2D tex, v2f256 tex_coord, i256 mask) {
-	v4f256 result;
-	v4f32 a_texels[8];
-	f32 a_u_s[8];
-	f32 a_v_s[8];
-	for(i32 i = 0; i < 8; ++i) {
-		if(!mask.m256i_i32[i]) continue;
-		_mm256_store_ps(a_u_s, tex_coord.x);
-		_mm256_store_ps(a_v_s, tex_coord.y);
-
-		//a_texels[i] = point_u(tex, a_u_s[i], a_v_s[i]);
-		a_texels[i] = bilinear_u(tex, a_u_s[i], a_v_s[i]);
-	}
-	
-	const i256 offset = _mm256_set_epi32(
-		sizeof(v4f32)*7, sizeof(v4f32) * 6, sizeof(v4f32) * 5, sizeof(v4f32) * 4, 
-		sizeof(v4f32) * 3, sizeof(v4f32) * 2, sizeof(v4f32) * 1, 0);
-	
-	result.x = _mm256_i32gather_ps(((f32*)a_texels), offset, 1);
-	result.y = _mm256_i32gather_ps(((f32*)a_texels) + 1, offset, 1);
-	result.z = _mm256_i32gather_ps(((f32*)a_texels) + 2, offset, 1);
-	result.w = _mm256_i32gather_ps(((f32*)a_texels) + 3, offset, 1);
-
-	return result;
-
+inline v4f256 sample_2D_u_x8(Texture2D tex, const SamplerState *p_sampler, v2f256 tex_coord, i256 mask) {
+	return p_sampler->sample_unorm8_x8(tex, p_sampler, tex_coord.x, tex_coord.y, mask);
 }
 
-inline v4f256 sample_2D_u_x8(Texture2D tex, v2f256 tex_coord, i256 mask) {
-	//v4f256 result = point_u_x8(tex, tex_coord.x, tex_coord.y);
-	v4f256 result = bilinear_u_x8(tex, tex_coord.x, tex_coord.y);
-	return result;
+inline v4f256 sample_2D_f_x8(Texture2D tex, const SamplerState *p_sampler, v2f256 tex_coord, i256 mask) {
+	return p_sampler->sample_float4_x8(tex, p_sampler, tex_coord.x, tex_coord.y, mask);
 }
 
-inline v4f256 sample_2D_f_x8(Texture2D tex, v2f256 tex_coord) {
-	//v4f256 result = point_f_x8(tex, tex_coord.x, tex_coord.y);
-	v4f256 result = bilinear_f_x8(tex, tex_coord.x, tex_coord.y);
-	return result;
+// dir does not need to be normalized
+inline v4f256 sample_cube_x8(TextureCube tex, const SamplerState *p_sampler, v3f256 dir, i256 mask) {
+	return p_sampler->sample_cube_x8(tex, p_sampler, dir, mask);
 }
 
 inline float4 sample_2D_latlon(Texture2D tex, float3 dir) {
@@ -223,15 +285,15 @@ inline float4 sample_2D_latlon(Texture2D tex, float3 dir) {
 	return sample_2D(tex, (float2) { uv_x, uv_y });
 }
 
-inline v4f256 sample_2D_latlon_x8(Texture2D tex, v3f256 dir) {
+inline v4f256 sample_2D_latlon_x8(Texture2D tex, const SamplerState *p_sampler, v3f256 dir, i256 mask) {
 	f256 cos_theta = v3f256_dot(v3f256_normalize((v3f256) { _mm256_set1_ps(0.0), _mm256_set1_ps(0.0), _mm256_set1_ps(1.0)}), dir);
 	v3f256 cos_xy = v3f256_normalize((v3f256) { dir.x, dir.y, _mm256_set1_ps(0) });
 	f256 cos_x = v3f256_dot(v3f256_normalize((v3f256) { _mm256_set1_ps(1.0), _mm256_set1_ps(0.0), _mm256_set1_ps(0.0) }), cos_xy);
 	f256 cos_y = v3f256_dot(v3f256_normalize((v3f256) { _mm256_set1_ps(0.0), _mm256_set1_ps(1.0), _mm256_set1_ps(0.0) }), cos_xy);
 
-	f256 acos_x_over_tau = _mm256_mul_ps(_mm256_acos_ps(cos_x), _mm256_set1_ps(1.0 / TAU));
+	f256 acos_x_over_tau = _mm256_mul_ps(f256_acos(cos_x), _mm256_set1_ps(1.0 / TAU));
 	f256 uv_x = _mm256_blendv_ps(_mm256_sub_ps(_mm256_set1_ps(1.0), acos_x_over_tau), acos_x_over_tau, _mm256_cmp_ps(cos_y, _mm256_set1_ps(0.0), _CMP_GE_OQ));
-	f256 uv_y = _mm256_mul_ps(_mm256_acos_ps(cos_theta), _mm256_set1_ps(1.0 / PI));
+	f256 uv_y = _mm256_mul_ps(f256_acos(cos_theta), _mm256_set1_ps(1.0 / PI));
 	
 	f256 pos_cond = _mm256_cmp_ps(cos_theta, _mm256_set1_ps(0.999), _CMP_GT_OQ);
 	f256 neg_cond = _mm256_cmp_ps(cos_theta, _mm256_set1_ps(-0.999), _CMP_LT_OQ);
@@ -240,5 +302,5 @@ inline v4f256 sample_2D_latlon_x8(Texture2D tex, v3f256 dir) {
 	uv_y = _mm256_blendv_ps(uv_y, _mm256_set1_ps(1.0), neg_cond);
 	uv_y = _mm256_sub_ps(_mm256_set1_ps(1.0), uv_y);
 
-	return sample_2D_f_x8(tex, (v2f256) { uv_x, uv_y });
+	return sample_2D_f_x8(tex, p_sampler, (v2f256) { uv_x, uv_y }, mask);
 }
\ No newline at end of file
@@ -9,8 +9,6 @@ typedef struct Vs_Input {
 typedef struct Vs_Output {
 	v4f256 SV_POSITION;
 	v3f256 VIEW_DIR;
-	v2f256 UV;
-	f256 _pad[3];
 }Vs_Output;
 
 typedef struct ConstantBuffer{
@@ -19,7 +17,7 @@ typedef struct ConstantBuffer{
 	float4x4 world_from_view;
 } ConstantBuffer;
 
-static void vs_main(const void *p_vertex_input_data, void *p_vertex_output_data, const void **pp_constant_buffers) {
+void fullscreen_vs_main(const void *p_vertex_input_data, void *p_vertex_output_data, const void **pp_constant_buffers, const void **pp_shader_resource_views, const SamplerState **pp_samplers) {
 	Vs_Input *p_in = ((Vs_Input*)p_vertex_input_data);
 	Vs_Output *p_out = ((Vs_Output*)p_vertex_output_data);
 	ConstantBuffer *p_cb = (ConstantBuffer*)(pp_constant_buffers[0]);
@@ -38,4 +36,4 @@ static void vs_main(const void *p_vertex_input_data, void *p_vertex_output_data,
 	p_out->VIEW_DIR = dir_ws.xyz;
 }
 
-VertexShader fullscreen_vs = { sizeof(Vs_Input), sizeof(Vs_Output),  vs_main };
+VertexShader fullscreen_vs = { sizeof(Vs_Input), sizeof(Vs_Output), fullscreen_vs_main };
@@ -0,0 +1,348 @@
+#define LEAN_AND_MEAN
+#include <windows.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "job_system.h"
+#include "external/Remotery/Remotery.h"
+
+#define JOB_SPIN_COUNT_BEFORE_SLEEP	256
+// A job with a worker affinity is only stolen while its worker has at least this many jobs queued
+#define JOB_AFFINITY_STEAL_THRESHOLD	4
+
+// The owner pushes and pops at the bottom, thieves take from the top, so the owner works depth first on the jobs it
+// just made ready while thieves take the oldest ones. A slim lock is enough at the granularity of our jobs. A full queue
+// doubles its ring instead of turning jobs away, so jobs always run on the worker they were pushed to.
+typedef struct __declspec(align(64)) JobQueue {
+	SRWLOCK lock;
+	volatile u32 top;
+	volatile u32 bottom;
+	u32 capacity; // a power of two
+	Job **pp_jobs;
+} JobQueue;
+
+typedef struct Worker {
+	JobQueue queue;
+	HANDLE h_wake_semaphore; // wakes this worker for a job pushed to its queue
+	volatile long is_sleeping;
+	volatile LONGLONG idle_time_ticks; // spent looking for jobs or sleeping, only written by the worker
+} Worker;
+
+// main.c's, reports a fatal error
+void error(const char *p_func_name, const char *p_message);
+
+static Worker a_workers[JOB_MAX_WORKER_COUNT];
+static u32 worker_count = 1;
+static __declspec(thread) u32 worker_index; // threads that aren't workers push to the first worker's queue
+static HANDLE h_job_semaphore; // wakes any sleeping worker, for jobs every worker can take
+static volatile long sleeping_worker_count;
+static f64 milliseconds_per_tick;
+
+//----------------------------------------  QUEUES  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+static void job_queue_init(JobQueue *p_queue) {
+	InitializeSRWLock(&p_queue->lock);
+	p_queue->top = 0;
+	p_queue->bottom = 0;
+	p_queue->capacity = JOB_QUEUE_INITIAL_CAPACITY;
+	p_queue->pp_jobs = malloc(p_queue->capacity * sizeof(Job*));
+}
+
+static void job_queue_push(JobQueue *p_queue, Job *p_job) {
+	AcquireSRWLockExclusive(&p_queue->lock);
+	if(p_queue->bottom - p_queue->top == p_queue->capacity) {
+		// the jobs keep their positions, only the mask they are wrapped with grows
+		u32 capacity = p_queue->capacity * 2;
+		Job **pp_jobs = malloc(capacity * sizeof(Job*));
+		for(u32 i = p_queue->top; i != p_queue->bottom; ++i) {
+			pp_jobs[i & (capacity - 1)] = p_queue->pp_jobs[i & (p_queue->capacity - 1)];
+		}
+		free(p_queue->pp_jobs);
+		p_queue->pp_jobs = pp_jobs;
+		p_queue->capacity = capacity;
+	}
+	p_queue->pp_jobs[p_queue->bottom & (p_queue->capacity - 1)] = p_job;
+	p_queue->bottom++;
+	ReleaseSRWLockExclusive(&p_queue->lock);
+}
+
+static Job* job_queue_pop(JobQueue *p_queue) {
+	Job *p_job = NULL;
+	AcquireSRWLockExclusive(&p_queue->lock);
+	if(p_queue->bottom != p_queue->top) {
+		p_queue->bottom--;
+		p_job = p_queue->pp_jobs[p_queue->bottom & (p_queue->capacity - 1)];
+	}
+	ReleaseSRWLockExclusive(&p_queue->lock);
+	return p_job;
+}
+
+// Jobs with an affinity to the queue's worker are left alone unless the worker is falling behind
+static Job* job_queue_steal(JobQueue *p_queue) {
+	// peek without the lock first, most of the queues we look at while idle are empty
+	if(p_queue->bottom == p_queue->top) return NULL;
+	Job *p_job = NULL;
+	AcquireSRWLockExclusive(&p_queue->lock);
+	u32 queued_job_count = p_queue->bottom - p_queue->top;
+	if(queued_job_count) {
+		Job *p_top_job = p_queue->pp_jobs[p_queue->top & (p_queue->capacity - 1)];
+		bool is_stealable = (p_top_job->worker_affinity == JOB_NO_AFFINITY) ||
+			(p_top_job->is_affinity_stealable && queued_job_count >= JOB_AFFINITY_STEAL_THRESHOLD);
+		if(is_stealable) {
+			p_job = p_top_job;
+			p_queue->top++;
+		}
+	}
+	ReleaseSRWLockExclusive(&p_queue->lock);
+	return p_job;
+}
+
+//----------------------------------------  JOBS  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+static void job_lock(Job *p_job) {
+	while(InterlockedCompareExchange(&p_job->lock, 1, 0) != 0) {
+		_mm_pause();
+	}
+}
+
+static void job_unlock(Job *p_job) {
+	InterlockedExchange(&p_job->lock, 0);
+}
+
+static void job_pool_release(JobPool *p_pool) {
+	if(InterlockedDecrement(&p_pool->unfinished_job_count) == 0) {
+		SetEvent(p_pool->h_idle_event);
+	}
+}
+
+static void job_push(Job *p_job) {
+	bool has_affinity = p_job->worker_affinity != JOB_NO_AFFINITY;
+	Worker *p_worker = a_workers + (has_affinity ? p_job->worker_affinity : worker_index);
+	job_queue_push(&p_worker->queue, p_job);
+	if(p_worker->is_sleeping) {
+		ReleaseSemaphore(p_worker->h_wake_semaphore, 1, NULL);
+	}
+	else if(!has_affinity && sleeping_worker_count > 0) {
+		ReleaseSemaphore(h_job_semaphore, 1, NULL);
+	}
+}
+
+static void job_release(Job *p_job) {
+	if(InterlockedDecrement(&p_job->unfinished_dependency_count) == 0) {
+		job_push(p_job);
+	}
+}
+
+static void job_execute(Job *p_job) {
+	p_job->function(p_job->p_data, p_job->job_index);
+
+	job_lock(p_job);
+	p_job->is_finished = true;
+	job_unlock(p_job);
+	// no continuations can be added once the job is marked as finished
+	for(u32 continuation_index = 0; continuation_index < p_job->continuation_count; ++continuation_index) {
+		job_release(p_job->a_continuations[continuation_index]);
+	}
+	// the continuations were counted before this job finished, the count can not touch zero early
+	job_pool_release(p_job->p_pool);
+}
+
+static Job* job_find() {
+	Job *p_job = job_queue_pop(&a_workers[worker_index].queue);
+	for(u32 i = 1; !p_job && i < worker_count; ++i) {
+		p_job = job_queue_steal(&a_workers[(worker_index + i) % worker_count].queue);
+	}
+	return p_job;
+}
+
+// Spins for a while, then sleeps until a job is pushed
+static Job* job_wait(Worker *p_worker) {
+	for(;;) {
+		for(u32 spin_index = 0; spin_index < JOB_SPIN_COUNT_BEFORE_SLEEP; ++spin_index) {
+			Job *p_job = job_find();
+			if(p_job) return p_job;
+			_mm_pause();
+		}
+
+		// a push that doesn't see us sleeping happened before we said so, so the search below finds its job
+		InterlockedExchange(&p_worker->is_sleeping, 1);
+		InterlockedIncrement(&sleeping_worker_count);
+		Job *p_job = job_find();
+		if(!p_job) {
+			HANDLE a_wake_handles[2] = { p_worker->h_wake_semaphore, h_job_semaphore };
+			WaitForMultipleObjects(2, a_wake_handles, FALSE, INFINITE);
+		}
+		InterlockedDecrement(&sleeping_worker_count);
+		InterlockedExchange(&p_worker->is_sleeping, 0);
+		if(p_job) return p_job;
+	}
+}
+
+static DWORD WINAPI worker_thread_main(LPVOID p_parameter) {
+	worker_index = (u32)(uintptr_t)p_parameter;
+	Worker *p_worker = a_workers + worker_index;
+	char thread_name[32];
+	sprintf(thread_name, "job_worker_%u", worker_index);
+	rmt_SetCurrentThreadName(thread_name);
+
+	for(;;) {
+		Job *p_job = job_find();
+		if(!p_job) {
+			LARGE_INTEGER idle_start_time, idle_end_time;
+			QueryPerformanceCounter(&idle_start_time);
+			p_job = job_wait(p_worker);
+			QueryPerformanceCounter(&idle_end_time);
+			p_worker->idle_time_ticks += idle_end_time.QuadPart - idle_start_time.QuadPart;
+		}
+		job_execute(p_job);
+	}
+	return 0;
+}
+
+// Maps a worker to the logical processor of the same index, counting through the processor groups in order
+static void pin_worker_thread(HANDLE h_thread, u32 thread_index) {
+	u32 processor_index = thread_index;
+	WORD group_count = GetActiveProcessorGroupCount();
+	for(WORD group = 0; group < group_count; ++group) {
+		u32 group_processor_count = GetActiveProcessorCount(group);
+		if(processor_index < group_processor_count) {
+			GROUP_AFFINITY affinity = { 0 };
+			affinity.Group = group;
+			affinity.Mask = (KAFFINITY)1 << processor_index;
+			SetThreadGroupAffinity(h_thread, &affinity, NULL);
+			return;
+		}
+		processor_index -= group_processor_count;
+	}
+}
+
+void job_system_init(u32 requested_worker_count, bool is_pinned) {
+	worker_count = MIN(MAX(requested_worker_count, 1), JOB_MAX_WORKER_COUNT);
+	LARGE_INTEGER performance_frequency;
+	QueryPerformanceFrequency(&performance_frequency);
+	milliseconds_per_tick = 1000.0 / performance_frequency.QuadPart;
+	h_job_semaphore = CreateSemaphore(NULL, 0, JOB_MAX_WORKER_COUNT, NULL);
+	for(u32 thread_index = 0; thread_index < worker_count; ++thread_index) {
+		job_queue_init(&a_workers[thread_index].queue);
+		a_workers[thread_index].h_wake_semaphore = CreateSemaphore(NULL, 0, 1, NULL);
+	}
+	for(u32 thread_index = 0; thread_index < worker_count; ++thread_index) {
+		// pinned before it runs, so everything the worker first touches is placed on its node
+		HANDLE h_thread = CreateThread(NULL, 0, worker_thread_main, (LPVOID)(uintptr_t)thread_index, CREATE_SUSPENDED, NULL);
+		assert(h_thread);
+		if(is_pinned) {
+			pin_worker_thread(h_thread, thread_index);
+		}
+		ResumeThread(h_thread);
+		CloseHandle(h_thread);
+	}
+}
+
+void job_pool_init(JobPool *p_pool) {
+	memset((void*)p_pool->ap_blocks, 0, sizeof(p_pool->ap_blocks));
+	p_pool->ap_blocks[0] = malloc(JOB_POOL_BLOCK_SIZE * sizeof(Job));
+	p_pool->job_count = 0;
+	p_pool->unfinished_job_count = 0;
+	p_pool->h_idle_event = CreateEvent(NULL, TRUE, TRUE, NULL);
+}
+
+void job_pool_begin(JobPool *p_pool) {
+	assert(p_pool->unfinished_job_count == 0);
+	ResetEvent(p_pool->h_idle_event);
+	p_pool->job_count = 0;
+	p_pool->unfinished_job_count = 1;
+}
+
+void job_pool_end(JobPool *p_pool) {
+	job_pool_release(p_pool);
+}
+
+void job_pool_wait(JobPool *p_pool) {
+	rmt_BeginCPUSample(job_pool_wait, 0);
+	WaitForSingleObject(p_pool->h_idle_event, INFINITE);
+	rmt_EndCPUSample();
+}
+
+Job* job_create(JobPool *p_pool, JobFunction *function, void *p_data, u32 job_index) {
+	// only jobs of the pool's frame create jobs in it, and they can't finish it before job_pool_end
+	assert(p_pool->unfinished_job_count > 0);
+	long pool_index = InterlockedIncrement(&p_pool->job_count) - 1;
+	u32 block_index = pool_index / JOB_POOL_BLOCK_SIZE;
+	if(block_index >= JOB_POOL_MAX_BLOCK_COUNT) {
+		error("job_create", "The job pool ran out of blocks!");
+		ExitProcess(1);
+	}
+	Job *p_block = p_pool->ap_blocks[block_index];
+	if(!p_block) {
+		// every thread that gets a job of the block races to allocate it, the first one to publish its block wins
+		Job *p_new_block = malloc(JOB_POOL_BLOCK_SIZE * sizeof(Job));
+		p_block = InterlockedCompareExchangePointer((PVOID volatile*)&p_pool->ap_blocks[block_index], p_new_block, NULL);
+		if(p_block) {
+			free(p_new_block);
+		}
+		else {
+			p_block = p_new_block;
+		}
+	}
+	Job *p_job = p_block + pool_index % JOB_POOL_BLOCK_SIZE;
+	memset(p_job, 0, sizeof(Job));
+	p_job->function = function;
+	p_job->p_pool = p_pool;
+	p_job->worker_affinity = JOB_NO_AFFINITY;
+	p_job->p_data = p_data;
+	p_job->job_index = job_index;
+	p_job->unfinished_dependency_count = 1; // released by job_submit
+	InterlockedIncrement(&p_pool->unfinished_job_count);
+	return p_job;
+}
+
+static void relay_job(void *p_data, u32 job_index) {
+}
+
+void job_add_dependency(Job *p_job, Job *p_dependency) {
+	job_lock(p_dependency);
+	if(!p_dependency->is_finished) {
+		if(p_dependency->continuation_count < JOB_MAX_CONTINUATION_COUNT) {
+			p_dependency->a_continuations[p_dependency->continuation_count++] = p_job;
+			InterlockedIncrement(&p_job->unfinished_dependency_count);
+		}
+		else {
+			// A full job hands its last continuation to a relay job that takes its slot. The relay's creation dependency
+			// stands for this job, so the relay runs once this job finishes and then releases its own continuations.
+			Job **pp_last_continuation = p_dependency->a_continuations + JOB_MAX_CONTINUATION_COUNT - 1;
+			if((*pp_last_continuation)->function != relay_job) {
+				Job *p_relay = job_create(p_dependency->p_pool, relay_job, NULL, 0);
+				p_relay->a_continuations[p_relay->continuation_count++] = *pp_last_continuation;
+				*pp_last_continuation = p_relay;
+			}
+			// the relay can't have finished, this job hasn't
+			job_add_dependency(p_job, *pp_last_continuation);
+		}
+	}
+	job_unlock(p_dependency);
+}
+
+void job_set_worker_affinity(Job *p_job, u32 worker_index, bool is_stealable) {
+	assert(worker_index < worker_count);
+	p_job->worker_affinity = worker_index;
+	p_job->is_affinity_stealable = is_stealable;
+}
+
+void job_submit(Job *p_job) {
+	job_release(p_job);
+}
+
+u32 job_system_get_worker_index() {
+	return worker_index;
+}
+
+u32 job_system_get_worker_count() {
+	return worker_count;
+}
+
+f64 job_system_get_worker_idle_time(u32 worker_index) {
+	return a_workers[worker_index].idle_time_ticks * milliseconds_per_tick;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include "math.h"
+
+// Work-stealing job scheduler. Every worker owns a deque of ready jobs, it pushes and pops at one end and idle workers
+// steal from the other end. A job runs once all of its dependencies have finished, there are no global barriers.
+//
+// A job is built in three steps: job_create, any number of job_add_dependency calls, and job_submit. A created job holds
+// one extra dependency that job_submit releases, so dependencies can be added, from any thread, until it is submitted.
+//
+// Jobs are allocated from a JobPool, which is filled between job_pool_begin and job_pool_end and can be waited on as a
+// whole. Job pointers stay valid until the pool is begun again, so pools of different frames can be in flight together.
+// A pool grows a block of jobs at a time and keeps its blocks when it is recycled.
+
+#define JOB_POOL_BLOCK_SIZE			(1 << 15)
+#define JOB_POOL_MAX_BLOCK_COUNT	64
+#define JOB_QUEUE_INITIAL_CAPACITY	(1 << 12)	// per worker, a full queue grows
+#define JOB_MAX_CONTINUATION_COUNT	4			// jobs that depend on a single job
+#define JOB_MAX_WORKER_COUNT		128
+#define JOB_NO_AFFINITY				0xFFFFFFFF
+
+typedef void JobFunction(void *p_data, u32 job_index);
+
+typedef struct Job {
+	JobFunction *function;
+	struct JobPool *p_pool;
+	void *p_data;
+	u32 job_index;
+	u32 worker_affinity;		// the worker whose queue the job goes to when it is ready, or JOB_NO_AFFINITY
+	u32 is_affinity_stealable;	// other workers may still take it to even out an imbalance
+	volatile long unfinished_dependency_count;
+	volatile long lock; // guards is_finished and the continuations
+	u32 is_finished;
+	u32 continuation_count;
+	struct Job *a_continuations[JOB_MAX_CONTINUATION_COUNT];
+} Job;
+
+typedef struct JobPool {
+	Job * volatile ap_blocks[JOB_POOL_MAX_BLOCK_COUNT]; // of JOB_POOL_BLOCK_SIZE jobs, allocated by the first job_create that needs them
+	volatile long job_count;
+	volatile long unfinished_job_count; // + 1 between job_pool_begin and job_pool_end
+	void *h_idle_event;
+} JobPool;
+
+// Starts worker_count worker threads, threads that aren't workers can create and submit jobs too. Pinned workers run
+// on the logical processor of the same index, so memory they touch first stays local to them across frames.
+void job_system_init(u32 worker_count, bool is_pinned);
+void job_pool_init(JobPool *p_pool);
+// Recycles the pool, every job of it must have finished
+void job_pool_begin(JobPool *p_pool);
+void job_pool_end(JobPool *p_pool);
+// Blocks until job_pool_end was called and every job of the pool has finished
+void job_pool_wait(JobPool *p_pool);
+Job* job_create(JobPool *p_pool, JobFunction *function, void *p_data, u32 job_index);
+void job_add_dependency(Job *p_job, Job *p_dependency);
+// Must be set before the job is submitted
+void job_set_worker_affinity(Job *p_job, u32 worker_index, bool is_stealable);
+void job_submit(Job *p_job);
+u32 job_system_get_worker_index();
+u32 job_system_get_worker_count();
+// Milliseconds the worker spent without a job to run since it started, can be read from any thread
+f64 job_system_get_worker_idle_time(u32 worker_index);
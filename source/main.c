@@ -5,18 +5,26 @@
 #include <omp.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <assert.h>
 
 #include "math.h"
 #include "common_shader_core.h"
+#include "job_system.h"
+#include "mesh_file.h"
 #include "external/Remotery/Remotery.h"
-#include "external/octarine/octarine_mesh.h"
 typedef int DXGI_FORMAT;
+#define DXGI_FORMAT_BC1_UNORM		71
+#define DXGI_FORMAT_BC1_UNORM_SRGB	72
+#define DXGI_FORMAT_BC3_UNORM		77
+#define DXGI_FORMAT_BC3_UNORM_SRGB	78
+#define DXGI_FORMAT_BC6H_UF16		95
+#define DXGI_FORMAT_BC7_UNORM		98
+#define DXGI_FORMAT_BC7_UNORM_SRGB	99
 #include "external/octarine/octarine_image.h"
 
 #pragma comment(lib, "octarine_mesh.lib")
 #pragma comment(lib, "octarine_image.lib")
-#pragma comment(lib, "svml_disp.lib")
 
 #define WIDTH	1200 //560;
 #define HEIGHT  720 //704;
@@ -28,20 +36,42 @@ typedef int DXGI_FORMAT;
 #define WIDTH_IN_TILES	(WIDTH/TILE_WIDTH)
 #define HEIGHT_IN_TILES (HEIGHT/TILE_HEIGHT)
 #define NUM_BINS (WIDTH_IN_TILES*HEIGHT_IN_TILES)
+#define TILE_TEXEL_COUNT (TILE_WIDTH*TILE_HEIGHT)
 
 const int frame_width = WIDTH;
 const int frame_height = HEIGHT;
 
-u32 frame_buffer[WIDTH][HEIGHT];
-f32 depth_buffer[WIDTH][HEIGHT];
+// Frames are recorded into the swap chain buffers in turn. The main thread can record up to MAX_FRAMES_IN_FLIGHT frames
+// ahead of the one the present thread is waiting for, fewer frames in flight means less latency between input and screen.
+#define SWAP_CHAIN_BUFFER_COUNT 3
+#define MAX_FRAMES_IN_FLIGHT 2
+#if MAX_FRAMES_IN_FLIGHT > SWAP_CHAIN_BUFFER_COUNT
+#error "a frame in flight needs a swap chain buffer of its own"
+#endif
 
 #define MAX_NUM_CLIP_VERTICES 16
 #define NUM_SUB_PIXEL_PRECISION_BITS 4
-#define PIXEL_SHADER_INPUT_REGISTER_COUNT 4
+#define PIXEL_SHADER_INPUT_COMPONENT_COUNT 128 // 32 float4 registers, like d3d11
 #define COMMONSHADER_CONSTANT_BUFFER_HW_SLOT_COUNT 16
 #define COMMONSHADER_INPUT_RESOURCE_REGISTER_COUNT 16
+#define COMMONSHADER_SAMPLER_SLOT_COUNT 16
 
 #define MAX_OBJECT_COUNT_PER_SCENE 8
+#define MAX_ASSET_COUNT_PER_SCENE (2 * MAX_OBJECT_COUNT_PER_SCENE)
+#define ASSET_LOADER_THREAD_COUNT 4
+#define DEFAULT_ASSET_MEMORY_BUDGET_MB 1024
+
+// A draw is split into geometry jobs of this many triangles (IA, VS and PA), and into raster jobs of bands of this many
+// tile rows (rasterizer and pixel shader). GEOMETRY_JOB_TRIANGLE_COUNT keeps every geometry job's vertex count divisible by 8.
+#define GEOMETRY_JOB_TRIANGLE_COUNT 1024
+#define RASTER_JOB_TILE_ROW_COUNT 1
+#define RASTER_BAND_COUNT ((HEIGHT_IN_TILES + RASTER_JOB_TILE_ROW_COUNT - 1) / RASTER_JOB_TILE_ROW_COUNT)
+// Bin costs are measured in covered pixels, every triangle in a bin adds this much for its setup and attribute planes
+#define BIN_COST_PER_TRIANGLE 16
+// Draws of a frame whose band costs are remembered to order the raster jobs of the next frames
+#define BAND_COST_HISTORY_DRAW_COUNT 16
+// A draw uses the coarsest LOD of its mesh whose simplification error projects to at most this many pixels
+#define LOD_MAX_SCREEN_ERROR 1.f
 
 extern VertexShader passthrough_vs;
 extern PixelShader passthrough_ps;
@@ -51,37 +81,101 @@ extern VertexShader vertex_lighting_vs;
 extern PixelShader env_lighting_ps;
 extern VertexShader fullscreen_vs;
 
+typedef void VertexShaderMain(const void *p_vertex_input_data, void *p_vertex_output_data, const void **pp_constant_buffers, const void **pp_shader_resource_views, const SamplerState **pp_samplers);
+typedef void PixelShaderMain(const void *p_pixel_input_data, void *p_pixel_output_data, const void **pp_shader_resource_views, const SamplerState **pp_samplers, i256 mask);
+typedef void PixelShaderTileMain(const PixelTile *p_tile, void *p_tile_output_data, const void **pp_shader_resource_views, const SamplerState **pp_samplers);
+
+// shader entry points, the specialized pipeline variants call them directly
+VertexShaderMain basic_vs_main, fullscreen_vs_main, passthrough_vs_main, vertex_lighting_vs_main;
+PixelShaderMain basic_ps_main, env_lighting_ps_main, passthrough_ps_main;
+PixelShaderTileMain basic_ps_tile_main;
+
 typedef struct MeshHeader {
 	uint32_t size;
 	uint32_t vertex_count;
 	uint32_t index_count;
 } MeshHeader;
 
-typedef struct Mesh {
-	MeshHeader header;
-	void *p_vertex_buffer;
-	u32 *p_index_buffer;
-} Mesh;
+#define IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT	MESH_FILE_MAX_ATTRIBUTE_COUNT
+#define IA_MAX_INPUT_ELEMENT_COUNT			MESH_FILE_MAX_ATTRIBUTE_COUNT
 
 typedef enum PrimitiveTopology {
 	PRIMITIVE_TOPOLOGY_UNDEFINED = 0,
 	PRIMITIVE_TOPOLOGY_TRIANGLELIST = 1
 } PrimitiveTopology;
 
+typedef enum IndexFormat {
+	INDEX_FORMAT_R32_UINT = 0,
+	INDEX_FORMAT_R16_UINT
+} IndexFormat;
+
+typedef struct InputElementDesc {
+	u32 input_slot;
+	u32 aligned_byte_offset;
+	MeshAttributeFormat format;
+	u32 component_count; // decoded, each one becomes a 32-bit float component of the vertex shader input
+	f32 a_scale[4]; // of MESH_ATTRIBUTE_FORMAT_UNORM16
+	f32 a_bias[4];
+} InputElementDesc;
+
+typedef struct InputLayout {
+	InputElementDesc a_elements[IA_MAX_INPUT_ELEMENT_COUNT];
+	u32 element_count;
+	u32 component_count; // of the vertex shader input, summed over the elements
+} InputLayout;
+
 typedef struct IA {
-	u32 *p_index_buffer;// TODO(cerlet): 16-bit index buffers!
-	void *p_vertex_buffer;
-	u32 input_layout;
+	const void *p_index_buffer;
+	IndexFormat index_format;
+	const void *ap_vertex_buffers[IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	u32 a_vertex_buffer_strides[IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	const InputLayout *p_input_layout;
 	PrimitiveTopology primitive_topology;
 } IA;
 
+// The buffers of a loaded mesh point into its mapped file, the built-in meshes point to static arrays
+typedef struct Mesh {
+	MeshHeader header;
+	const void *ap_vertex_buffers[IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	u32 a_vertex_buffer_strides[IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	const void *p_index_buffer;
+	IndexFormat index_format;
+	InputLayout input_layout;
+	MeshFile file;
+	MeshLod a_lods[MESH_FILE_MAX_LOD_COUNT]; // index ranges of p_index_buffer, the built-in meshes only have LOD 0
+	u32 lod_count;
+	v3f32 center; // of the bounding sphere, in world space
+	f32 radius;
+	struct MeshCluster *p_clusters; // NULL for the built-in meshes, they are drawn without cluster culling
+	u32 a_lod_first_clusters[MESH_FILE_MAX_LOD_COUNT];
+	u32 cluster_count;
+} Mesh;
+
 typedef struct VS {
-	void (*shader)(const void *p_vertex_input_data, void *p_vertex_output_data, const void *p_constant_buffers, const void *p_shader_resource_views);
-	u8 output_register_count;
+	VertexShaderMain *shader;
+	u32 output_component_count;
 	void *p_constant_buffers[COMMONSHADER_CONSTANT_BUFFER_HW_SLOT_COUNT];
 	void *p_shader_resource_views[COMMONSHADER_INPUT_RESOURCE_REGISTER_COUNT];
+	SamplerState *p_samplers[COMMONSHADER_SAMPLER_SLOT_COUNT];
 } VS;
 
+// Runs before the input assembler and drops clusters of MESH_CLUSTER_TRIANGLE_COUNT consecutive triangles, i.e. 192
+// indices, that can't contribute to the frame. Geometry jobs cover exactly GEOMETRY_JOB_TRIANGLE_COUNT /
+// MESH_CLUSTER_TRIANGLE_COUNT clusters.
+#define MESH_CLUSTER_TRIANGLE_COUNT 64
+
+typedef struct MeshCluster {
+	v3f32 center;		// of the bounding sphere, in world space
+	f32 radius;
+	v3f32 cone_axis;	// the triangle normals are within the cone around it
+	f32 cone_cutoff;	// sine of the cone's half angle, 2 if the cluster can't be back-face culled as a whole
+} MeshCluster;
+
+typedef struct CC {
+	const MeshCluster *p_clusters; // NULL disables the stage
+	const struct PerFrameCB *p_per_frame_cb;
+} CC;
+
 typedef struct Viewport {
 	f32 top_left_x;
 	f32 top_left_y;
@@ -96,43 +190,65 @@ typedef struct RS {
 } RS;
 
 typedef struct PS {
-	void(*shader)(void *p_pixel_input_data, void *p_pixel_output_data, const void *p_shader_resource_views);
+	PixelShaderMain *shader;
+	PixelShaderTileMain *tile_shader;	// optional
 	void *p_shader_resource_views[COMMONSHADER_INPUT_RESOURCE_REGISTER_COUNT];
+	SamplerState *p_samplers[COMMONSHADER_SAMPLER_SLOT_COUNT];
 } PS;
 
+typedef enum DepthFormat {
+	DEPTH_FORMAT_D32_FLOAT = 0,
+	DEPTH_FORMAT_D24_UNORM,		// stored in the low 24 bits of a 32-bit texel
+	DEPTH_FORMAT_D16_UNORM
+} DepthFormat;
+
 typedef struct OM {
 	u32 *p_colors;
-	f32 *p_depth;
+	u8 *p_depth;
+	struct TileMetadata *p_tile_metadata; // of the color and depth targets above
+	DepthFormat depth_format;
 	//u8 num_render_targets;
 } OM;
 
 typedef struct Pipeline {
+	CC cc;
 	IA ia;
 	VS vs;
 	RS rs;
 	PS ps;
 	OM om;
+	const struct PipelineVariant *p_variant; // picked when the shaders are bound, NULL runs the generic stages
 } Pipeline;
 
+// Only the first output_component_count components are ever read or written, SV_POSITION is in the first four
 typedef struct Vertex {
-	v4f32 a_attributes[PIXEL_SHADER_INPUT_REGISTER_COUNT];
+	f32 a_components[PIXEL_SHADER_INPUT_COMPONENT_COUNT];
 }Vertex;
 
+inline v4f32 get_vertex_position(const Vertex *p_vertex) {
+	return *((const v4f32*)p_vertex->a_components);
+}
+
 typedef struct EdgeFunction{
 	i32 a;
 	i32 b;
 	i32 c;
 } EdgeFunction;
 
+typedef struct PlaneEquation {
+	f32 c;
+	f32 dx;
+	f32 dy;
+} PlaneEquation;
+
 typedef struct Setup {
 	EdgeFunction a_edge_functions[3];
-	f32 a_reciprocal_ws[3];
-	f32 one_over_area;
+	PlaneEquation reciprocal_w_plane;
 	f32 max_depth;
 }Setup;
 
 typedef struct Triangle {
-	v4f32 *p_attributes;
+	PlaneEquation *p_attribute_planes; // one plane per attribute component
 	v2i32 min_bounds;
 	v2i32 max_bounds;
 	Setup setup;
@@ -161,6 +277,72 @@ typedef struct TileInfo {
 	u64 fragment_mask;
 } TileInfo;
 
+typedef struct PipelineVariant {
+	VertexShaderMain *vs_main;
+	PixelShaderMain *ps_main;
+	u32 output_component_count;
+	void(*vertex_shader_stage)(const Pipeline *p_pipeline, u32 vertex_count, const void *p_vertex_input_data, void *p_vertex_output_data);
+	void(*pixel_shader_stage)(const Pipeline *p_pipeline, const TileInfo* p_fragments, const Triangle *p_triangles, const CompactedBin *p_compacted_bins, u32 num_compacted_bins);
+} PipelineVariant;
+
+// Everything the jobs of one draw call share, the draw's finish job frees it. The pipeline is a snapshot in a command
+// list, which stays untouched until the frame's swap chain buffer is recycled.
+typedef struct DrawContext {
+	const Pipeline *p_pipeline;
+	struct SwapChainBuffer *p_buffer;
+	u32 triangle_count;
+	Triangle *p_triangles;
+	PlaneEquation *p_attribute_planes;
+	volatile long cluster_culled_triangle_count;
+	volatile long assembled_triangle_count;
+	u32 *p_triangle_ids;
+	CompactedBin *p_compacted_bins;
+	TileInfo *p_tile_infos;
+	u32 a_band_first_compacted_bins[RASTER_BAND_COUNT + 1]; // band b owns compacted bins [a[b], a[b+1])
+	u32 draw_index; // in its frame
+	Job *p_finish_job;
+} DrawContext;
+
+// Deferred contexts record draws and clears into command lists, which the immediate context executes in order. Every
+// context owns its bound state and its list, so threads record into contexts of their own without any locks. A draw
+// snapshots the bound state unless it is unchanged since the last snapshot, snapshots are never written again, so the
+// draws that share one and the jobs they create read it while the context records on.
+#define DEFERRED_CONTEXT_COUNT 4
+
+typedef enum CommandType {
+	COMMAND_TYPE_CLEAR_RENDER_TARGET_VIEW = 0,
+	COMMAND_TYPE_CLEAR_DEPTH_STENCIL_VIEW,
+	COMMAND_TYPE_DRAW_INDEXED
+} CommandType;
+
+typedef struct Command {
+	CommandType type;
+	union {
+		struct {
+			struct TileMetadata *p_tile_metadata;
+			f32 a_values[4]; // the color, or the depth in the first component
+		} clear;
+		struct {
+			u32 pipeline_index; // snapshots are referenced by index, the array moves while it grows
+			u32 index_count;
+		} draw_indexed;
+	};
+} Command;
+
+typedef struct CommandList {
+	Command *p_commands;
+	u32 command_count;
+	u32 command_capacity;
+	Pipeline *p_pipelines;
+	u32 pipeline_count;
+	u32 pipeline_capacity;
+} CommandList;
+
+typedef struct DeferredContext {
+	Pipeline pipeline; // bound state, set directly like the immediate context's state used to be
+	CommandList command_list;
+} DeferredContext;
+
 typedef struct Tile {
 	u32 a_colors[64];
 	f32 a_depths[64];
@@ -170,6 +352,8 @@ typedef struct PerFrameCB {
 	m4x4f32 clip_from_world;
 	m4x4f32 view_from_clip;
 	m4x4f32 world_from_view;
+	f32 projection_scale_y; // the camera's, for the jobs that can't read it while the main thread updates it
+	f32 near_plane;
 }PerFrameCB;
 
 typedef struct Camera {
@@ -200,35 +384,121 @@ typedef struct Stats {
 	f32 frame_time;
 	u32 vertex_count;
 	u32 input_triangle_count;
+	u32 cluster_culled_triangle_count;
 	u32 assembled_triangle_count;
 	u32 active_bin_count;
 	u32 total_triangle_count_in_bins;
+	f32 a_worker_idle_times[JOB_MAX_WORKER_COUNT]; // ms each worker had nothing to run since the previous present
 } Stats;
 
+// Fast clears only record the clear value, tiles are filled lazily by read_tile or at present
+// A tile whose depth is a single plane (a clear, or one triangle covering all of it) stores only the plane equation.
+#define TILE_FLAG_COLOR_CLEARED 0x1
+#define TILE_FLAG_DEPTH_PLANE	0x2
+
+typedef struct TileMetadata {
+	u8 a_flags[NUM_BINS];
+	f32 a_min_depths[NUM_BINS];
+	PlaneEquation a_depth_planes[NUM_BINS];
+	u32 color_clear_value;
+} TileMetadata;
+
+// A frame's render targets and everything its draws share while they are in flight
+typedef struct SwapChainBuffer {
+	// Render targets are stored tile-major: each 8x8 tile is one contiguous block, rows of the tile are 8 consecutive texels.
+	__declspec(align(64)) u32 a_colors[NUM_BINS][TILE_TEXEL_COUNT];
+	// Sized for the widest depth format, narrower formats pack their tiles tighter
+	__declspec(align(64)) u8 a_depths[NUM_BINS * TILE_TEXEL_COUNT * sizeof(f32)];
+	TileMetadata tile_metadata;
+	PerFrameCB per_frame_cb;
+	Stats stats;
+	JobPool job_pool;
+	Bin	a_bins[NUM_BINS]; // only used by binner jobs, which run one at a time in draw order
+	// Last jobs of the frame's draws: the next draw's binner waits for p_last_binner_job, and its raster job of a band
+	// waits for the previous raster job of the same band
+	Job *p_last_binner_job;
+	Job *a_last_raster_jobs[RASTER_BAND_COUNT];
+	u32 draw_count;
+	// Measured by the raster jobs, which run one at a time per band
+	u32 a_band_costs[BAND_COST_HISTORY_DRAW_COUNT][RASTER_BAND_COUNT];
+	const void *ap_band_cost_index_buffers[BAND_COST_HISTORY_DRAW_COUNT]; // of the draws whose costs those are
+	const struct Scene *p_scene; // recorded by the frame's record jobs, NULL while no scene is resident yet
+	DeferredContext a_deferred_contexts[DEFERRED_CONTEXT_COUNT];
+} SwapChainBuffer;
+
+typedef struct SwapChain {
+	SwapChainBuffer a_buffers[SWAP_CHAIN_BUFFER_COUNT];
+	u64 recorded_frame_count;			// only touched by the main thread
+	volatile long long presented_frame_count; // incremented by the present thread, the main thread reads it to evict scenes
+	HANDLE h_frame_slot_semaphore;		// frames that can still be put in flight
+	HANDLE h_recorded_frame_semaphore;	// recorded frames the present thread hasn't taken yet
+	// Linear copies of the frame buffer: the present thread resolves into the back one and flips, paint_window reads the front one
+	__declspec(align(64)) u32 a_present_buffers[2][HEIGHT][WIDTH];
+	u32 front_present_buffer_index;
+	SRWLOCK present_lock; // shared while painting, exclusive while flipping
+	// Band costs of the last presented frame. Binner jobs read them while the present thread updates them, they are only
+	// estimates so a mix of two frames is fine.
+	u32 a_band_cost_estimates[BAND_COST_HISTORY_DRAW_COUNT][RASTER_BAND_COUNT];
+	const void *ap_band_cost_estimate_index_buffers[BAND_COST_HISTORY_DRAW_COUNT];
+	f64 a_worker_idle_times[JOB_MAX_WORKER_COUNT]; // totals at the last present, only touched by the present thread
+} SwapChain;
+
 typedef struct SuprematistVertex {
 	v4f32 pos;
 	v3f32 color;
 	f32 _pad;
 } SuprematistVertex;
 
+typedef enum AssetType {
+	ASSET_TYPE_MESH = 0,
+	ASSET_TYPE_TEXTURE,
+	ASSET_TYPE_TEXTURE_CUBE
+} AssetType;
+
+// A file that is loaded into one of the scene's object slots when the scene is paged in, and freed when it is evicted
+typedef struct Asset {
+	AssetType type;
+	const char *p_file_name;
+	struct Scene *p_scene;
+	u32 object_index;
+	bool is_in_srgb;
+	u64 size; // bytes kept allocated once loaded
+} Asset;
+
+typedef enum SceneResidency {
+	SCENE_RESIDENCY_EVICTED = 0,
+	SCENE_RESIDENCY_LOADING,
+	SCENE_RESIDENCY_RESIDENT
+} SceneResidency;
+
 typedef struct Scene {
 	Mesh a_meshes[MAX_OBJECT_COUNT_PER_SCENE];
 	Texture2D a_textures[MAX_OBJECT_COUNT_PER_SCENE];
+	TextureCube a_texture_cubes[MAX_OBJECT_COUNT_PER_SCENE];
 	VertexShader a_vertex_shaders[MAX_OBJECT_COUNT_PER_SCENE];
 	PixelShader a_pixel_shaders[MAX_OBJECT_COUNT_PER_SCENE];
+	SamplerState *a_samplers[MAX_OBJECT_COUNT_PER_SCENE];
 	u32 num_objects;
+	DepthFormat depth_format;
+	// Streamed in and out, everything else of the scene stays resident. The scene's load is a future: residency turns
+	// to SCENE_RESIDENCY_RESIDENT and h_resident_event is set once its last asset has loaded.
+	Asset a_assets[MAX_ASSET_COUNT_PER_SCENE];
+	u32 asset_count;
+	volatile long residency;
+	volatile long unloaded_asset_count;
+	HANDLE h_resident_event;
+	u64 last_used_frame_index; // the last frame that draws the scene, it can be evicted once that frame is presented
 }Scene;
 
-Pipeline graphics_pipeline;
 HWND h_window;
 u32 window_width = WIDTH;
 u32 window_height = HEIGHT;
 PerFrameCB per_frame_cb;
 Camera camera;
 Input input;
-Bin	a_bins[NUM_BINS];
-f32 a_tile_min_depths[NUM_BINS];
-Stats stats;
+SwapChain swap_chain;
+SwapChainBuffer *p_back_buffer; // the frame being recorded
+Stats stats; // of the frame on screen
 SuprematistVertex suprematist_vertex_buffer[] = {
 	{ { 0.34107, 0.12215, 0.5,  1.0 }, { 0.07500, 0.08200, 0.06300 }, {0.0} },
 	{ { 0.95357, 0.12500, 0.5,  1.0 }, { 0.07500, 0.08200, 0.06300 }, {0.0} },
@@ -277,9 +547,17 @@ enum SceneType {
 	SceneType_COUNT
 };
 Scene a_scenes[SceneType_COUNT];
+SamplerState linear_clamp_sampler;
+SamplerState latlon_sampler; // wraps around the longitude, clamps at the poles, only used to convert panoramas to cubes
 u32 current_scene_index = 0;
 char cpu_brand_name[0x40] = {0};
 u32 num_logical_processors = 0;
+// Every band of tile rows belongs to one pinned worker, which first touches its pages and rasterizes it in every draw
+bool is_tile_ownership_enabled = false;
+u64 asset_memory_budget = (u64)DEFAULT_ASSET_MEMORY_BUDGET_MB << 20;
+u64 resident_asset_size = 0; // as of the last frame
+Scene *p_displayed_scene = NULL; // drawn while the current scene is still loading
+FILE *p_log_file = NULL;
 
 //----------------------------------------  WINDOW  ----------------------------------------------------------------------------------------------------------------------------------------------------//
 
@@ -311,10 +589,12 @@ void paint_window(HDC h_device_context) {
 	info.bmiHeader = bmpheader;
 
 	// Draw to bitmap
-	StretchDIBits(backbuffer_dc, 0, 0, window_width, window_height, 0, 0, frame_width, frame_height, frame_buffer, &info, DIB_RGB_COLORS, SRCCOPY);
+	AcquireSRWLockShared(&swap_chain.present_lock);
+	const u32 *p_present_buffer = &swap_chain.a_present_buffers[swap_chain.front_present_buffer_index][0][0];
+	StretchDIBits(backbuffer_dc, 0, 0, window_width, window_height, 0, 0, frame_width, frame_height, p_present_buffer, &info, DIB_RGB_COLORS, SRCCOPY);
 	if(input.is_space_pressed) {
 		SetBkMode(backbuffer_dc, TRANSPARENT);
-		char gui_buf[64];
+		char gui_buf[128];
 		int y = 0;
 		sprintf(gui_buf, "cpu: %s", cpu_brand_name);
 		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
@@ -322,6 +602,13 @@ void paint_window(HDC h_device_context) {
 		sprintf(gui_buf, "logical processor count: %d", num_logical_processors);
 		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
 		y += 14;
+		sprintf(gui_buf, "tile ownership: %s", is_tile_ownership_enabled ? "on" : "off");
+		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
+		y += 14;
+		sprintf(gui_buf, "resident assets: %.1f / %.1f MB%s", resident_asset_size / (1024.0 * 1024.0), asset_memory_budget / (1024.0 * 1024.0),
+			(a_scenes[current_scene_index].residency == SCENE_RESIDENCY_RESIDENT) ? "" : ", loading scene");
+		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
+		y += 14;
 		sprintf(gui_buf, "frame buffer size: %d, %d", frame_width, frame_height);
 		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
 		y += 14;
@@ -331,7 +618,8 @@ void paint_window(HDC h_device_context) {
 		sprintf(gui_buf, "vertex count: %d", stats.vertex_count);
 		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
 		y += 14;
-		sprintf(gui_buf, "triangle count(input/assembled): %d, %d", stats.input_triangle_count, stats.assembled_triangle_count);
+		sprintf(gui_buf, "triangle count(input/cluster culled/assembled): %d, %d, %d", stats.input_triangle_count, stats.cluster_culled_triangle_count,
+			stats.assembled_triangle_count);
 		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
 		y += 14;
 		sprintf(gui_buf, "active bin count: %d", stats.active_bin_count);
@@ -340,12 +628,26 @@ void paint_window(HDC h_device_context) {
 		sprintf(gui_buf, "avg triangle count per bin: %.5f", ((f32)stats.total_triangle_count_in_bins) / stats.active_bin_count);
 		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
 		y += 14;
+		f32 min_idle_time = stats.a_worker_idle_times[0];
+		f32 max_idle_time = 0.f;
+		f32 total_idle_time = 0.f;
+		u32 worker_count = job_system_get_worker_count();
+		for(u32 worker_index = 0; worker_index < worker_count; ++worker_index) {
+			f32 idle_time = stats.a_worker_idle_times[worker_index];
+			min_idle_time = MIN(min_idle_time, idle_time);
+			max_idle_time = MAX(max_idle_time, idle_time);
+			total_idle_time += idle_time;
+		}
+		sprintf(gui_buf, "worker idle time(min/avg/max): %.3f, %.3f, %.3f ms", min_idle_time, total_idle_time / worker_count, max_idle_time);
+		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
+		y += 14;
 		sprintf(gui_buf, "cam pos: %.5f, %.5f, %.5f", camera.pos.x, camera.pos.y, camera.pos.z);
 		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
 		y += 14;
 		sprintf(gui_buf, "cam angles: %.5f, %.5f ", camera.yaw_rad, camera.pitch_rad);
 		TextOutA(backbuffer_dc, 0, y, gui_buf, strlen(gui_buf));
 	}
+	ReleaseSRWLockShared(&swap_chain.present_lock);
 
 	// Blit bitmap
 	BitBlt(h_device_context, 0, 0, window_width, window_height, backbuffer_dc, 0, 0, SRCCOPY);
@@ -448,6 +750,27 @@ void init_window(HINSTANCE h_instance, i32 n_cmd_show) {
 
 //----------------------------------------  UTILITY  ----------------------------------------------------------------------------------------------------------------------------------------------------//
 
+f64 get_time_ms() {
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart * 1000.0 / frequency.QuadPart;
+}
+
+void log_message(const char *p_format, ...) {
+	char message[512];
+	va_list args;
+	va_start(args, p_format);
+	vsnprintf(message, sizeof(message), p_format, args);
+	va_end(args);
+
+	OutputDebugStringA(message);
+	if(p_log_file) {
+		fputs(message, p_log_file);
+		fflush(p_log_file);
+	}
+}
+
 void error(const char *p_func_name, const char *p_message) {
 	char display_msg[512] = { 0 };
 
@@ -518,44 +841,597 @@ void get_cpu_info() {
 		}
 	}
 
-	SYSTEM_INFO system_info;
-	GetSystemInfo(&system_info);
-	num_logical_processors = system_info.dwNumberOfProcessors;
+	// counts the processors of every group, GetSystemInfo only sees the ones in our group, at most 64
+	num_logical_processors = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+}
+
+void log_mesh_optimization_stats(const char *p_mesh_name, const MeshOptimizationStats *p_stats) {
+	log_message("optimized %-59s ACMR: %5.3f -> %5.3f | overdraw: %5.3f -> %5.3f | vertices: %8u -> %-8u\n", p_mesh_name,
+		p_stats->acmr_before, p_stats->acmr_after, p_stats->overdraw_before, p_stats->overdraw_after, p_stats->vertex_count_before, p_stats->vertex_count_after);
+}
+
+// Load time only, the input assembler decodes the attributes itself
+v3f32 get_mesh_vertex_position(const MeshAttribute *p_attribute, const void *p_stream, u32 vertex_index) {
+	const u8 *p_vertex = (const u8*)p_stream + (u64)vertex_index * p_attribute->stride;
+	v3f32 position;
+	for(u32 i = 0; i < 3; ++i) {
+		if(p_attribute->format == MESH_ATTRIBUTE_FORMAT_UNORM16) {
+			position.xyz[i] = ((const u16*)p_vertex)[i] * (1.f / 65535.f) * p_attribute->a_scale[i] + p_attribute->a_bias[i];
+		}
+		else {
+			assert(p_attribute->format == MESH_ATTRIBUTE_FORMAT_FLOAT32);
+			position.xyz[i] = ((const f32*)p_vertex)[i];
+		}
+	}
+	return position;
+}
+
+// Bounds up to MESH_CLUSTER_TRIANGLE_COUNT consecutive triangles with a sphere, and their normals with a cone
+MeshCluster build_mesh_cluster(const Mesh *p_mesh, const MeshAttribute *p_attribute, const void *p_positions, u32 first_index, u32 triangle_count) {
+	v3f32 a_triangle_positions[MESH_CLUSTER_TRIANGLE_COUNT][3];
+	v3f32 a_triangle_normals[MESH_CLUSTER_TRIANGLE_COUNT];
+	v3f32 min_position = { INFINITY, INFINITY, INFINITY };
+	v3f32 max_position = { -INFINITY, -INFINITY, -INFINITY };
+	v3f32 normal_sum = { 0.f, 0.f, 0.f };
+	for(u32 triangle_index = 0; triangle_index < triangle_count; ++triangle_index) {
+		v3f32 *p_triangle = a_triangle_positions[triangle_index];
+		for(u32 vertex = 0; vertex < 3; ++vertex) {
+			u32 index_index = first_index + triangle_index * 3 + vertex;
+			u32 vertex_index = (p_mesh->index_format == INDEX_FORMAT_R16_UINT) ? ((const u16*)p_mesh->p_index_buffer)[index_index] : ((const u32*)p_mesh->p_index_buffer)[index_index];
+			p_triangle[vertex] = get_mesh_vertex_position(p_attribute, p_positions, vertex_index);
+			for(u32 i = 0; i < 3; ++i) {
+				min_position.xyz[i] = MIN(min_position.xyz[i], p_triangle[vertex].xyz[i]);
+				max_position.xyz[i] = MAX(max_position.xyz[i], p_triangle[vertex].xyz[i]);
+			}
+		}
+		// degenerate triangles are never drawn, they don't constrain the cone
+		v3f32 normal = v3f32_cross(v3f32_subtract_v3f32(p_triangle[1], p_triangle[0]), v3f32_subtract_v3f32(p_triangle[2], p_triangle[0]));
+		f32 length = v3f32_length(normal);
+		a_triangle_normals[triangle_index] = (length > 0.f) ? v3f32_mul_f32(normal, 1.f / length) : normal;
+		normal_sum = v3f32_add_v3f32(normal_sum, a_triangle_normals[triangle_index]);
+	}
+
+	MeshCluster cluster;
+	cluster.center = v3f32_mul_f32(v3f32_add_v3f32(min_position, max_position), 0.5f);
+	cluster.radius = 0.f;
+	for(u32 triangle_index = 0; triangle_index < triangle_count; ++triangle_index) {
+		for(u32 vertex = 0; vertex < 3; ++vertex) {
+			cluster.radius = MAX(cluster.radius, v3f32_length(v3f32_subtract_v3f32(a_triangle_positions[triangle_index][vertex], cluster.center)));
+		}
+	}
+
+	// the cone's half angle is the widest angle between its axis and a normal, min_dot is its cosine
+	cluster.cone_axis = normal_sum;
+	cluster.cone_cutoff = 2.f;
+	f32 normal_sum_length = v3f32_length(normal_sum);
+	if(normal_sum_length == 0.f) return cluster;
+	cluster.cone_axis = v3f32_mul_f32(normal_sum, 1.f / normal_sum_length);
+	f32 min_dot = 1.f;
+	for(u32 triangle_index = 0; triangle_index < triangle_count; ++triangle_index) {
+		if(v3f32_dot(a_triangle_normals[triangle_index], a_triangle_normals[triangle_index]) == 0.f) continue;
+		min_dot = MIN(min_dot, v3f32_dot(a_triangle_normals[triangle_index], cluster.cone_axis));
+	}
+	// a cone wider than a hemisphere has a camera position to every side of it that sees some triangle's front
+	if(min_dot > 0.f) {
+		cluster.cone_cutoff = sqrtf(1.f - min_dot * min_dot);
+	}
+	return cluster;
 }
 
+// Splits every LOD of the mapped mesh into clusters of MESH_CLUSTER_TRIANGLE_COUNT consecutive triangles for
+// cluster_culling_stage, the mesh optimizer already grouped neighbouring triangles, so the runs are compact. The mesh's
+// bounding sphere encloses the clusters of LOD 0.
+void build_mesh_clusters(Mesh *p_mesh) {
+	const MeshFileHeader *p_header = p_mesh->file.p_header;
+	u32 position_attribute_index = 0;
+	while(position_attribute_index < p_header->attribute_count && p_header->a_attributes[position_attribute_index].semantic != MESH_ATTRIBUTE_SEMANTIC_POSITION) {
+		++position_attribute_index;
+	}
+	if(position_attribute_index == p_header->attribute_count) return;
+	const MeshAttribute *p_attribute = p_header->a_attributes + position_attribute_index;
+	const void *p_positions = mesh_file_get_stream(&p_mesh->file, position_attribute_index);
+
+	p_mesh->cluster_count = 0;
+	for(u32 lod_index = 0; lod_index < p_mesh->lod_count; ++lod_index) {
+		p_mesh->a_lod_first_clusters[lod_index] = p_mesh->cluster_count;
+		p_mesh->cluster_count += (p_mesh->a_lods[lod_index].index_count / 3 + MESH_CLUSTER_TRIANGLE_COUNT - 1) / MESH_CLUSTER_TRIANGLE_COUNT;
+	}
+	p_mesh->p_clusters = malloc(p_mesh->cluster_count * sizeof(MeshCluster));
+	for(u32 lod_index = 0; lod_index < p_mesh->lod_count; ++lod_index) {
+		const MeshLod *p_lod = p_mesh->a_lods + lod_index;
+		u32 triangle_count = p_lod->index_count / 3;
+		MeshCluster *p_clusters = p_mesh->p_clusters + p_mesh->a_lod_first_clusters[lod_index];
+		for(u32 first_triangle = 0; first_triangle < triangle_count; first_triangle += MESH_CLUSTER_TRIANGLE_COUNT) {
+			*p_clusters++ = build_mesh_cluster(p_mesh, p_attribute, p_positions, p_lod->first_index + first_triangle * 3,
+				MIN(MESH_CLUSTER_TRIANGLE_COUNT, triangle_count - first_triangle));
+		}
+	}
+
+	u32 lod0_cluster_count = (p_mesh->lod_count > 1) ? p_mesh->a_lod_first_clusters[1] : p_mesh->cluster_count;
+	v3f32 min_position = { INFINITY, INFINITY, INFINITY };
+	v3f32 max_position = { -INFINITY, -INFINITY, -INFINITY };
+	for(u32 cluster_index = 0; cluster_index < lod0_cluster_count; ++cluster_index) {
+		const MeshCluster *p_cluster = p_mesh->p_clusters + cluster_index;
+		for(u32 i = 0; i < 3; ++i) {
+			min_position.xyz[i] = MIN(min_position.xyz[i], p_cluster->center.xyz[i] - p_cluster->radius);
+			max_position.xyz[i] = MAX(max_position.xyz[i], p_cluster->center.xyz[i] + p_cluster->radius);
+		}
+	}
+	p_mesh->center = v3f32_mul_f32(v3f32_add_v3f32(min_position, max_position), 0.5f);
+	p_mesh->radius = 0.f;
+	for(u32 cluster_index = 0; cluster_index < lod0_cluster_count; ++cluster_index) {
+		const MeshCluster *p_cluster = p_mesh->p_clusters + cluster_index;
+		p_mesh->radius = MAX(p_mesh->radius, v3f32_length(v3f32_subtract_v3f32(p_cluster->center, p_mesh->center)) + p_cluster->radius);
+	}
+}
+
+// Maps a v2 mesh, the input assembler reads it in place. A mesh that only exists as a v1 .octrn file, the name without
+// the trailing 2, is converted first.
 void load_mesh(const char *p_mesh_name, Mesh *p_mesh) {
-	void *p_data = NULL;
-	OCTARINE_MESH_RESULT result = octarine_mesh_read_from_file(p_mesh_name, &(p_mesh->header), &p_data);
-	if(result != OCTARINE_MESH_OK) { assert(false); };
+	f64 start_ms = get_time_ms();
+	if(!mesh_file_map(p_mesh_name, &p_mesh->file)) {
+		char octrn_file_name[MAX_PATH];
+		strncpy(octrn_file_name, p_mesh_name, MAX_PATH - 1);
+		octrn_file_name[MAX_PATH - 1] = '\0';
+		octrn_file_name[strlen(octrn_file_name) - 1] = '\0';
+		MeshOptimizationStats optimization_stats;
+		if(!mesh_file_convert_from_octrn(octrn_file_name, p_mesh_name, &optimization_stats) || !mesh_file_map(p_mesh_name, &p_mesh->file)) {
+			error("load_mesh", "Couldn't load or convert the mesh!");
+		}
+		log_mesh_optimization_stats(p_mesh_name, &optimization_stats);
+	}
+	f64 map_ms = get_time_ms();
+
+	const MeshFileHeader *p_header = p_mesh->file.p_header;
+	p_mesh->header.size = (u32)p_header->file_size;
+	p_mesh->header.vertex_count = p_header->vertex_count;
+	p_mesh->header.index_count = p_header->a_lods[0].index_count;
+	p_mesh->lod_count = p_header->lod_count;
+	memcpy(p_mesh->a_lods, p_header->a_lods, p_header->lod_count * sizeof(MeshLod));
+	p_mesh->p_index_buffer = mesh_file_get_indices(&p_mesh->file);
+	p_mesh->index_format = (p_header->index_size == sizeof(u16)) ? INDEX_FORMAT_R16_UINT : INDEX_FORMAT_R32_UINT;
+	// every attribute stream is bound to a slot of its own
+	InputLayout *p_input_layout = &p_mesh->input_layout;
+	memset(p_input_layout, 0, sizeof(InputLayout));
+	for(u32 attribute_index = 0; attribute_index < p_header->attribute_count; ++attribute_index) {
+		const MeshAttribute *p_attribute = p_header->a_attributes + attribute_index;
+		p_mesh->ap_vertex_buffers[attribute_index] = mesh_file_get_stream(&p_mesh->file, attribute_index);
+		p_mesh->a_vertex_buffer_strides[attribute_index] = p_attribute->stride;
+		InputElementDesc element = { attribute_index, 0, p_attribute->format, p_attribute->component_count };
+		memcpy(element.a_scale, p_attribute->a_scale, sizeof(element.a_scale));
+		memcpy(element.a_bias, p_attribute->a_bias, sizeof(element.a_bias));
+		p_input_layout->a_elements[p_input_layout->element_count++] = element;
+		p_input_layout->component_count += p_attribute->component_count;
+	}
+	build_mesh_clusters(p_mesh);
+	log_message("load_mesh %-59s %8u vertices | %2u-bit indices | %6u clusters | map: %8.2f ms | clusters: %8.2f ms\n", p_mesh_name,
+		p_header->vertex_count, p_header->index_size * 8, p_mesh->cluster_count, map_ms - start_ms, get_time_ms() - map_ms);
+	for(u32 lod_index = 0; lod_index < p_mesh->lod_count; ++lod_index) {
+		log_message("    lod %u: %8u triangles | error: %10.6f\n", lod_index, p_mesh->a_lods[lod_index].index_count / 3, p_mesh->a_lods[lod_index].error);
+	}
+}
+
+// For the built-in meshes, whose vertices are interleaved 32-bit floats in a single buffer
+void init_interleaved_mesh(Mesh *p_mesh, const void *p_vertex_buffer, u32 vertex_size, const u32 *p_index_buffer, u32 index_count) {
+	memset(p_mesh, 0, sizeof(Mesh));
+	p_mesh->header.index_count = index_count;
+	p_mesh->ap_vertex_buffers[0] = p_vertex_buffer;
+	p_mesh->a_vertex_buffer_strides[0] = vertex_size;
+	p_mesh->p_index_buffer = p_index_buffer;
+	p_mesh->index_format = INDEX_FORMAT_R32_UINT;
+	MeshLod lod = { 0, index_count, 0.f };
+	p_mesh->a_lods[0] = lod;
+	p_mesh->lod_count = 1;
+	InputElementDesc element = { 0, 0, MESH_ATTRIBUTE_FORMAT_FLOAT32, vertex_size / sizeof(f32) };
+	p_mesh->input_layout.a_elements[0] = element;
+	p_mesh->input_layout.element_count = 1;
+	p_mesh->input_layout.component_count = element.component_count;
+}
+
+// Copies the texels of src into a newly allocated texture with the given memory layout
+Texture2D create_texture_with_layout(Texture2D src, TextureLayout layout, u32 texel_size) {
+	Texture2D dst = src;
+	dst.layout = layout;
+	dst.width_in_blocks = (src.width + TEXTURE_BLOCK_DIM - 1) / TEXTURE_BLOCK_DIM;
+	u32 height_in_blocks = (src.height + TEXTURE_BLOCK_DIM - 1) / TEXTURE_BLOCK_DIM;
+	u32 texel_count = (layout == TEXTURE_LAYOUT_TILED_4X4) ? dst.width_in_blocks * height_in_blocks * TEXTURE_BLOCK_DIM * TEXTURE_BLOCK_DIM : src.width * src.height;
+	dst.p_data = malloc(texel_count * texel_size);
+
+	for(i32 t = 0; t < (i32)src.height; ++t) {
+		for(i32 s = 0; s < (i32)src.width; ++s) {
+			memcpy((u8*)dst.p_data + get_texel_index(dst, s, t) * texel_size, (u8*)src.p_data + get_texel_index(src, s, t) * texel_size, texel_size);
+		}
+	}
+	return dst;
+}
+
+u64 get_texture_size(Texture2D tex) {
+	u32 height_in_blocks = (tex.height + TEXTURE_BLOCK_DIM - 1) / TEXTURE_BLOCK_DIM;
+	switch(tex.format) {
+		case TEXTURE_FORMAT_BC1_UNORM:
+		case TEXTURE_FORMAT_BC1_UNORM_SRGB: return (u64)tex.width_in_blocks * height_in_blocks * 8;
+		case TEXTURE_FORMAT_BC3_UNORM:
+		case TEXTURE_FORMAT_BC3_UNORM_SRGB:
+		case TEXTURE_FORMAT_BC7_UNORM:
+		case TEXTURE_FORMAT_BC7_UNORM_SRGB:
+		case TEXTURE_FORMAT_BC6H_UF16: return (u64)tex.width_in_blocks * height_in_blocks * 16;
+		default: break;
+	}
+	u32 texel_size = (tex.format == TEXTURE_FORMAT_R8G8B8A8_UNORM) ? sizeof(u32) : (tex.format == TEXTURE_FORMAT_R16G16B16A16_FLOAT) ? sizeof(u64) : 4 * sizeof(f32);
+	u64 texel_count = (tex.layout == TEXTURE_LAYOUT_TILED_4X4) ? (u64)tex.width_in_blocks * height_in_blocks * TEXTURE_BLOCK_DIM * TEXTURE_BLOCK_DIM : (u64)tex.width * tex.height;
+	return texel_count * texel_size;
+}
 
-	u32 vertex_size = sizeof(float) * 8;
-	u32 vertex_buffer_size = p_mesh->header.vertex_count * vertex_size;
+// 32-bit entries so that 8 channels can be looked up with one gather. Filled by init, before any texture is loaded.
+u32 a_linear_from_srgb_u32[256];
 
-	p_mesh->p_vertex_buffer = p_data;
-	p_mesh->p_index_buffer = (u32*)(((uint8_t*)p_data) + vertex_buffer_size);
+void init_linear_from_srgb_table() {
+	for(u32 i = 0; i < 256; ++i) a_linear_from_srgb_u32[i] = (u32)(srgb_to_linear(i / 255.f) * 255.f + 0.5f);
 }
 
-void load_texture(const char *p_tex_name, Texture2D *p_tex, bool is_in_srgb) {
+// Linearizes the rgb channels of R8G8B8A8 texels in place, alpha is kept linear. Rounds like the block compressed path
+// so that both kinds of srgb textures come out the same.
+void linearize_srgb_texels(u32 *p_texels, u32 texel_count) {
+	const i256 channel_mask = _mm256_set1_epi32(0xFF);
+	for(i32 i = 0; i < (i32)(texel_count & ~(VECTOR_WIDTH - 1)); i += VECTOR_WIDTH) {
+		i256 texels = _mm256_loadu_si256((i256*)(p_texels + i));
+		i256 r = _mm256_i32gather_epi32((const int*)a_linear_from_srgb_u32, _mm256_and_si256(texels, channel_mask), 4);
+		i256 g = _mm256_i32gather_epi32((const int*)a_linear_from_srgb_u32, _mm256_and_si256(_mm256_srli_epi32(texels, 8), channel_mask), 4);
+		i256 b = _mm256_i32gather_epi32((const int*)a_linear_from_srgb_u32, _mm256_and_si256(_mm256_srli_epi32(texels, 16), channel_mask), 4);
+		i256 a = _mm256_andnot_si256(_mm256_set1_epi32(0x00FFFFFF), texels);
+		texels = _mm256_or_si256(_mm256_or_si256(a, r), _mm256_or_si256(_mm256_slli_epi32(g, 8), _mm256_slli_epi32(b, 16)));
+		_mm256_storeu_si256((i256*)(p_texels + i), texels);
+	}
+	for(u32 i = texel_count & ~(VECTOR_WIDTH - 1); i < texel_count; ++i) {
+		u32 texel = p_texels[i];
+		p_texels[i] = (texel & 0xFF000000) | a_linear_from_srgb_u32[texel & 0xFF] | (a_linear_from_srgb_u32[(texel >> 8) & 0xFF] << 8) | (a_linear_from_srgb_u32[(texel >> 16) & 0xFF] << 16);
+	}
+}
+
+// hdr textures are sampled as half floats, half the memory and one 64-bit gather per texel
+u64* convert_float4_texels_to_half(const f32 *p_float_texels, u32 texel_count) {
+	u64 *p_half_texels = malloc(texel_count * sizeof(u64));
+	for(i32 i = 0; i < (i32)(texel_count & ~1u); i += 2) {
+		_mm_storeu_si128((__m128i*)(p_half_texels + i), _mm256_cvtps_ph(_mm256_loadu_ps(p_float_texels + i * 4), _MM_FROUND_TO_NEAREST_INT));
+	}
+	if(texel_count & 1) {
+		_mm_storel_epi64((__m128i*)(p_half_texels + texel_count - 1), _mm_cvtps_ph(_mm_loadu_ps(p_float_texels + (texel_count - 1) * 4), _MM_FROUND_TO_NEAREST_INT));
+	}
+	return p_half_texels;
+}
+
+// Texture preprocessing runs as a chain of passes over the whole texture: read, format conversion, srgb linearization and
+// re-layout. The passes are serial, the loader threads already work on several assets at once and parallel ones would
+// compete with the job workers for every core. Each asset logs how long its passes took. Returns whether the file is a cube.
+bool load_texture(const char *p_tex_name, Texture2D *p_tex, bool is_in_srgb) {
+	f64 start_ms = get_time_ms();
 	OctarineImageHeader header;
 	OCTARINE_IMAGE result = octarine_image_read_from_file(p_tex_name, &header, &(p_tex->p_data));
 	if(result != OCTARINE_IMAGE_OK) { assert(false); };
+	f64 read_ms = get_time_ms();
 
 	p_tex->width = header.width;
 	p_tex->height = header.height;
+	p_tex->layout = TEXTURE_LAYOUT_LINEAR;
+	// the faces of a cube file come one after the other, which is the stacked layout of TextureCube. That only holds for
+	// single cubes without mips, which is what load_texture_cube expects.
+	bool is_cube = header.flags & OCTARINE_IMAGE_FLAGS_CUBE;
+	if(is_cube) {
+		p_tex->height *= 6;
+	}
+
+	// block compressed textures are kept compressed, the samplers decode them on demand
+	if(header.format.flags & OCTARINE_IMAGE_FORMAT_FLAG_BLOCK_COMPRESSED) {
+		switch(octarine_image_get_dxgi_format(header.format.as_enum)) {
+			case DXGI_FORMAT_BC1_UNORM: p_tex->format = is_in_srgb ? TEXTURE_FORMAT_BC1_UNORM_SRGB : TEXTURE_FORMAT_BC1_UNORM; break;
+			case DXGI_FORMAT_BC1_UNORM_SRGB: p_tex->format = TEXTURE_FORMAT_BC1_UNORM_SRGB; break;
+			case DXGI_FORMAT_BC3_UNORM: p_tex->format = is_in_srgb ? TEXTURE_FORMAT_BC3_UNORM_SRGB : TEXTURE_FORMAT_BC3_UNORM; break;
+			case DXGI_FORMAT_BC3_UNORM_SRGB: p_tex->format = TEXTURE_FORMAT_BC3_UNORM_SRGB; break;
+			case DXGI_FORMAT_BC7_UNORM: p_tex->format = is_in_srgb ? TEXTURE_FORMAT_BC7_UNORM_SRGB : TEXTURE_FORMAT_BC7_UNORM; break;
+			case DXGI_FORMAT_BC7_UNORM_SRGB: p_tex->format = TEXTURE_FORMAT_BC7_UNORM_SRGB; break;
+			case DXGI_FORMAT_BC6H_UF16: p_tex->format = TEXTURE_FORMAT_BC6H_UF16; break;
+			default: error("load_texture", "Unsupported block compressed texture format!");
+		}
+		p_tex->width_in_blocks = (header.width + TEXTURE_BLOCK_DIM - 1) / TEXTURE_BLOCK_DIM;
+		log_message("load_texture %-56s %5u x %-5u read: %8.2f ms\n", p_tex_name, p_tex->width, p_tex->height, read_ms - start_ms);
+		return is_cube;
+	}
+	u32 texel_size = header.format.num_bits_per_pixel / 8;
+	u32 texel_count = p_tex->width * p_tex->height;
+	p_tex->format = TEXTURE_FORMAT_R8G8B8A8_UNORM;
+	if(header.format.type == OCTARINE_IMAGE_FORMAT_FLOAT) {
+		p_tex->format = (texel_size == sizeof(u64)) ? TEXTURE_FORMAT_R16G16B16A16_FLOAT : TEXTURE_FORMAT_R32G32B32A32_FLOAT;
+	}
 
-	// if texture is in srgb color space get rid of gamma mapping
-	if(is_in_srgb){
-		for(i32 t = 0; t < header.height; ++t) {
-			for(i32 s = 0; s < header.width; ++s) {
-				v4f32 texel = decode_u32_as_color(get_texel_u(*p_tex, s, t));
-				texel.x = srgb_to_linear(texel.x);
-				texel.y = srgb_to_linear(texel.y);
-				texel.z = srgb_to_linear(texel.z);
-				texel.w = srgb_to_linear(texel.w);
-				((u32*)p_tex->p_data)[t*p_tex->width + s] = encode_color_as_u32(texel);
+	if(p_tex->format == TEXTURE_FORMAT_R32G32B32A32_FLOAT) {
+		u64 *p_half_texels = convert_float4_texels_to_half((const f32*)p_tex->p_data, texel_count);
+		free(p_tex->p_data);
+		p_tex->p_data = p_half_texels;
+		p_tex->format = TEXTURE_FORMAT_R16G16B16A16_FLOAT;
+		texel_size = sizeof(u64);
+	}
+	else if(is_in_srgb && p_tex->format == TEXTURE_FORMAT_R8G8B8A8_UNORM) {
+		linearize_srgb_texels((u32*)p_tex->p_data, texel_count);
+	}
+	f64 convert_ms = get_time_ms();
+
+	// re-lay the texels in 4x4 blocks, so the bilinear footprints of neighbouring pixels share cache lines on rotated geometry
+	Texture2D tiled_tex = create_texture_with_layout(*p_tex, TEXTURE_LAYOUT_TILED_4X4, texel_size);
+	free(p_tex->p_data);
+	*p_tex = tiled_tex;
+	f64 relayout_ms = get_time_ms();
+
+	log_message("load_texture %-56s %5u x %-5u read: %8.2f ms | convert: %8.2f ms | re-layout: %8.2f ms\n",
+		p_tex_name, p_tex->width, p_tex->height, read_ms - start_ms, convert_ms - read_ms, relayout_ms - convert_ms);
+	return is_cube;
+}
+
+// inverse of the face selection in sample_cube_x8, sc and tc are in [-1, 1]
+v3f256 get_cube_face_dir_x8(u32 face, f256 sc, f256 tc) {
+	const f256 one = _mm256_set1_ps(1.f);
+	const f256 neg_sc = _mm256_sub_ps(_mm256_setzero_ps(), sc);
+	const f256 neg_tc = _mm256_sub_ps(_mm256_setzero_ps(), tc);
+	switch(face) {
+		case 0: return (v3f256) { one, neg_tc, neg_sc };
+		case 1: return (v3f256) { _mm256_set1_ps(-1.f), neg_tc, sc };
+		case 2: return (v3f256) { sc, one, tc };
+		case 3: return (v3f256) { sc, _mm256_set1_ps(-1.f), neg_tc };
+		case 4: return (v3f256) { sc, neg_tc, one };
+		default: return (v3f256) { neg_sc, neg_tc, _mm256_set1_ps(-1.f) };
+	}
+}
+
+// Resamples a lat-long panorama into a half float cube with faces of a quarter of its width. The panorama is read through
+// the same lookup the shaders used before, so the environment keeps its orientation.
+void create_texture_cube_from_latlon(Texture2D latlon_tex, TextureCube *p_cube) {
+	u32 face_size = latlon_tex.width / 4;
+	Texture2D faces = { 0 };
+	faces.width = face_size;
+	faces.height = 6 * face_size;
+	faces.layout = TEXTURE_LAYOUT_LINEAR;
+	faces.format = TEXTURE_FORMAT_R16G16B16A16_FLOAT;
+	faces.p_data = malloc(faces.width * faces.height * sizeof(u64));
+
+	const f32 texel_size = 2.f / face_size;
+	for(i32 row = 0; row < (i32)faces.height; ++row) {
+		u32 face = row / face_size;
+		f256 tc = _mm256_set1_ps(((row % face_size) + 0.5f) * texel_size - 1.f);
+		for(u32 s = 0; s < face_size; s += VECTOR_WIDTH) {
+			i256 s_x8 = _mm256_add_epi32(_mm256_set1_epi32(s), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+			i256 mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(face_size), s_x8);
+			f256 sc = _mm256_fmadd_ps(_mm256_add_ps(_mm256_cvtepi32_ps(s_x8), _mm256_set1_ps(0.5f)), _mm256_set1_ps(texel_size), _mm256_set1_ps(-1.f));
+			v3f256 dir = v3f256_normalize(get_cube_face_dir_x8(face, sc, tc));
+			v4f256 color = sample_2D_latlon_x8(latlon_tex, &latlon_sampler, dir, mask);
+
+			__declspec(align(32)) f32 a_channels[4][VECTOR_WIDTH];
+			_mm256_store_ps(a_channels[0], color.x);
+			_mm256_store_ps(a_channels[1], color.y);
+			_mm256_store_ps(a_channels[2], color.z);
+			_mm256_store_ps(a_channels[3], _mm256_set1_ps(1.f));
+			for(u32 lane = 0; lane < VECTOR_WIDTH && s + lane < face_size; ++lane) {
+				__m128 texel = _mm_setr_ps(a_channels[0][lane], a_channels[1][lane], a_channels[2][lane], a_channels[3][lane]);
+				_mm_storel_epi64((__m128i*)((u64*)faces.p_data + row * face_size + s + lane), _mm_cvtps_ph(texel, _MM_FROUND_TO_NEAREST_INT));
 			}
 		}
 	}
+
+	p_cube->faces = create_texture_with_layout(faces, TEXTURE_LAYOUT_TILED_4X4, sizeof(u64));
+	p_cube->face_size = face_size;
+	free(faces.p_data);
+}
+
+// Loads either a cube file or a lat-long panorama, which gets converted to a cube
+void load_texture_cube(const char *p_tex_name, TextureCube *p_cube) {
+	Texture2D tex;
+	if(load_texture(p_tex_name, &tex, false)) {
+		p_cube->faces = tex;
+		p_cube->face_size = tex.width;
+		return;
+	}
+	f64 start_ms = get_time_ms();
+	create_texture_cube_from_latlon(tex, p_cube);
+	free(tex.p_data);
+	log_message("load_texture_cube %-51s %5u x %-5u latlon to cube: %8.2f ms\n", p_tex_name, p_cube->face_size, p_cube->face_size, get_time_ms() - start_ms);
+}
+
+//----------------------------------------  ASSET STREAMING  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+// Scenes are paged in on demand by a pool of loader threads, separate from the job workers so that file reads never
+// hold up a frame. Resident scenes that aren't drawn are evicted, least recently used first, while the resident assets
+// are over asset_memory_budget. Only the main thread requests and evicts scenes.
+
+typedef struct AssetLoader {
+	Asset *a_queue[SceneType_COUNT * MAX_ASSET_COUNT_PER_SCENE]; // every asset is queued at most once at a time
+	u32 queue_head;
+	u32 queue_tail;
+	SRWLOCK queue_lock;
+	HANDLE h_queue_semaphore;
+} AssetLoader;
+
+AssetLoader asset_loader;
+
+void add_scene_asset(Scene *p_scene, AssetType type, u32 object_index, const char *p_file_name, bool is_in_srgb) {
+	assert(p_scene->asset_count < MAX_ASSET_COUNT_PER_SCENE);
+	Asset *p_asset = p_scene->a_assets + p_scene->asset_count++;
+	p_asset->type = type;
+	p_asset->p_file_name = p_file_name;
+	p_asset->p_scene = p_scene;
+	p_asset->object_index = object_index;
+	p_asset->is_in_srgb = is_in_srgb;
+	p_asset->size = 0;
+}
+
+void load_asset(Asset *p_asset) {
+	Scene *p_scene = p_asset->p_scene;
+	switch(p_asset->type) {
+		case ASSET_TYPE_MESH: {
+			Mesh *p_mesh = p_scene->a_meshes + p_asset->object_index;
+			load_mesh(p_asset->p_file_name, p_mesh);
+			// the mapped pages live in the page cache, but they are what a resident mesh costs
+			p_asset->size = p_mesh->file.p_header->file_size + p_mesh->cluster_count * sizeof(MeshCluster);
+		} break;
+		case ASSET_TYPE_TEXTURE: {
+			Texture2D *p_texture = p_scene->a_textures + p_asset->object_index;
+			load_texture(p_asset->p_file_name, p_texture, p_asset->is_in_srgb);
+			p_asset->size = get_texture_size(*p_texture);
+		} break;
+		case ASSET_TYPE_TEXTURE_CUBE: {
+			TextureCube *p_cube = p_scene->a_texture_cubes + p_asset->object_index;
+			load_texture_cube(p_asset->p_file_name, p_cube);
+			p_asset->size = get_texture_size(p_cube->faces);
+		} break;
+	}
+}
+
+void free_asset(Asset *p_asset) {
+	Scene *p_scene = p_asset->p_scene;
+	switch(p_asset->type) {
+		case ASSET_TYPE_MESH:
+			mesh_file_unmap(&p_scene->a_meshes[p_asset->object_index].file);
+			free(p_scene->a_meshes[p_asset->object_index].p_clusters);
+			memset(p_scene->a_meshes + p_asset->object_index, 0, sizeof(Mesh));
+			break;
+		case ASSET_TYPE_TEXTURE:
+			invalidate_decoded_block_caches();
+			free(p_scene->a_textures[p_asset->object_index].p_data);
+			memset(p_scene->a_textures + p_asset->object_index, 0, sizeof(Texture2D));
+			break;
+		case ASSET_TYPE_TEXTURE_CUBE:
+			// compressed cubes are sampled through the decoded block caches too
+			invalidate_decoded_block_caches();
+			free(p_scene->a_texture_cubes[p_asset->object_index].faces.p_data);
+			memset(p_scene->a_texture_cubes + p_asset->object_index, 0, sizeof(TextureCube));
+			break;
+	}
+	p_asset->size = 0;
+}
+
+DWORD WINAPI asset_loader_thread_main(LPVOID p_parameter) {
+	char thread_name[32];
+	sprintf(thread_name, "asset_loader_%u", (u32)(uintptr_t)p_parameter);
+	rmt_SetCurrentThreadName(thread_name);
+	for(;;) {
+		WaitForSingleObject(asset_loader.h_queue_semaphore, INFINITE);
+		AcquireSRWLockExclusive(&asset_loader.queue_lock);
+		Asset *p_asset = asset_loader.a_queue[asset_loader.queue_head++ % ARRAYSIZE(asset_loader.a_queue)];
+		ReleaseSRWLockExclusive(&asset_loader.queue_lock);
+
+		rmt_BeginCPUSample(load_asset, 0);
+		load_asset(p_asset);
+		rmt_EndCPUSample();
+
+		Scene *p_scene = p_asset->p_scene;
+		if(InterlockedDecrement(&p_scene->unloaded_asset_count) == 0) {
+			InterlockedExchange(&p_scene->residency, SCENE_RESIDENCY_RESIDENT);
+			SetEvent(p_scene->h_resident_event);
+		}
+	}
+	return 0;
+}
+
+void init_asset_loader() {
+	InitializeSRWLock(&asset_loader.queue_lock);
+	asset_loader.h_queue_semaphore = CreateSemaphore(NULL, 0, ARRAYSIZE(asset_loader.a_queue), NULL);
+	for(u32 scene_index = 0; scene_index < SceneType_COUNT; ++scene_index) {
+		a_scenes[scene_index].h_resident_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	}
+	for(u32 thread_index = 0; thread_index < ASSET_LOADER_THREAD_COUNT; ++thread_index) {
+		HANDLE h_thread = CreateThread(NULL, 0, asset_loader_thread_main, (LPVOID)(uintptr_t)thread_index, 0, NULL);
+		if(!h_thread) {
+			error_win32("CreateThread", GetLastError());
+		}
+		CloseHandle(h_thread);
+	}
+}
+
+// Starts paging the scene in unless it is resident or loading already, returns whether it is resident
+bool request_scene(Scene *p_scene) {
+	if(p_scene->residency != SCENE_RESIDENCY_EVICTED) {
+		return p_scene->residency == SCENE_RESIDENCY_RESIDENT;
+	}
+	if(p_scene->asset_count == 0) {
+		p_scene->residency = SCENE_RESIDENCY_RESIDENT;
+		SetEvent(p_scene->h_resident_event);
+		return true;
+	}
+	ResetEvent(p_scene->h_resident_event);
+	p_scene->unloaded_asset_count = p_scene->asset_count;
+	p_scene->residency = SCENE_RESIDENCY_LOADING;
+	AcquireSRWLockExclusive(&asset_loader.queue_lock);
+	for(u32 asset_index = 0; asset_index < p_scene->asset_count; ++asset_index) {
+		asset_loader.a_queue[asset_loader.queue_tail++ % ARRAYSIZE(asset_loader.a_queue)] = p_scene->a_assets + asset_index;
+	}
+	ReleaseSRWLockExclusive(&asset_loader.queue_lock);
+	ReleaseSemaphore(asset_loader.h_queue_semaphore, p_scene->asset_count, NULL);
+	return false;
+}
+
+// Blocks until the scene is resident
+void wait_for_scene(Scene *p_scene) {
+	request_scene(p_scene);
+	WaitForSingleObject(p_scene->h_resident_event, INFINITE);
+}
+
+u64 get_scene_size(const Scene *p_scene) {
+	u64 size = 0;
+	for(u32 asset_index = 0; asset_index < p_scene->asset_count; ++asset_index) {
+		size += p_scene->a_assets[asset_index].size;
+	}
+	return size;
+}
+
+u64 get_resident_asset_size() {
+	u64 size = 0;
+	for(u32 scene_index = 0; scene_index < SceneType_COUNT; ++scene_index) {
+		if(a_scenes[scene_index].residency == SCENE_RESIDENCY_RESIDENT) {
+			size += get_scene_size(a_scenes + scene_index);
+		}
+	}
+	return size;
+}
+
+// A scene can go once every frame that draws it is on screen, and it is neither current nor displayed. Returns the size
+// of the assets that stay resident.
+u64 evict_scenes(const Scene *p_current_scene) {
+	u64 resident_size = get_resident_asset_size();
+	// frames before it are resolved, the present thread is done with their buffers
+	u64 presented_frame_count = (u64)swap_chain.presented_frame_count;
+	while(resident_size > asset_memory_budget) {
+		Scene *p_victim = NULL;
+		for(u32 scene_index = 0; scene_index < SceneType_COUNT; ++scene_index) {
+			Scene *p_scene = a_scenes + scene_index;
+			if(p_scene->residency != SCENE_RESIDENCY_RESIDENT || p_scene->asset_count == 0) continue;
+			if(p_scene == p_current_scene || p_scene == p_displayed_scene) continue;
+			if(p_scene->last_used_frame_index >= presented_frame_count) continue;
+			if(!p_victim || p_scene->last_used_frame_index < p_victim->last_used_frame_index) {
+				p_victim = p_scene;
+			}
+		}
+		if(!p_victim) break;
+
+		resident_size -= get_scene_size(p_victim);
+		for(u32 asset_index = 0; asset_index < p_victim->asset_count; ++asset_index) {
+			free_asset(p_victim->a_assets + asset_index);
+		}
+		p_victim->residency = SCENE_RESIDENCY_EVICTED;
+		log_message("evicted scene %u, resident assets: %.2f MB\n", (u32)(p_victim - a_scenes), resident_size / (1024.0 * 1024.0));
+	}
+	return resident_size;
+}
+
+// Picks the scene the frame draws: the current one once it is resident, the last displayed one until then
+const Scene* stream_scenes(u64 frame_index) {
+	rmt_BeginCPUSample(stream_scenes, 0);
+	Scene *p_current_scene = a_scenes + current_scene_index;
+	if(request_scene(p_current_scene)) {
+		p_displayed_scene = p_current_scene;
+	}
+	if(p_displayed_scene) {
+		p_displayed_scene->last_used_frame_index = frame_index;
+	}
+	resident_asset_size = evict_scenes(p_current_scene);
+	rmt_EndCPUSample();
+	return p_displayed_scene;
 }
 
 //----------------------------------------  PIPELINE  ----------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -574,47 +1450,158 @@ inline void set_edge_function(EdgeFunction *p_edge, i32 signed_area, i32 x0, i32
 	p_edge->c = c;
 }
 
-inline void read_tile(v2i32 tile_min_bounds, u32 *p_colors, f32 *p_depths) {
-	for(int j = 0; j < 8; ++j) {
-		for(int i = 0; i < 8; ++i) {
-			i32 x = tile_min_bounds.x + i;
-			i32 y = tile_min_bounds.y + j;
-			const fragment_linear_coordinate = y * (i32)graphics_pipeline.rs.viewport.width + x;
-			p_colors[j * 8 + i] = graphics_pipeline.om.p_colors[fragment_linear_coordinate];
-			p_depths[j * 8 + i] = graphics_pipeline.om.p_depth[fragment_linear_coordinate];
+// a(x,y) = c + dx * x + dy * y, passing through (x_i, y_i, a_i) for the three vertices
+inline void set_plane_equation(PlaneEquation *p_plane, const f32 *p_xs, const f32 *p_ys, f32 one_over_determinant, f32 a0, f32 a1, f32 a2) {
+	f32 dx1 = p_xs[1] - p_xs[0];
+	f32 dy1 = p_ys[1] - p_ys[0];
+	f32 dx2 = p_xs[2] - p_xs[0];
+	f32 dy2 = p_ys[2] - p_ys[0];
+	f32 da1 = a1 - a0;
+	f32 da2 = a2 - a0;
+
+	p_plane->dx = (da1 * dy2 - da2 * dy1) * one_over_determinant;
+	p_plane->dy = (da2 * dx1 - da1 * dx2) * one_over_determinant;
+	p_plane->c = a0 - p_plane->dx * p_xs[0] - p_plane->dy * p_ys[0];
+}
+
+inline u32 get_depth_format_size(DepthFormat format) {
+	return (format == DEPTH_FORMAT_D16_UNORM) ? sizeof(u16) : sizeof(u32);
+}
+
+inline f256 load_depth_row(const u8 *p_row, DepthFormat format) {
+	switch(format) {
+		case DEPTH_FORMAT_D24_UNORM: return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_load_si256((const i256*)p_row)), _mm256_set1_ps(1.0 / 16777215.0));
+		case DEPTH_FORMAT_D16_UNORM: return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_load_si128((const __m128i*)p_row))), _mm256_set1_ps(1.0 / 65535.0));
+		default: return _mm256_load_ps((const f32*)p_row);
+	}
+}
+
+// Returns the depth as it will read back, so that Hi-Z stays conservative with the unorm formats
+inline f256 store_depth_row(u8 *p_row, DepthFormat format, f256 depth) {
+	depth = _mm256_min_ps(_mm256_max_ps(depth, _mm256_setzero_ps()), _mm256_set1_ps(1.0));
+	switch(format) {
+		case DEPTH_FORMAT_D24_UNORM: {
+			i256 encoded = _mm256_cvtps_epi32(_mm256_mul_ps(depth, _mm256_set1_ps(16777215.0)));
+			_mm256_store_si256((i256*)p_row, encoded);
+			return _mm256_mul_ps(_mm256_cvtepi32_ps(encoded), _mm256_set1_ps(1.0 / 16777215.0));
+		}
+		case DEPTH_FORMAT_D16_UNORM: {
+			i256 encoded = _mm256_cvtps_epi32(_mm256_mul_ps(depth, _mm256_set1_ps(65535.0)));
+			_mm_store_si128((__m128i*)p_row, _mm_packus_epi32(_mm256_castsi256_si128(encoded), _mm256_extracti128_si256(encoded, 1)));
+			return _mm256_mul_ps(_mm256_cvtepi32_ps(encoded), _mm256_set1_ps(1.0 / 65535.0));
+		}
+		default: {
+			_mm256_store_ps((f32*)p_row, depth);
+			return depth;
 		}
 	}
 }
 
-inline void write_tile(u32 bin_index, u32 *p_colors, f32 *p_depths) {
-	v2i32 tile_min_bounds = { TILE_WIDTH * (bin_index % WIDTH_IN_TILES), TILE_HEIGHT * (bin_index / WIDTH_IN_TILES) };
-	f32 min_tile_depth = 1.0;
-	for(int j = 0; j < 8; ++j) {
-		for(int i = 0; i < 8; ++i) {
-			i32 x = tile_min_bounds.x + i;
-			i32 y = tile_min_bounds.y + j;
-			const fragment_linear_coordinate = y * (i32)graphics_pipeline.rs.viewport.width + x;
-			graphics_pipeline.om.p_colors[fragment_linear_coordinate] = p_colors[j * 8 + i];
-			graphics_pipeline.om.p_depth[fragment_linear_coordinate] = p_depths[j * 8 + i];
-			min_tile_depth = MIN(min_tile_depth, p_depths[j * 8 + i]);
+inline void read_tile(const Pipeline *p_pipeline, u32 bin_index, u32 *p_colors, f32 *p_depths) {
+	const u32 *p_tile_colors = p_pipeline->om.p_colors + bin_index * TILE_TEXEL_COUNT;
+	const DepthFormat depth_format = p_pipeline->om.depth_format;
+	const u32 depth_row_size = get_depth_format_size(depth_format) * TILE_WIDTH;
+	const u8 *p_tile_depths = p_pipeline->om.p_depth + bin_index * depth_row_size * TILE_HEIGHT;
+	const TileMetadata *p_tile_metadata = p_pipeline->om.p_tile_metadata;
+	u8 flags = p_tile_metadata->a_flags[bin_index];
+
+	if(flags & TILE_FLAG_COLOR_CLEARED) {
+		i256 clear_color = _mm256_set1_epi32(p_tile_metadata->color_clear_value);
+		for(int j = 0; j < TILE_HEIGHT; ++j) {
+			_mm256_store_si256((i256*)(p_colors + j * TILE_WIDTH), clear_color);
+		}
+	}
+	else {
+		for(int j = 0; j < TILE_HEIGHT; ++j) {
+			_mm256_store_si256((i256*)(p_colors + j * TILE_WIDTH), _mm256_load_si256((const i256*)(p_tile_colors + j * TILE_WIDTH)));
+		}
+	}
+
+	if(flags & TILE_FLAG_DEPTH_PLANE) {
+		PlaneEquation plane = p_tile_metadata->a_depth_planes[bin_index];
+		f32 x0 = (f32)(TILE_WIDTH * (bin_index % WIDTH_IN_TILES));
+		f32 y0 = (f32)(TILE_HEIGHT * (bin_index / WIDTH_IN_TILES));
+		f256 x = _mm256_add_ps(_mm256_set1_ps(x0), _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0));
+		for(int j = 0; j < TILE_HEIGHT; ++j) {
+			_mm256_store_ps(p_depths + j * TILE_WIDTH, _mm256_fmadd_ps(_mm256_set1_ps(plane.dx), x, _mm256_set1_ps(plane.c + plane.dy * (y0 + j))));
+		}
+	}
+	else {
+		for(int j = 0; j < TILE_HEIGHT; ++j) {
+			_mm256_store_ps(p_depths + j * TILE_WIDTH, load_depth_row(p_tile_depths + j * depth_row_size, depth_format));
 		}
 	}
-	a_tile_min_depths[bin_index] = min_tile_depth;
 }
 
-inline f32 get_tile_minimum_depth(u32 bin_index) {
-	return a_tile_min_depths[bin_index];
+inline void write_tile(const Pipeline *p_pipeline, u32 bin_index, u32 *p_colors, f32 *p_depths, const PlaneEquation *p_depth_plane) {
+	u32 *p_tile_colors = p_pipeline->om.p_colors + bin_index * TILE_TEXEL_COUNT;
+	const DepthFormat depth_format = p_pipeline->om.depth_format;
+	const u32 depth_row_size = get_depth_format_size(depth_format) * TILE_WIDTH;
+	u8 *p_tile_depths = p_pipeline->om.p_depth + bin_index * depth_row_size * TILE_HEIGHT;
+	TileMetadata *p_tile_metadata = p_pipeline->om.p_tile_metadata;
+	f256 min_depth = _mm256_set1_ps(1.0);
+	for(int j = 0; j < TILE_HEIGHT; ++j) {
+		f256 depth = _mm256_load_ps(p_depths + j * TILE_WIDTH);
+		_mm256_store_si256((i256*)(p_tile_colors + j * TILE_WIDTH), _mm256_load_si256((const i256*)(p_colors + j * TILE_WIDTH)));
+		if(!p_depth_plane) {
+			depth = store_depth_row(p_tile_depths + j * depth_row_size, depth_format, depth);
+		}
+		min_depth = _mm256_min_ps(min_depth, depth);
+	}
+	// horizontal min of the 8 lanes
+	min_depth = _mm256_min_ps(min_depth, _mm256_permute2f128_ps(min_depth, min_depth, 1));
+	min_depth = _mm256_min_ps(min_depth, _mm256_shuffle_ps(min_depth, min_depth, _MM_SHUFFLE(1, 0, 3, 2)));
+	min_depth = _mm256_min_ps(min_depth, _mm256_shuffle_ps(min_depth, min_depth, _MM_SHUFFLE(2, 3, 0, 1)));
+	p_tile_metadata->a_min_depths[bin_index] = _mm256_cvtss_f32(min_depth);
+
+	if(p_depth_plane) {
+		p_tile_metadata->a_depth_planes[bin_index] = *p_depth_plane;
+		p_tile_metadata->a_flags[bin_index] = TILE_FLAG_DEPTH_PLANE;
+	}
+	else {
+		p_tile_metadata->a_flags[bin_index] = 0;
+	}
 }
 
-void clip_by_plane(Vertex *p_clipped_vertices, v4f32 plane_normal, f32 plane_d, i32 *p_num_vertices) {
+// Converts the tile-major frame buffer into the linear present buffer, one tile row per 256-bit load/store
+// Tiles that were cleared but never drawn to are resolved straight from the clear value.
+// Runs on the present thread, it is a plain streaming copy that overlaps with the shading of the next frames.
+void resolve_frame_buffer(const SwapChainBuffer *p_buffer, u32 (*a_present_buffer)[WIDTH]) {
+	rmt_BeginCPUSample(resolve_frame_buffer, 0);
+	const TileMetadata *p_tile_metadata = &p_buffer->tile_metadata;
+	for(i32 tile_y = 0; tile_y < HEIGHT_IN_TILES; ++tile_y) {
+		for(u32 tile_x = 0; tile_x < WIDTH_IN_TILES; ++tile_x) {
+			u32 bin_index = tile_y * WIDTH_IN_TILES + tile_x;
+			if(p_tile_metadata->a_flags[bin_index] & TILE_FLAG_COLOR_CLEARED) {
+				i256 clear_color = _mm256_set1_epi32(p_tile_metadata->color_clear_value);
+				for(u32 j = 0; j < TILE_HEIGHT; ++j) {
+					_mm256_stream_si256((i256*)(&a_present_buffer[tile_y * TILE_HEIGHT + j][tile_x * TILE_WIDTH]), clear_color);
+				}
+				continue;
+			}
+			const u32 *p_tile_colors = p_buffer->a_colors[bin_index];
+			for(u32 j = 0; j < TILE_HEIGHT; ++j) {
+				i256 row = _mm256_load_si256((const i256*)(p_tile_colors + j * TILE_WIDTH));
+				_mm256_stream_si256((i256*)(&a_present_buffer[tile_y * TILE_HEIGHT + j][tile_x * TILE_WIDTH]), row);
+			}
+		}
+	}
+	_mm_sfence();
+	rmt_EndCPUSample();
+}
+
+inline f32 get_tile_minimum_depth(const TileMetadata *p_tile_metadata, u32 bin_index) {
+	return p_tile_metadata->a_min_depths[bin_index];
+}
+
+void clip_by_plane(Vertex *p_clipped_vertices, v4f32 plane_normal, f32 plane_d, i32 *p_num_vertices, u32 num_components) {
 
 	u32 num_out_vertices = 0;
 	u32 num_vertices = *p_num_vertices;
-	u32 num_attributes = graphics_pipeline.vs.output_register_count;
 	static u32 num_generated_clipped_vertices = 0;
 	Vertex a_result_vertices[MAX_NUM_CLIP_VERTICES];
 
-	f32 current_dot = v4f32_dot(plane_normal, (p_clipped_vertices)[0].a_attributes[0]);
+	f32 current_dot = v4f32_dot(plane_normal, get_vertex_position(p_clipped_vertices));
 	bool is_current_inside = current_dot > -plane_d;
 
 	for(int i = 0; i < num_vertices; i++) {
@@ -622,18 +1609,17 @@ void clip_by_plane(Vertex *p_clipped_vertices, v4f32 plane_normal, f32 plane_d,
 
 		int next = (i + 1) % num_vertices;
 		if(is_current_inside) {
-			a_result_vertices[num_out_vertices++] = p_clipped_vertices[i];
+			memcpy(a_result_vertices + num_out_vertices++, p_clipped_vertices + i, num_components * sizeof(f32));
 		}
 
-		float next_dot = v4f32_dot(plane_normal, p_clipped_vertices[next].a_attributes[0]);
+		float next_dot = v4f32_dot(plane_normal, get_vertex_position(p_clipped_vertices + next));
 		bool is_next_inside = next_dot > -plane_d;
 		if(is_current_inside != is_next_inside) {
 			assert(num_generated_clipped_vertices < MAX_NUM_CLIP_VERTICES);
 			f32 t = (plane_d + current_dot) / (current_dot - next_dot);
-			for(u32 attribute_index = 0; attribute_index < num_attributes; ++attribute_index) {
-				a_result_vertices[num_out_vertices].a_attributes[attribute_index] = v4f32_add_v4f32(
-					v4f32_mul_f32(p_clipped_vertices[i].a_attributes[attribute_index], (1.f - t)),
-					v4f32_mul_f32(p_clipped_vertices[next].a_attributes[attribute_index], t));
+			for(u32 component_index = 0; component_index < num_components; ++component_index) {
+				a_result_vertices[num_out_vertices].a_components[component_index] =
+					p_clipped_vertices[i].a_components[component_index] * (1.f - t) + p_clipped_vertices[next].a_components[component_index] * t;
 			}
 			num_out_vertices++;
 		}
@@ -643,111 +1629,246 @@ void clip_by_plane(Vertex *p_clipped_vertices, v4f32 plane_normal, f32 plane_d,
 	}
 
 	*p_num_vertices = num_out_vertices;
-	memcpy(p_clipped_vertices, a_result_vertices, sizeof(Vertex)*num_out_vertices);
+	for(u32 vertex_index = 0; vertex_index < num_out_vertices; ++vertex_index) {
+		memcpy(p_clipped_vertices + vertex_index, a_result_vertices + vertex_index, num_components * sizeof(f32));
+	}
 }
 
-void clipper(Vertex *p_clipped_vertices, i32 *p_num_clipped_vertices) {
+void clipper(Vertex *p_clipped_vertices, i32 *p_num_clipped_vertices, u32 num_components) {
 	//rmt_BeginCPUSample(clipper, RMTSF_Aggregate);
 
-	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { 1, 0, 0, 1 }), 0, p_num_clipped_vertices);	// -w <= x <==> 0 <= x + w
-	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { -1, 0, 0, 1 }), 0, p_num_clipped_vertices);	//  x <= w <==> 0 <= w - x
-	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { 0, 1, 0, 1 }), 0, p_num_clipped_vertices);	// -w <= y <==> 0 <= y + w
-	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { 0, -1, 0, 1 }), 0, p_num_clipped_vertices);	//  y <= w <==> 0 <= w - y
-	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { 0, 0, 1, 1 }), 0, p_num_clipped_vertices);	// -w <= z <==> 0 <= z + w
-	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { 0, 0, -1, 1 }), 0, p_num_clipped_vertices);	//  z <= w <==> 0 <= w - z
+	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { 1, 0, 0, 1 }), 0, p_num_clipped_vertices, num_components);	// -w <= x <==> 0 <= x + w
+	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { -1, 0, 0, 1 }), 0, p_num_clipped_vertices, num_components);	//  x <= w <==> 0 <= w - x
+	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { 0, 1, 0, 1 }), 0, p_num_clipped_vertices, num_components);	// -w <= y <==> 0 <= y + w
+	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { 0, -1, 0, 1 }), 0, p_num_clipped_vertices, num_components);	//  y <= w <==> 0 <= w - y
+	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { 0, 0, 1, 1 }), 0, p_num_clipped_vertices, num_components);	// -w <= z <==> 0 <= z + w
+	clip_by_plane(p_clipped_vertices, v4f32_normalize((v4f32) { 0, 0, -1, 1 }), 0, p_num_clipped_vertices, num_components);	//  z <= w <==> 0 <= w - z
 
 	//rmt_EndCPUSample();
 }
 
-void input_assembler_stage(u32 index_count, void **pp_vertex_input_data) {
-	rmt_BeginCPUSample(input_assambler_stage, 0);
+// Decodes 8 vertices of an input element into the vertex shader input, returns where the next element goes. 16-bit
+// components are gathered in pairs as 32-bit words.
+__forceinline f256* gather_input_element(const InputElementDesc *p_element, const u8 *p_vertex_buffer, i256 vertex_offset, f256 *p_vertex) {
+	switch(p_element->format) {
+		case MESH_ATTRIBUTE_FORMAT_FLOAT32: {
+			for(u32 i = 0; i < p_element->component_count; ++i) {
+				*p_vertex++ = _mm256_i32gather_ps((const f32*)p_vertex_buffer + i, vertex_offset, 1);
+			}
+		} break;
+		case MESH_ATTRIBUTE_FORMAT_FLOAT16: {
+			for(u32 i = 0; i < p_element->component_count; i += 2) {
+				i256 words = _mm256_i32gather_epi32((const i32*)((const u16*)p_vertex_buffer + i), vertex_offset, 1);
+				// packs the low and the high halves, each into a lane order 128 bits
+				i256 lows = _mm256_and_si256(words, _mm256_set1_epi32(0xFFFF));
+				i256 highs = _mm256_srli_epi32(words, 16);
+				i256 packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lows, highs), _MM_SHUFFLE(3, 1, 2, 0));
+				*p_vertex++ = _mm256_cvtph_ps(_mm256_castsi256_si128(packed));
+				if(i + 1 < p_element->component_count) {
+					*p_vertex++ = _mm256_cvtph_ps(_mm256_extracti128_si256(packed, 1));
+				}
+			}
+		} break;
+		case MESH_ATTRIBUTE_FORMAT_UNORM16: {
+			for(u32 i = 0; i < p_element->component_count; i += 2) {
+				i256 words = _mm256_i32gather_epi32((const i32*)((const u16*)p_vertex_buffer + i), vertex_offset, 1);
+				f256 low = _mm256_cvtepi32_ps(_mm256_and_si256(words, _mm256_set1_epi32(0xFFFF)));
+				*p_vertex++ = _mm256_fmadd_ps(low, _mm256_set1_ps(p_element->a_scale[i] / 65535.f), _mm256_set1_ps(p_element->a_bias[i]));
+				if(i + 1 < p_element->component_count) {
+					f256 high = _mm256_cvtepi32_ps(_mm256_srli_epi32(words, 16));
+					*p_vertex++ = _mm256_fmadd_ps(high, _mm256_set1_ps(p_element->a_scale[i + 1] / 65535.f), _mm256_set1_ps(p_element->a_bias[i + 1]));
+				}
+			}
+		} break;
+		case MESH_ATTRIBUTE_FORMAT_OCTAHEDRAL_SNORM16: {
+			i256 words = _mm256_i32gather_epi32((const i32*)p_vertex_buffer, vertex_offset, 1);
+			f256 normalizer = _mm256_set1_ps(1.f / 32767.f);
+			f256 x = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(words, 16), 16)), normalizer);
+			f256 y = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(words, 16)), normalizer);
+			v3f256 normal = decode_octahedral_x8(x, y);
+			*p_vertex++ = normal.x;
+			*p_vertex++ = normal.y;
+			*p_vertex++ = normal.z;
+		} break;
+	}
+	return p_vertex;
+}
+
+// A cluster is culled when all of its triangles face away from the eye, when its bounding sphere is outside the frustum
+// or when it is behind the depth the tiles it covers already hold.
+bool is_cluster_visible(const Pipeline *p_pipeline, const MeshCluster *p_cluster, v3f32 eye) {
+	// Front faces have world space cross product normals that point towards the eye, PA keeps negative signed areas and the
+	// view to world change of basis is a mirror. So every triangle faces away from an eye that is behind all of their
+	// planes, which holds when the eye looks at the sphere along the cone's axis, within the complement of the cone's angle
+	// and with the radius as margin. Points on the triangle planes are within the sphere.
+	v3f32 center_from_eye = v3f32_subtract_v3f32(p_cluster->center, eye);
+	if(v3f32_dot(center_from_eye, p_cluster->cone_axis) >= p_cluster->cone_cutoff * v3f32_length(center_from_eye) + p_cluster->radius) {
+		return false;
+	}
+
+	// the 8 corners of the sphere's bounding box, a cluster is outside the frustum if all of them are outside one plane
+	const m4x4f32 *p_clip_from_world = &p_pipeline->cc.p_per_frame_cb->clip_from_world;
+	v4f32 a_corners[8];
+	u32 outside_all_mask = 0b111111;
+	bool is_in_front_of_eye = true;
+	for(u32 corner_index = 0; corner_index < 8; ++corner_index) {
+		v4f32 corner = {
+			p_cluster->center.x + ((corner_index & 1) ? p_cluster->radius : -p_cluster->radius),
+			p_cluster->center.y + ((corner_index & 2) ? p_cluster->radius : -p_cluster->radius),
+			p_cluster->center.z + ((corner_index & 4) ? p_cluster->radius : -p_cluster->radius),
+			1.f
+		};
+		v4f32 clip = m4x4f32_mul_v4f32(p_clip_from_world, corner);
+		u32 outside_mask = (clip.x < -clip.w) | ((clip.x > clip.w) << 1) | ((clip.y < -clip.w) << 2) | ((clip.y > clip.w) << 3) |
+			((clip.z < 0.f) << 4) | ((clip.z > clip.w) << 5);
+		outside_all_mask &= outside_mask;
+		is_in_front_of_eye &= (clip.w > 0.f) && (clip.z <= clip.w);
+		a_corners[corner_index] = clip;
+	}
+	if(outside_all_mask) return false;
+	// a box that crosses the near plane covers unbounded screen space
+	if(!is_in_front_of_eye) return true;
+
+	// Hierarchical-Z against the tile depths of the draws before this one. The rasterizer updates them concurrently, but
+	// they only ever grow within a frame, so reading an older value is conservative.
+	Viewport viewport = p_pipeline->rs.viewport;
+	f32 min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY, max_depth = 0.f;
+	for(u32 corner_index = 0; corner_index < 8; ++corner_index) {
+		v4f32 clip = a_corners[corner_index];
+		f32 one_over_w = 1.f / clip.w;
+		f32 x = (clip.x * one_over_w * 0.5f + 0.5f) * viewport.width + viewport.top_left_x;
+		f32 y = (-clip.y * one_over_w * 0.5f + 0.5f) * viewport.height + viewport.top_left_y;
+		f32 depth = clip.z * one_over_w * (viewport.max_depth - viewport.min_depth) + viewport.min_depth;
+		min_x = MIN(min_x, x); max_x = MAX(max_x, x);
+		min_y = MIN(min_y, y); max_y = MAX(max_y, y);
+		max_depth = MAX(max_depth, depth);
+	}
+	i32 min_tile_x = MAX((i32)min_x, 0) / TILE_WIDTH;
+	i32 min_tile_y = MAX((i32)min_y, 0) / TILE_HEIGHT;
+	i32 max_tile_x = MIN(MIN((i32)max_x, (i32)viewport.width - 1) / TILE_WIDTH, WIDTH_IN_TILES - 1);
+	i32 max_tile_y = MIN(MIN((i32)max_y, (i32)viewport.height - 1) / TILE_HEIGHT, HEIGHT_IN_TILES - 1);
+	const TileMetadata *p_tile_metadata = p_pipeline->om.p_tile_metadata;
+	for(i32 tile_y = min_tile_y; tile_y <= max_tile_y; ++tile_y) {
+		for(i32 tile_x = min_tile_x; tile_x <= max_tile_x; ++tile_x) {
+			if(max_depth >= get_tile_minimum_depth(p_tile_metadata, tile_y * WIDTH_IN_TILES + tile_x)) return true;
+		}
+	}
+	return false;
+}
+
+// Copies the indices of the visible clusters among triangles [first_triangle, first_triangle + triangle_count) to
+// p_culled_indices, in the bound index format. The result is padded with zero indices to whole batches of 8 triangles,
+// the degenerate triangles are dropped by PA. Returns the index count, the padding included.
+u32 cluster_culling_stage(const Pipeline *p_pipeline, u32 first_triangle, u32 triangle_count, void *p_culled_indices, volatile long *p_culled_triangle_count) {
+	rmt_BeginCPUSample(cluster_culling_stage, RMTSF_Aggregate);
+
+	// geometry jobs start on cluster boundaries, GEOMETRY_JOB_TRIANGLE_COUNT is a multiple of MESH_CLUSTER_TRIANGLE_COUNT
+	assert(first_triangle % MESH_CLUSTER_TRIANGLE_COUNT == 0);
+	const IA *p_ia = &p_pipeline->ia;
+	u32 index_size = (p_ia->index_format == INDEX_FORMAT_R16_UINT) ? sizeof(u16) : sizeof(u32);
+	v4f32 eye = m4x4f32_mul_v4f32(&p_pipeline->cc.p_per_frame_cb->world_from_view, (v4f32) { 0.f, 0.f, 0.f, 1.f });
+	u32 end_triangle = first_triangle + triangle_count;
+	u32 index_count = 0;
+	for(u32 cluster_first_triangle = first_triangle; cluster_first_triangle < end_triangle; cluster_first_triangle += MESH_CLUSTER_TRIANGLE_COUNT) {
+		const MeshCluster *p_cluster = p_pipeline->cc.p_clusters + cluster_first_triangle / MESH_CLUSTER_TRIANGLE_COUNT;
+		if(!is_cluster_visible(p_pipeline, p_cluster, eye.xyz)) continue;
+		u32 cluster_index_count = MIN(MESH_CLUSTER_TRIANGLE_COUNT, end_triangle - cluster_first_triangle) * 3;
+		memcpy((u8*)p_culled_indices + index_count * index_size, (const u8*)p_ia->p_index_buffer + cluster_first_triangle * 3 * index_size,
+			cluster_index_count * index_size);
+		index_count += cluster_index_count;
+	}
+	InterlockedAdd(p_culled_triangle_count, triangle_count - index_count / 3);
+	u32 padded_index_count = (index_count + 23) / 24 * 24;
+	memset((u8*)p_culled_indices + index_count * index_size, 0, (padded_index_count - index_count) * index_size);
+
+	rmt_EndCPUSample();
+	return padded_index_count;
+}
+
+// Assembles the vertices of index_count indices, which are in the bound index format, into p_vertex_input_data
+void input_assembler_stage(const Pipeline *p_pipeline, const void *p_indices, u32 index_count, void *p_vertex_input_data) {
+	rmt_BeginCPUSample(input_assambler_stage, RMTSF_Aggregate);
 
 	// Input Assembler
-	assert(graphics_pipeline.ia.primitive_topology == PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	assert(p_pipeline->ia.primitive_topology == PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	// ASSUMPTION(cerlet): In Direct3D, index buffers are bounds checked!, we assume our index buffers are properly bounded.
 	// ASSUMPTION(cerlet): index_count is divisible by 8
 	assert((index_count & 0b111) == 0); 
 	
 	// TODO(cerlet): Implement some kind of post-transform vertex cache.
-	u32 vertex_count = index_count;
-	u32 per_vertex_input_data_size = graphics_pipeline.ia.input_layout;
-	void *p_vertex_input_data = malloc(vertex_count*per_vertex_input_data_size);
-	f256 *p_vertex = p_vertex_input_data;
+	const IA *p_ia = &p_pipeline->ia;
+	const InputLayout *p_input_layout = p_ia->p_input_layout;
 	
-	#pragma omp parallel for schedule(dynamic, 128)
 	for(u32 index_index = 0; index_index < index_count; index_index += 8) {
-		f256 *p_vertex = ((f256*)p_vertex_input_data) + index_index;
-		i256 index = _mm256_set_epi32(index_index + 7, index_index + 6, index_index + 5, index_index + 4, index_index + 3, index_index + 2, index_index + 1, index_index);
-		i256 vertex_index = _mm256_i32gather_epi32((i32*)graphics_pipeline.ia.p_index_buffer, index, 4);
-		i256 vertex_offset = _mm256_mullo_epi32(vertex_index, _mm256_set1_epi32(per_vertex_input_data_size));
-		p_vertex[0] = _mm256_i32gather_ps(((f32*)graphics_pipeline.ia.p_vertex_buffer) + 0, vertex_offset, 1);
-		p_vertex[1] = _mm256_i32gather_ps(((f32*)graphics_pipeline.ia.p_vertex_buffer) + 1, vertex_offset, 1);
-		p_vertex[2] = _mm256_i32gather_ps(((f32*)graphics_pipeline.ia.p_vertex_buffer) + 2, vertex_offset, 1);
-		p_vertex[3] = _mm256_i32gather_ps(((f32*)graphics_pipeline.ia.p_vertex_buffer) + 3, vertex_offset, 1);
-		p_vertex[4] = _mm256_i32gather_ps(((f32*)graphics_pipeline.ia.p_vertex_buffer) + 4, vertex_offset, 1);
-		p_vertex[5] = _mm256_i32gather_ps(((f32*)graphics_pipeline.ia.p_vertex_buffer) + 5, vertex_offset, 1);
-		p_vertex[6] = _mm256_i32gather_ps(((f32*)graphics_pipeline.ia.p_vertex_buffer) + 6, vertex_offset, 1);
-		p_vertex[7] = _mm256_i32gather_ps(((f32*)graphics_pipeline.ia.p_vertex_buffer) + 7, vertex_offset, 1);
-	}
-	*pp_vertex_input_data = p_vertex_input_data;
+		f256 *p_vertex = ((f256*)p_vertex_input_data) + index_index / 8 * p_input_layout->component_count;
+		// the 8 indices are contiguous, index buffers are padded to a multiple of 8
+		i256 vertex_index;
+		if(p_ia->index_format == INDEX_FORMAT_R16_UINT) {
+			vertex_index = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)((const u16*)p_indices + index_index)));
+		}
+		else {
+			vertex_index = _mm256_loadu_si256((const i256*)((const u32*)p_indices + index_index));
+		}
+		for(u32 element_index = 0; element_index < p_input_layout->element_count; ++element_index) {
+			const InputElementDesc *p_element = p_input_layout->a_elements + element_index;
+			const u8 *p_vertex_buffer = (const u8*)p_ia->ap_vertex_buffers[p_element->input_slot] + p_element->aligned_byte_offset;
+			i256 vertex_offset = _mm256_mullo_epi32(vertex_index, _mm256_set1_epi32(p_ia->a_vertex_buffer_strides[p_element->input_slot]));
+			p_vertex = gather_input_element(p_element, p_vertex_buffer, vertex_offset, p_vertex);
+		}
+	}
 
 	rmt_EndCPUSample();
 }
 
-void vertex_shader_stage(u32 vertex_count, const void * p_vertex_input_data, u32 *p_per_vertex_output_data_size, void **pp_vertex_output_data) {
-	rmt_BeginCPUSample(vertex_shader_stage, 0);
-	
-	// Vertex Shader
-	u32 per_vertex_input_data_size = graphics_pipeline.ia.input_layout;
-	u32 per_vertex_output_data_size = graphics_pipeline.vs.output_register_count * sizeof(v4f32);
-	void **p_constant_buffers = graphics_pipeline.vs.p_constant_buffers;
-	void *p_vertex_output_data = malloc(vertex_count*per_vertex_output_data_size);
-	
-	#pragma omp parallel for schedule(dynamic, 128)
+// Shared by the generic and the specialized vertex shader stages. The specialized ones pass compile time constants, which
+// turns the shader call into a direct one and gives the transpose loop a known trip count.
+__forceinline void run_vertex_shader_stage(const Pipeline *p_pipeline, u32 vertex_count, const void *p_vertex_input_data, void *p_vertex_output_data,
+	u32 output_component_count, VertexShaderMain *vs_main) {
+	u32 per_vertex_input_data_size = p_pipeline->ia.p_input_layout->component_count * sizeof(f32);
+	u32 per_vertex_output_data_size = output_component_count * sizeof(f32);
+	const void **pp_constant_buffers = (const void**)p_pipeline->vs.p_constant_buffers;
+	const void **pp_shader_resource_views = (const void**)p_pipeline->vs.p_shader_resource_views;
+	const SamplerState **pp_samplers = (const SamplerState**)p_pipeline->vs.p_samplers;
+
 	for(u32 vertex_id = 0; vertex_id < vertex_count; vertex_id +=8 ) {
 		u8 *p_vertex_input = (u8*)p_vertex_input_data + vertex_id * per_vertex_input_data_size;
 		f32 *p_vertex_output = (f32*)((u8*)p_vertex_output_data + vertex_id * per_vertex_output_data_size);
-		f256 vertex_output[12];
-		graphics_pipeline.vs.shader(p_vertex_input, vertex_output, p_constant_buffers, graphics_pipeline.vs.p_shader_resource_views);
+		f256 vertex_output[PIXEL_SHADER_INPUT_COMPONENT_COUNT];
+		vs_main(p_vertex_input, vertex_output, pp_constant_buffers, pp_shader_resource_views, pp_samplers);
 
 		for(int i = 0; i < 8; i++) {
-			*(p_vertex_output++) = vertex_output[0].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[1].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[2].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[3].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[4].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[5].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[6].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[7].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[8].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[9].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[10].m256_f32[i];
-			*(p_vertex_output++) = vertex_output[11].m256_f32[i];
+			for(u32 component_index = 0; component_index < output_component_count; ++component_index) {
+				*(p_vertex_output++) = vertex_output[component_index].m256_f32[i];
+			}
 		}
 	}
+}
 
-	*p_per_vertex_output_data_size = per_vertex_output_data_size;
-	*pp_vertex_output_data = p_vertex_output_data;
+void vertex_shader_stage(const Pipeline *p_pipeline, u32 vertex_count, const void * p_vertex_input_data, void *p_vertex_output_data) {
+	rmt_BeginCPUSample(vertex_shader_stage, RMTSF_Aggregate);
+	
+	// Vertex Shader
+	if(p_pipeline->p_variant) {
+		p_pipeline->p_variant->vertex_shader_stage(p_pipeline, vertex_count, p_vertex_input_data, p_vertex_output_data);
+	}
+	else {
+		run_vertex_shader_stage(p_pipeline, vertex_count, p_vertex_input_data, p_vertex_output_data, p_pipeline->vs.output_component_count, p_pipeline->vs.shader);
+	}
 	
 	rmt_EndCPUSample();
 }
 
-void primitive_assembly_stage(u32 in_triangle_count, const void* p_vertex_output_data, u32 *p_out_triangle_count, Triangle **pp_triangles, v4f32 **pp_attributes) {
-	rmt_BeginCPUSample(primitive_assembly_stage, 0);
+// Output triangles are appended to p_triangles through the draw's shared p_out_triangle_count, the geometry jobs of a draw
+// run this concurrently. p_triangles and p_attribute_planes are sized by draw_indexed.
+void primitive_assembly_stage(const Pipeline *p_pipeline, u32 in_triangle_count, const void* p_vertex_output_data, volatile long *p_out_triangle_count,
+	Triangle *p_triangles, PlaneEquation *p_attribute_planes) {
+	rmt_BeginCPUSample(primitive_assembly_stage, RMTSF_Aggregate);
 	// Primitive Assembly
-	const u32 max_clipper_generated_triangle_count = max(in_triangle_count * 2, 512);
-	const u32 out_triangle_count = in_triangle_count + max_clipper_generated_triangle_count;
-	const u32 num_attributes = graphics_pipeline.vs.output_register_count;
-	const u32 per_vertex_offset = num_attributes * sizeof(v4f32);
+	const u32 num_attribute_components = p_pipeline->vs.output_component_count;
+	const u32 per_vertex_offset = num_attribute_components * sizeof(f32);
 	const u32 triangle_data_size = per_vertex_offset * 3;
-	
-	*pp_triangles = malloc(sizeof(Triangle) * out_triangle_count);
-	*pp_attributes = malloc(triangle_data_size * out_triangle_count);
-	
-	u32 shared_out_triangle_index = 0;
 
-	#pragma omp parallel for schedule(dynamic,128)
 	for(u32 in_triangle_index = 0; in_triangle_index < in_triangle_count; ++in_triangle_index) {
 
 		v4f32 a_vertex_positions[3];
@@ -782,22 +1903,20 @@ void primitive_assembly_stage(u32 in_triangle_count, const void* p_vertex_output
 
 		Vertex a_clipped_vertices[MAX_NUM_CLIP_VERTICES];
 		i32 clipped_vertex_count = 3;
-		u32 num_attributes = graphics_pipeline.vs.output_register_count;
-		u32 vertex_size = num_attributes * sizeof(v4f32);
 
 		// In order to have the same code path for non-clipped triangles and clipped triangles, initialize clipped vertices array with the original vertex data
-		memcpy(a_clipped_vertices, ((v4f32*)p_vertex_output_data) + in_triangle_index * num_attributes * 3, per_vertex_offset);
-		memcpy(a_clipped_vertices + 1, ((v4f32*)p_vertex_output_data) + in_triangle_index * num_attributes * 3 + num_attributes, per_vertex_offset);
-		memcpy(a_clipped_vertices + 2, ((v4f32*)p_vertex_output_data) + in_triangle_index * num_attributes * 3 + num_attributes * 2, per_vertex_offset);
+		memcpy(a_clipped_vertices, (u8*)p_vertex_output_data + in_triangle_index * triangle_data_size, per_vertex_offset);
+		memcpy(a_clipped_vertices + 1, (u8*)p_vertex_output_data + in_triangle_index * triangle_data_size + per_vertex_offset, per_vertex_offset);
+		memcpy(a_clipped_vertices + 2, (u8*)p_vertex_output_data + in_triangle_index * triangle_data_size + per_vertex_offset * 2, per_vertex_offset);
 
 		if(is_clipping_needed) {
-			clipper(&a_clipped_vertices, &clipped_vertex_count);
+			clipper(&a_clipped_vertices, &clipped_vertex_count, num_attribute_components);
 		}
 
 		for(i32 clipped_vertex_index = 1; clipped_vertex_index < clipped_vertex_count - 1; ++clipped_vertex_index) {
-			a_vertex_positions[0] = a_clipped_vertices[0].a_attributes[0];
-			a_vertex_positions[1] = a_clipped_vertices[clipped_vertex_index].a_attributes[0];
-			a_vertex_positions[2] = a_clipped_vertices[clipped_vertex_index + 1].a_attributes[0];
+			a_vertex_positions[0] = get_vertex_position(a_clipped_vertices);
+			a_vertex_positions[1] = get_vertex_position(a_clipped_vertices + clipped_vertex_index);
+			a_vertex_positions[2] = get_vertex_position(a_clipped_vertices + clipped_vertex_index + 1);
 
 			// projection : Clip Space --> NDC Space
 			f32 a_reciprocal_ws[3];
@@ -820,7 +1939,7 @@ void primitive_assembly_stage(u32 in_triangle_count, const void* p_vertex_output
 			a_vertex_positions[2].w *= a_reciprocal_ws[2];
 
 			// viewport transformation : NDC Space --> Screen Space
-			Viewport viewport = graphics_pipeline.rs.viewport;
+			Viewport viewport = p_pipeline->rs.viewport;
 			v4f32 vertex_pos_ss;
 			m4x4f32 screen_from_ndc = {
 				viewport.width*0.5, 0, 0, viewport.width*0.5 + viewport.top_left_x,
@@ -849,7 +1968,7 @@ void primitive_assembly_stage(u32 in_triangle_count, const void* p_vertex_output
 
 			// triangle setup
 			signed_area = ((x[1] - x[0]) * (y[2] - y[0])) - ((x[2] - x[0]) * (y[1] - y[0]));
-			//if(signed_area == 0) { signed_area=0.00001; } // degenerate triangle 
+			if(signed_area == 0) { continue; } // degenerate triangle, covers no pixels
 			
 			// BUG(cerlet): Backface culling creates cracks in the rasterization!
 			// face culling with winding order
@@ -860,29 +1979,32 @@ void primitive_assembly_stage(u32 in_triangle_count, const void* p_vertex_output
 			set_edge_function(&setup.a_edge_functions[0], signed_area, x[1], y[1], x[2], y[2]);
 			set_edge_function(&setup.a_edge_functions[1], signed_area, x[2], y[2], x[0], y[0]);
 
-			f32 signed_area_f32 = (f32)(signed_area >> (NUM_SUB_PIXEL_PRECISION_BITS * 2));
-			if(signed_area_f32 == 0.0) signed_area_f32 = 1.0;
+			setup.max_depth = MAX3(a_vertex_positions[0].z, a_vertex_positions[1].z, a_vertex_positions[2].z);
 
-			setup.one_over_area = fabs(1.f / signed_area_f32);
-			setup.a_reciprocal_ws[0] = a_reciprocal_ws[0];
-			setup.a_reciprocal_ws[1] = a_reciprocal_ws[1];
-			setup.a_reciprocal_ws[2] = a_reciprocal_ws[2];
+			u32 out_triangle_index = InterlockedIncrement(p_out_triangle_count) - 1;
 
-			setup.max_depth = MAX3(a_vertex_positions[0].z, a_vertex_positions[1].z, a_vertex_positions[2].z);
+			// attribute plane equations, evaluated at the same snapped positions the edge functions use
+			// SV_POSITION is interpolated linearly in screen space, the rest of the attributes as a/w for perspective correction
+			const f32 sub_pixel_scale = 1.f / (1 << NUM_SUB_PIXEL_PRECISION_BITS);
+			f32 a_xs[3] = { x[0] * sub_pixel_scale, x[1] * sub_pixel_scale, x[2] * sub_pixel_scale };
+			f32 a_ys[3] = { y[0] * sub_pixel_scale, y[1] * sub_pixel_scale, y[2] * sub_pixel_scale };
+			f32 one_over_determinant = 1.f / (signed_area * (sub_pixel_scale * sub_pixel_scale));
 
-			u32 out_triangle_index;
-			#pragma omp atomic capture
-			{ out_triangle_index = shared_out_triangle_index; shared_out_triangle_index += 1; }
+			set_plane_equation(&setup.reciprocal_w_plane, a_xs, a_ys, one_over_determinant, a_reciprocal_ws[0], a_reciprocal_ws[1], a_reciprocal_ws[2]);
 
-			memcpy((*pp_attributes) + out_triangle_index * num_attributes * 3, &a_clipped_vertices[0], per_vertex_offset);
-			memcpy((*pp_attributes) + out_triangle_index * num_attributes * 3 + num_attributes, &a_clipped_vertices[clipped_vertex_index], per_vertex_offset);
-			memcpy((*pp_attributes) + out_triangle_index * num_attributes * 3 + num_attributes * 2, &a_clipped_vertices[clipped_vertex_index + 1], per_vertex_offset);
-			
-			*((*pp_attributes) + out_triangle_index * num_attributes*3) = a_vertex_positions[0];
-			*((*pp_attributes) + out_triangle_index * num_attributes*3 + num_attributes) = a_vertex_positions[1];
-			*((*pp_attributes) + out_triangle_index * num_attributes*3 + num_attributes * 2) = a_vertex_positions[2];
+			PlaneEquation *p_planes = p_attribute_planes + out_triangle_index * num_attribute_components;
+			for(u32 component_index = 0; component_index < 4; ++component_index) {
+				set_plane_equation(p_planes + component_index, a_xs, a_ys, one_over_determinant,
+					a_vertex_positions[0].xyzw[component_index], a_vertex_positions[1].xyzw[component_index], a_vertex_positions[2].xyzw[component_index]);
+			}
+			for(u32 component_index = 4; component_index < num_attribute_components; ++component_index) {
+				set_plane_equation(p_planes + component_index, a_xs, a_ys, one_over_determinant,
+					a_clipped_vertices[0].a_components[component_index] * a_reciprocal_ws[0],
+					a_clipped_vertices[clipped_vertex_index].a_components[component_index] * a_reciprocal_ws[1],
+					a_clipped_vertices[clipped_vertex_index + 1].a_components[component_index] * a_reciprocal_ws[2]);
+			}
 
-			Triangle *p_current_triangle = (*pp_triangles) + out_triangle_index;
+			Triangle *p_current_triangle = p_triangles + out_triangle_index;
 			p_current_triangle->setup = setup;
 
 			v2i32 min_bounds;
@@ -903,16 +2025,14 @@ void primitive_assembly_stage(u32 in_triangle_count, const void* p_vertex_output
 			p_current_triangle->min_bounds = min_bounds;
 			p_current_triangle->max_bounds = max_bounds;
 
-			p_current_triangle->p_attributes = (*pp_attributes) + out_triangle_index * 3 * num_attributes;
+			p_current_triangle->p_attribute_planes = p_planes;
 		}	
 	}
 
-	*p_out_triangle_count = shared_out_triangle_index;
-
 	rmt_EndCPUSample();
 }
 
-void binner(u32 assembled_triangle_count, const Triangle *p_triangles, u32 **pp_triangle_ids, CompactedBin **pp_compacted_bins, u32 *p_num_compacted_bins, u32* p_total_triangle_count ) {
+void binner(Bin *a_bins, u32 assembled_triangle_count, const Triangle *p_triangles, u32 **pp_triangle_ids, CompactedBin **pp_compacted_bins, u32 *p_num_compacted_bins, u32* p_total_triangle_count ) {
 	rmt_BeginCPUSample(binner, 0);
 	u32 current_counts[NUM_BINS];
 	for(u32 bin_index = 0; bin_index < NUM_BINS; ++bin_index) {
@@ -980,19 +2100,21 @@ void binner(u32 assembled_triangle_count, const Triangle *p_triangles, u32 **pp_
 	rmt_EndCPUSample();
 }
 
-void rasterizer(u32 total_triangle_count_in_bins, u32 num_compacted_bins, const Triangle *p_triangles, const u32 *p_triangle_ids, const CompactedBin *p_compacted_bins, TileInfo **pp_tile_infos) {
-	rmt_BeginCPUSample(rasterizer_stage, 0);
-
-	*pp_tile_infos = malloc(total_triangle_count_in_bins * sizeof(TileInfo));
+// p_tile_infos is indexed like p_triangle_ids, so any range of the compacted bins can be rasterized on its own.
+// Returns the estimated shading cost of the bins: their triangle counts and covered pixels, see BIN_COST_PER_TRIANGLE.
+u32 rasterizer(u32 num_compacted_bins, const Triangle *p_triangles, const u32 *p_triangle_ids, const CompactedBin *p_compacted_bins, const TileMetadata *p_tile_metadata,
+	TileInfo *p_tile_infos) {
+	rmt_BeginCPUSample(rasterizer_stage, RMTSF_Aggregate);
 
-	#pragma omp parallel for schedule(dynamic, 128)
+	u32 cost = 0;
 	for(u32 bin_index = 0; bin_index < num_compacted_bins; ++bin_index) {
 		CompactedBin bin = p_compacted_bins[bin_index];
 		v2i32 min_bounds = { TILE_WIDTH * (bin.bin_index % WIDTH_IN_TILES), TILE_HEIGHT * (bin.bin_index / WIDTH_IN_TILES) };
 		v2i32 max_bounds = v2i32_add_v2i32(min_bounds, (v2i32) { TILE_WIDTH - 1, TILE_HEIGHT - 1 });
 		i256 x = _mm256_add_epi32(_mm256_set1_epi32(min_bounds.x), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
 		u32 num_triangles_of_current_bin = bin.num_triangles_self;
-		f32 min_tile_depth = get_tile_minimum_depth(bin.bin_index);
+		cost += num_triangles_of_current_bin * BIN_COST_PER_TRIANGLE;
+		f32 min_tile_depth = get_tile_minimum_depth(p_tile_metadata, bin.bin_index);
 		for(u32 triangle_index = 0; triangle_index < num_triangles_of_current_bin; ++triangle_index) {
 			u32 triangle_id = p_triangle_ids[bin.num_triangles_upto + triangle_index];
 			TileInfo tile_info;
@@ -1005,7 +2127,7 @@ void rasterizer(u32 total_triangle_count_in_bins, u32 num_compacted_bins, const
 			f32 max_tri_depth = tri.setup.max_depth;
 			if(max_tri_depth < min_tile_depth) {
 				tile_info.fragment_mask = fragment_mask;
-				(*pp_tile_infos)[bin.num_triangles_upto + triangle_index] = tile_info;
+				p_tile_infos[bin.num_triangles_upto + triangle_index] = tile_info;
 				continue;
 			}
 
@@ -1037,126 +2159,70 @@ void rasterizer(u32 total_triangle_count_in_bins, u32 num_compacted_bins, const
 				y = _mm256_add_epi32(y, _mm256_set1_epi32(1));
 			}
 			tile_info.fragment_mask = fragment_mask;
-			(*pp_tile_infos)[bin.num_triangles_upto + triangle_index] = tile_info;
+			p_tile_infos[bin.num_triangles_upto + triangle_index] = tile_info;
+			cost += (u32)_mm_popcnt_u64(fragment_mask);
 		}	
 	}
 	rmt_EndCPUSample();
+	return cost;
 }
 
-void pixel_shader_stage(const TileInfo* p_fragments, const Triangle *p_triangles, const CompactedBin *p_compacted_bins, u32 num_compacted_bins) {
-	rmt_BeginCPUSample(pixel_shader_stage, 0);
+// Shared by the generic and the specialized pixel shader stages, like run_vertex_shader_stage. Pixel shaders without a
+// tile entry point (tile_main is NULL) are run one row at a time.
+__forceinline void run_pixel_shader_stage(const Pipeline *p_pipeline, const TileInfo* p_fragments, const Triangle *p_triangles, const CompactedBin *p_compacted_bins,
+	u32 num_compacted_bins, u32 num_attribute_components, PixelShaderTileMain *tile_main, PixelShaderMain *ps_main) {
+	const void **pp_shader_resource_views = (const void**)p_pipeline->ps.p_shader_resource_views;
+	const SamplerState **pp_samplers = (const SamplerState**)p_pipeline->ps.p_samplers;
 
-	u8 num_attibutes = graphics_pipeline.vs.output_register_count;
-
-	#pragma omp parallel for schedule(dynamic,32)
 	for(u32 bin_index = 0; bin_index < num_compacted_bins; ++bin_index) {
 		
 		CompactedBin bin = p_compacted_bins[bin_index];
-		u32 a_tile_colors[64];
-		f32 a_tile_depths[64];
+		__declspec(align(32)) u32 a_tile_colors[TILE_TEXEL_COUNT];
+		__declspec(align(32)) f32 a_tile_depths[TILE_TEXEL_COUNT];
 		v2i32 min_bounds = { TILE_WIDTH * (bin.bin_index % WIDTH_IN_TILES), TILE_HEIGHT * (bin.bin_index / WIDTH_IN_TILES) };
-		read_tile(min_bounds, a_tile_colors, a_tile_depths);
+		read_tile(p_pipeline, bin.bin_index, a_tile_colors, a_tile_depths);
+		bool is_tile_touched = false;
+		// the tile's depth stays a single plane for as long as every triangle that writes to it covers all 64 fragments
+		bool is_depth_plane = (p_pipeline->om.p_tile_metadata->a_flags[bin.bin_index] & TILE_FLAG_DEPTH_PLANE) != 0;
+		PlaneEquation depth_plane = p_pipeline->om.p_tile_metadata->a_depth_planes[bin.bin_index];
 
 		for(u32 triangle_index = 0; triangle_index < bin.num_triangles_self; ++triangle_index) {
 			TileInfo tile_info = p_fragments[bin.num_triangles_upto + triangle_index];
 			if(tile_info.fragment_mask == 0) continue;
 			Triangle triangle = p_triangles[tile_info.triangle_id];
 
-			__m256i fragment_x_index = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+			f256 fragment_x = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(min_bounds.x), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0)));
+			f256 a_tile_attributes[TILE_HEIGHT][PIXEL_SHADER_INPUT_COMPONENT_COUNT];
+			PixelTile tile;
+			tile.p_row_inputs = a_tile_attributes;
+			tile.row_input_stride = sizeof(a_tile_attributes[0]);
+			tile.active_row_mask = 0;
+
 			for(u32 fragment_y_index = 0; fragment_y_index < 8; ++fragment_y_index) {
 						
 				//if(!((((u64)1) << fragment_index) & tile_info.fragment_mask)) continue;
 				u8 mask_8 = (tile_info.fragment_mask >> (8 * fragment_y_index)) & 0xFF;
+				tile.a_row_masks[fragment_y_index] = _mm256_setzero_si256();
 				if(mask_8 == 0) continue;
 				__m256i mask = _mm256_setr_epi32(
 					0xFFFFFFFF * (mask_8 & 1), 0xFFFFFFFF * ((mask_8 >> 1) & 1), 0xFFFFFFFF * ((mask_8 >> 2) & 1), 0xFFFFFFFF * ((mask_8 >> 3) & 1),
 					0xFFFFFFFF * ((mask_8 >> 4) & 1), 0xFFFFFFFF * ((mask_8 >> 5) & 1), 0xFFFFFFFF * ((mask_8 >> 6) & 1), 0xFFFFFFFF * ((mask_8 >> 7) & 1)
 				);
 
-				//i32 x = min_bounds.x + (fragment_index % 8);
-				__m256i x = _mm256_add_epi32(_mm256_set1_epi32(min_bounds.x), fragment_x_index);
-				//i32 y = min_bounds.y + (fragment_index / 8);
-				__m256i y = _mm256_add_epi32(_mm256_set1_epi32(min_bounds.y), _mm256_set1_epi32(fragment_y_index));
-
-				// ASSUMPTION(Cerlet): 32 bit precision is enough for the fixed point representations of barycentric coordinates
-				//i32 alpha = (triangle.setup.a_edge_functions[0].a * x + triangle.setup.a_edge_functions[0].b *y) * (1 << NUM_SUB_PIXEL_PRECISION_BITS) + triangle.setup.a_edge_functions[0].c;
-				__m256i alpha = _mm256_slli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(triangle.setup.a_edge_functions[0].a), x), NUM_SUB_PIXEL_PRECISION_BITS);
-				alpha = _mm256_add_epi32(alpha, _mm256_slli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(triangle.setup.a_edge_functions[0].b), y), NUM_SUB_PIXEL_PRECISION_BITS));
-				alpha = _mm256_add_epi32(alpha, _mm256_set1_epi32(triangle.setup.a_edge_functions[0].c));
-
-				//i32 beta = (triangle.setup.a_edge_functions[1].a * x + triangle.setup.a_edge_functions[1].b *y) * (1 << NUM_SUB_PIXEL_PRECISION_BITS) + triangle.setup.a_edge_functions[1].c;
-				//f32 barycentric_coords_x = (f32)(beta >> (NUM_SUB_PIXEL_PRECISION_BITS * 2));
-				__m256i beta = _mm256_slli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(triangle.setup.a_edge_functions[1].a), x), NUM_SUB_PIXEL_PRECISION_BITS);
-				beta = _mm256_add_epi32(beta, _mm256_slli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(triangle.setup.a_edge_functions[1].b), y), NUM_SUB_PIXEL_PRECISION_BITS));
-				beta = _mm256_add_epi32(beta, _mm256_set1_epi32(triangle.setup.a_edge_functions[1].c));
-				beta = _mm256_srai_epi32(beta, NUM_SUB_PIXEL_PRECISION_BITS * 2);
-				__m256 barycentric_coords_x = _mm256_mul_ps(_mm256_cvtepi32_ps(beta), _mm256_set1_ps(triangle.setup.one_over_area));
-			
-				//i32 gamma = (triangle.setup.a_edge_functions[2].a * x + triangle.setup.a_edge_functions[2].b *y) * (1 << NUM_SUB_PIXEL_PRECISION_BITS) + triangle.setup.a_edge_functions[2].c;
-				//f32 barycentric_coords_y = (float)(gamma >> (NUM_SUB_PIXEL_PRECISION_BITS * 2)) * triangle.setup.one_over_area;
-				__m256i gamma = _mm256_slli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(triangle.setup.a_edge_functions[2].a), x), NUM_SUB_PIXEL_PRECISION_BITS);
-				gamma = _mm256_add_epi32(gamma, _mm256_slli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(triangle.setup.a_edge_functions[2].b), y), NUM_SUB_PIXEL_PRECISION_BITS));
-				gamma = _mm256_add_epi32(gamma, _mm256_set1_epi32(triangle.setup.a_edge_functions[2].c));
-				//gamma = _mm256_srli_epi32(gamma, NUM_SUB_PIXEL_PRECISION_BITS * 2);
-				gamma = _mm256_srai_epi32(gamma, NUM_SUB_PIXEL_PRECISION_BITS * 2);
-				__m256 barycentric_coords_y = _mm256_mul_ps(_mm256_cvtepi32_ps(gamma), _mm256_set1_ps(triangle.setup.one_over_area));
-
-				// f32 denom = (1.0 - u_bary - v_bary) * p_setup->a_reciprocal_ws[0] + u_bary * p_setup->a_reciprocal_ws[1] + v_bary * p_setup->a_reciprocal_ws[2];
-				// denom = 1.0 / denom;
-				__m256 denom = _mm256_sub_ps(_mm256_set1_ps(1.0), _mm256_add_ps(barycentric_coords_x, barycentric_coords_y));
-				denom = _mm256_mul_ps(denom, _mm256_set1_ps(triangle.setup.a_reciprocal_ws[0]));
-				denom = _mm256_add_ps(denom, _mm256_mul_ps(barycentric_coords_x, _mm256_set1_ps(triangle.setup.a_reciprocal_ws[1])));
-				denom = _mm256_add_ps(denom, _mm256_mul_ps(barycentric_coords_y, _mm256_set1_ps(triangle.setup.a_reciprocal_ws[2])));
-				denom = _mm256_div_ps(_mm256_set1_ps(1.0), denom);
-				
-				// f32 perspective_barycentric_coords.x = barycentric_coords_x * p_setup->a_reciprocal_ws[1] * denom;
-				__m256 perspective_barycentric_coords_x = _mm256_mul_ps(_mm256_mul_ps(barycentric_coords_x, _mm256_set1_ps(triangle.setup.a_reciprocal_ws[1])), denom);
-				// f32 perspective_barycentric_coords.y = barycentric_coords_y * p_setup->a_reciprocal_ws[2] * denom;
-				__m256 perspective_barycentric_coords_y = _mm256_mul_ps(_mm256_mul_ps(barycentric_coords_y, _mm256_set1_ps(triangle.setup.a_reciprocal_ws[2])), denom);
-
-				__m256 a_fragment_attributes[12];
-				for(i32 attribute_index = 0; attribute_index < num_attibutes; ++attribute_index) {
-					if(attribute_index > 0) {
-						barycentric_coords_x = perspective_barycentric_coords_x;
-						barycentric_coords_y = perspective_barycentric_coords_y;
-					}
+				// attributes are evaluated from their setup-time plane equations: c + dx * x + dy * y
+				f32 fragment_y = (f32)(min_bounds.y + fragment_y_index);
+				PlaneEquation reciprocal_w_plane = triangle.setup.reciprocal_w_plane;
+				f256 reciprocal_w = _mm256_fmadd_ps(_mm256_set1_ps(reciprocal_w_plane.dx), fragment_x, _mm256_set1_ps(reciprocal_w_plane.c + reciprocal_w_plane.dy * fragment_y));
+				f256 w = f256_reciprocal(reciprocal_w);
 
-					v4f32 v0_attribute = triangle.p_attributes[attribute_index];
-					v4f32 v1_attribute = triangle.p_attributes[attribute_index + 3];
-					v4f32 v2_attribute = triangle.p_attributes[attribute_index + 6]; 
-
-					__m256 v0_attribute_x = _mm256_set1_ps(v0_attribute.x);
-					__m256 v1_attribute_x = _mm256_set1_ps(v1_attribute.x);
-					__m256 v2_attribute_x = _mm256_set1_ps(v2_attribute.x);
-					__m256 temp_x = _mm256_add_ps(v0_attribute_x, _mm256_mul_ps(_mm256_sub_ps(v1_attribute_x, v0_attribute_x), barycentric_coords_x));
-					temp_x = _mm256_add_ps(temp_x, _mm256_mul_ps(_mm256_sub_ps(v2_attribute_x, v0_attribute_x), barycentric_coords_y));
-					a_fragment_attributes[attribute_index * 4 + 0] = temp_x;
-
-					__m256 v0_attribute_y = _mm256_set1_ps(v0_attribute.y);
-					__m256 v1_attribute_y = _mm256_set1_ps(v1_attribute.y);
-					__m256 v2_attribute_y = _mm256_set1_ps(v2_attribute.y);
-					__m256 temp_y = _mm256_add_ps(v0_attribute_y, _mm256_mul_ps(_mm256_sub_ps(v1_attribute_y, v0_attribute_y), barycentric_coords_x));
-					temp_y = _mm256_add_ps(temp_y, _mm256_mul_ps(_mm256_sub_ps(v2_attribute_y, v0_attribute_y), barycentric_coords_y));
-					a_fragment_attributes[attribute_index * 4 + 1] = temp_y;
-
-					__m256 v0_attribute_z = _mm256_set1_ps(v0_attribute.z);
-					__m256 v1_attribute_z = _mm256_set1_ps(v1_attribute.z);
-					__m256 v2_attribute_z = _mm256_set1_ps(v2_attribute.z);
-					__m256 temp_z = _mm256_add_ps(v0_attribute_z, _mm256_mul_ps(_mm256_sub_ps(v1_attribute_z, v0_attribute_z), barycentric_coords_x));
-					temp_z = _mm256_add_ps(temp_z, _mm256_mul_ps(_mm256_sub_ps(v2_attribute_z, v0_attribute_z), barycentric_coords_y));
-					a_fragment_attributes[attribute_index * 4 + 2] = temp_z;
-
-					__m256 v0_attribute_w = _mm256_set1_ps(v0_attribute.w);
-					__m256 v1_attribute_w = _mm256_set1_ps(v1_attribute.w);
-					__m256 v2_attribute_w = _mm256_set1_ps(v2_attribute.w);
-					__m256 temp_w = _mm256_add_ps(v0_attribute_w, _mm256_mul_ps(_mm256_sub_ps(v1_attribute_w, v0_attribute_w), barycentric_coords_x));
-					temp_w = _mm256_add_ps(temp_w, _mm256_mul_ps(_mm256_sub_ps(v2_attribute_w, v0_attribute_w), barycentric_coords_y));
-					a_fragment_attributes[attribute_index * 4 + 3] = temp_w;
-
-					//a_fragment_attributes[attribute_index * 4 + 0] = temp_x;
-					//a_fragment_attributes[attribute_index * 4 + 1] = temp_y;
-					//a_fragment_attributes[attribute_index * 4 + 2] = temp_z;
-					//a_fragment_attributes[attribute_index * 4 + 3] = temp_w;
+				f256 *a_fragment_attributes = a_tile_attributes[fragment_y_index];
+				for(u32 component_index = 0; component_index < num_attribute_components; ++component_index) {
+					PlaneEquation plane = triangle.p_attribute_planes[component_index];
+					a_fragment_attributes[component_index] = _mm256_fmadd_ps(_mm256_set1_ps(plane.dx), fragment_x, _mm256_set1_ps(plane.c + plane.dy * fragment_y));
+				}
+				// SV_POSITION is screen space linear, the rest are a/w and need perspective correction
+				for(u32 component_index = 4; component_index < num_attribute_components; ++component_index) {
+					a_fragment_attributes[component_index] = _mm256_mul_ps(a_fragment_attributes[component_index], w);
 				}
 
 				// Early-Z Test
@@ -1167,142 +2233,806 @@ void pixel_shader_stage(const TileInfo* p_fragments, const Triangle *p_triangles
 				mask = _mm256_and_si256(_mm256_castps_si256(depth_test), mask);
 				if(_mm256_testz_si256(mask, mask) == 1) continue;
 
-				// Pixel Shader
-				__m256 fragment_out_color[4];
-				graphics_pipeline.ps.shader(a_fragment_attributes, (void*)&fragment_out_color, graphics_pipeline.ps.p_shader_resource_views, mask);
+				tile.a_row_masks[fragment_y_index] = mask;
+				tile.active_row_mask |= (1 << fragment_y_index);
+			}
+			if(tile.active_row_mask == 0) continue;
+			is_tile_touched = true;
+
+			// Pixel Shader
+			f256 a_tile_out_colors[TILE_HEIGHT][4];
+			if(tile_main) {
+				tile_main(&tile, a_tile_out_colors, pp_shader_resource_views, pp_samplers);
+			}
+			else {
+				for(u32 row_index = 0; row_index < PIXEL_TILE_ROW_COUNT; ++row_index) {
+					if(!(tile.active_row_mask & (1 << row_index))) continue;
+					ps_main(a_tile_attributes[row_index], a_tile_out_colors[row_index], pp_shader_resource_views, pp_samplers, tile.a_row_masks[row_index]);
+				}
+			}
+
+			// Output Merger
+			u32 num_fully_written_rows = 0;
+			for(u32 fragment_y_index = 0; fragment_y_index < 8; ++fragment_y_index) {
+				if(!(tile.active_row_mask & (1 << fragment_y_index))) continue;
+				__m256i mask = tile.a_row_masks[fragment_y_index];
+				num_fully_written_rows += (_mm256_movemask_ps(_mm256_castsi256_ps(mask)) == 0xFF);
+				f256 *fragment_out_color = a_tile_out_colors[fragment_y_index];
 
-				// Output Merger
 				// (((u32)(color.x*255.f)) << 16) + (((u32)(color.y*255.f)) << 8) + (((u32)(color.z*255.f)));
 				__m256i encoded_color = _mm256_slli_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(fragment_out_color[0], _mm256_set1_ps(255.0))), 16); // r
 				encoded_color = _mm256_add_epi32(encoded_color, _mm256_slli_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(fragment_out_color[1], _mm256_set1_ps(255.0))), 8)); // r+g
 				encoded_color = _mm256_add_epi32(encoded_color, _mm256_cvtps_epi32(_mm256_mul_ps(fragment_out_color[2], _mm256_set1_ps(255.0)))); // r+g+b
 
 				_mm256_maskstore_epi32(a_tile_colors + fragment_y_index * 8, mask, encoded_color);
-				_mm256_maskstore_ps(a_tile_depths + fragment_y_index * 8, mask, fragment_z);
+				_mm256_maskstore_ps(a_tile_depths + fragment_y_index * 8, mask, a_tile_attributes[fragment_y_index][2]);
+			}
+
+			is_depth_plane = (num_fully_written_rows == TILE_HEIGHT);
+			if(is_depth_plane) {
+				depth_plane = triangle.p_attribute_planes[2];
 			}
 		}
 
-		write_tile(bin.bin_index, a_tile_colors, a_tile_depths);
+		if(is_tile_touched) {
+			write_tile(p_pipeline, bin.bin_index, a_tile_colors, a_tile_depths, is_depth_plane ? &depth_plane : NULL);
+		}
 	}
+}
 
+void pixel_shader_stage(const Pipeline *p_pipeline, const TileInfo* p_fragments, const Triangle *p_triangles, const CompactedBin *p_compacted_bins, u32 num_compacted_bins) {
+	rmt_BeginCPUSample(pixel_shader_stage, RMTSF_Aggregate);
+	if(p_pipeline->p_variant) {
+		p_pipeline->p_variant->pixel_shader_stage(p_pipeline, p_fragments, p_triangles, p_compacted_bins, num_compacted_bins);
+	}
+	else {
+		run_pixel_shader_stage(p_pipeline, p_fragments, p_triangles, p_compacted_bins, num_compacted_bins,
+			p_pipeline->vs.output_component_count, p_pipeline->ps.tile_shader, p_pipeline->ps.shader);
+	}
 	rmt_EndCPUSample();
 }
 
-void clear_render_target_view(const f32 *p_clear_color) {
+//----------------------------------------  PIPELINE VARIANTS  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+// Every shader pair the scenes bind, as (vertex shader, pixel shader, pixel shader tile entry point or NULL, output
+// component count). Each gets its own vertex and pixel shader stages, with the shaders called directly and the attribute
+// loops unrollable, and whole program optimization can inline the shaders into them. Unlisted pairs run the generic stages.
+#define PIPELINE_VARIANT_LIST(X) \
+	X(basic_vs, basic_ps, basic_ps_tile_main, 9) \
+	X(basic_vs, env_lighting_ps, NULL, 9) \
+	X(fullscreen_vs, env_lighting_ps, NULL, 7) \
+	X(passthrough_vs, passthrough_ps, NULL, 7) \
+	X(vertex_lighting_vs, passthrough_ps, NULL, 7)
+
+#define DEFINE_PIPELINE_VARIANT_STAGES(vs, ps, ps_tile_main, component_count) \
+	void vertex_shader_stage_##vs##_##ps##_##component_count(const Pipeline *p_pipeline, u32 vertex_count, const void *p_vertex_input_data, void *p_vertex_output_data) { \
+		run_vertex_shader_stage(p_pipeline, vertex_count, p_vertex_input_data, p_vertex_output_data, component_count, vs##_main); \
+	} \
+	void pixel_shader_stage_##vs##_##ps##_##component_count(const Pipeline *p_pipeline, const TileInfo* p_fragments, const Triangle *p_triangles, \
+		const CompactedBin *p_compacted_bins, u32 num_compacted_bins) { \
+		run_pixel_shader_stage(p_pipeline, p_fragments, p_triangles, p_compacted_bins, num_compacted_bins, component_count, ps_tile_main, ps##_main); \
+	}
+
+PIPELINE_VARIANT_LIST(DEFINE_PIPELINE_VARIANT_STAGES)
+
+#define PIPELINE_VARIANT_ENTRY(vs, ps, ps_tile_main, component_count) \
+	{ vs##_main, ps##_main, component_count, vertex_shader_stage_##vs##_##ps##_##component_count, pixel_shader_stage_##vs##_##ps##_##component_count },
+
+const PipelineVariant a_pipeline_variants[] = {
+	PIPELINE_VARIANT_LIST(PIPELINE_VARIANT_ENTRY)
+};
+
+const PipelineVariant* find_pipeline_variant(VertexShaderMain *vs_main, PixelShaderMain *ps_main, u32 output_component_count) {
+	for(u32 variant_index = 0; variant_index < ARRAYSIZE(a_pipeline_variants); ++variant_index) {
+		const PipelineVariant *p_variant = a_pipeline_variants + variant_index;
+		if(p_variant->vs_main == vs_main && p_variant->ps_main == ps_main && p_variant->output_component_count == output_component_count) {
+			return p_variant;
+		}
+	}
+	return NULL;
+}
+
+// Clears are not jobs, the immediate context runs them before it submits the draws of the frame
+void clear_render_target_view(TileMetadata *p_tile_metadata, const f32 *p_clear_color) {
 	rmt_BeginCPUSample(clear_render_target_view, 0);
 	v4f32 clear_color = { p_clear_color[0],p_clear_color[1] ,p_clear_color[2], p_clear_color[3]};
-	u32 encoded_clear = encode_color_as_u32(clear_color);
-	
-	u32 frame_buffer_texel_count = sizeof(frame_buffer) / sizeof(u32);
-	u32 *p_texel = frame_buffer;
-	while(frame_buffer_texel_count--) {
-		*p_texel++ = encoded_clear;
+	p_tile_metadata->color_clear_value = encode_color_as_u32(clear_color);
+
+	for(i32 i = 0; i < NUM_BINS; ++i) {
+		p_tile_metadata->a_flags[i] |= TILE_FLAG_COLOR_CLEARED;
 	}
 	rmt_EndCPUSample();
 }
 
-void clear_depth_stencil_view(const f32 depth) {
+void clear_depth_stencil_view(TileMetadata *p_tile_metadata, const f32 depth) {
 	rmt_BeginCPUSample(clear_depth_stencil_view, 0);
-	f32 *p_depth = depth_buffer;
-	u32 depth_buffer_texel_count = sizeof(depth_buffer) / sizeof(f32);
-	while(depth_buffer_texel_count--) {
-		*p_depth++ = depth;
-	}
+	PlaneEquation clear_plane = { depth, 0.f, 0.f };
 
 	for(i32 i = 0; i < NUM_BINS; ++i) {
-		a_tile_min_depths[i] = 0.0;
+		p_tile_metadata->a_flags[i] |= TILE_FLAG_DEPTH_PLANE;
+		p_tile_metadata->a_depth_planes[i] = clear_plane;
+		p_tile_metadata->a_min_depths[i] = depth;
 	}
 
 	rmt_EndCPUSample();
 }
 
-void draw_indexed(UINT index_count /* TODO(cerlet): Use UINT start_index_location, int base_vertex_location*/) {
-	rmt_BeginCPUSample(draw_indexed, 0);
+//----------------------------------------  DRAW JOBS  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+// A draw call is a small job graph: geometry jobs --> binner job --> one raster job per band with triangles --> finish job.
+// The binner jobs of a frame are chained in draw order and so are its raster jobs of a band, everything else of consecutive
+// draws overlaps, e.g. the geometry of a draw runs while the previous one is still shading. Frames render to swap chain
+// buffers of their own and share neither chain, the next frame's geometry starts while this one is still shading.
+
+void geometry_job(void *p_data, u32 job_index) {
+	DrawContext *p_draw = p_data;
+	const Pipeline *p_pipeline = p_draw->p_pipeline;
+	u32 first_triangle = job_index * GEOMETRY_JOB_TRIANGLE_COUNT;
+	u32 triangle_count = MIN(GEOMETRY_JOB_TRIANGLE_COUNT, p_draw->triangle_count - first_triangle);
+	u32 index_size = (p_pipeline->ia.index_format == INDEX_FORMAT_R16_UINT) ? sizeof(u16) : sizeof(u32);
+	const void *p_indices = (const u8*)p_pipeline->ia.p_index_buffer + first_triangle * 3 * index_size;
+	void *p_culled_indices = NULL;
+	if(p_pipeline->cc.p_clusters) {
+		// room for the padding to the next 8 triangles
+		p_culled_indices = malloc((triangle_count + 8) * 3 * index_size);
+		triangle_count = cluster_culling_stage(p_pipeline, first_triangle, triangle_count, p_culled_indices, &p_draw->cluster_culled_triangle_count) / 3;
+		p_indices = p_culled_indices;
+	}
+	u32 vertex_count = triangle_count * 3;
+
+	// vertices only live as long as the job that assembles them, so they are still in its cache when PA reads them
+	if(vertex_count) {
+		void *p_vertex_input_data = malloc(vertex_count * p_pipeline->ia.p_input_layout->component_count * sizeof(f32));
+		void *p_vertex_output_data = malloc(vertex_count * p_pipeline->vs.output_component_count * sizeof(f32));
+		input_assembler_stage(p_pipeline, p_indices, vertex_count, p_vertex_input_data);
+		vertex_shader_stage(p_pipeline, vertex_count, p_vertex_input_data, p_vertex_output_data);
+		primitive_assembly_stage(p_pipeline, triangle_count, p_vertex_output_data, &p_draw->assembled_triangle_count, p_draw->p_triangles, p_draw->p_attribute_planes);
+		free(p_vertex_input_data);
+		free(p_vertex_output_data);
+	}
+	free(p_culled_indices);
+}
 
-	void *p_vertex_input_data = NULL;
-	input_assembler_stage(index_count, &p_vertex_input_data);
+// Gives each worker a contiguous run of bands, so neighbouring workers, which are pinned to the same socket, own
+// neighbouring screen regions
+u32 get_band_owner(u32 band_index) {
+	return band_index * job_system_get_worker_count() / RASTER_BAND_COUNT;
+}
 
-	u32 per_vertex_output_data_size = 0;
-	void *p_vertex_output_data = NULL;
-	vertex_shader_stage(index_count, p_vertex_input_data, &per_vertex_output_data_size, &p_vertex_output_data);
-	stats.vertex_count += index_count;
+void raster_job(void *p_data, u32 band_index) {
+	DrawContext *p_draw = p_data;
+	u32 first_compacted_bin = p_draw->a_band_first_compacted_bins[band_index];
+	u32 num_compacted_bins = p_draw->a_band_first_compacted_bins[band_index + 1] - first_compacted_bin;
+	const CompactedBin *p_compacted_bins = p_draw->p_compacted_bins + first_compacted_bin;
+
+	u32 cost = rasterizer(num_compacted_bins, p_draw->p_triangles, p_draw->p_triangle_ids, p_compacted_bins, p_draw->p_pipeline->om.p_tile_metadata, p_draw->p_tile_infos);
+	if(p_draw->draw_index < BAND_COST_HISTORY_DRAW_COUNT) {
+		p_draw->p_buffer->a_band_costs[p_draw->draw_index][band_index] = cost;
+	}
+	pixel_shader_stage(p_draw->p_pipeline, p_draw->p_tile_infos, p_draw->p_triangles, p_compacted_bins, num_compacted_bins);
+}
+
+void binner_job(void *p_data, u32 job_index) {
+	DrawContext *p_draw = p_data;
+	SwapChainBuffer *p_buffer = p_draw->p_buffer;
+	u32 assembled_triangle_count = p_draw->assembled_triangle_count;
+	p_buffer->stats.assembled_triangle_count += assembled_triangle_count;
+	p_buffer->stats.cluster_culled_triangle_count += p_draw->cluster_culled_triangle_count;
+
+	u32 total_triangle_count_in_bins = 0;
+	u32 num_compacted_bins = 0;
+	binner(p_buffer->a_bins, assembled_triangle_count, p_draw->p_triangles, &p_draw->p_triangle_ids, &p_draw->p_compacted_bins, &num_compacted_bins, &total_triangle_count_in_bins);
+	p_buffer->stats.active_bin_count += num_compacted_bins;
+	p_buffer->stats.total_triangle_count_in_bins += total_triangle_count_in_bins;
+	p_draw->p_tile_infos = malloc(total_triangle_count_in_bins * sizeof(TileInfo));
+
+	// compacted bins are sorted by bin index, so the bins of a band are contiguous
+	u32 compacted_bin_index = 0;
+	for(u32 band_index = 0; band_index < RASTER_BAND_COUNT; ++band_index) {
+		p_draw->a_band_first_compacted_bins[band_index] = compacted_bin_index;
+		u32 band_end_bin_index = (band_index + 1) * RASTER_JOB_TILE_ROW_COUNT * WIDTH_IN_TILES;
+		while(compacted_bin_index < num_compacted_bins && p_draw->p_compacted_bins[compacted_bin_index].bin_index < band_end_bin_index) {
+			compacted_bin_index++;
+		}
+	}
+	p_draw->a_band_first_compacted_bins[RASTER_BAND_COUNT] = compacted_bin_index;
+
+	// The most expensive bands start first, so a band full of foliage doesn't start last and keep the frame going while
+	// the other workers are idle. The submitting worker pops the job it submitted last and thieves take the ones it
+	// submitted first. So the most expensive band is submitted last, after the others in descending cost order.
+	// The bands cost what they cost in the same draw of the last presented frame, if that draw read the same index buffer,
+	// which changes with the scene and the LOD, and had a cost for every band that is active now. Otherwise they are all
+	// estimated from their triangle counts, measured costs also count the covered pixels and don't compare to those.
+	bool has_cost_history = (p_draw->draw_index < BAND_COST_HISTORY_DRAW_COUNT) &&
+		(swap_chain.ap_band_cost_estimate_index_buffers[p_draw->draw_index] == p_draw->p_pipeline->ia.p_index_buffer);
+	for(u32 band_index = 0; has_cost_history && band_index < RASTER_BAND_COUNT; ++band_index) {
+		bool is_active = p_draw->a_band_first_compacted_bins[band_index] != p_draw->a_band_first_compacted_bins[band_index + 1];
+		has_cost_history = !is_active || swap_chain.a_band_cost_estimates[p_draw->draw_index][band_index];
+	}
+	u32 a_band_costs[RASTER_BAND_COUNT];
+	u32 a_sorted_band_indices[RASTER_BAND_COUNT];
+	u32 active_band_count = 0;
+	for(u32 band_index = 0; band_index < RASTER_BAND_COUNT; ++band_index) {
+		u32 first_compacted_bin = p_draw->a_band_first_compacted_bins[band_index];
+		u32 end_compacted_bin = p_draw->a_band_first_compacted_bins[band_index + 1];
+		if(first_compacted_bin == end_compacted_bin) continue;
+		u32 cost;
+		if(has_cost_history) {
+			cost = swap_chain.a_band_cost_estimates[p_draw->draw_index][band_index];
+		}
+		else {
+			const CompactedBin *p_last_bin = p_draw->p_compacted_bins + end_compacted_bin - 1;
+			u32 triangle_count = p_last_bin->num_triangles_upto + p_last_bin->num_triangles_self - p_draw->p_compacted_bins[first_compacted_bin].num_triangles_upto;
+			cost = triangle_count * BIN_COST_PER_TRIANGLE;
+		}
+		a_band_costs[band_index] = cost;
+
+		u32 sorted_index = active_band_count++;
+		for(; sorted_index > 0 && a_band_costs[a_sorted_band_indices[sorted_index - 1]] < cost; --sorted_index) {
+			a_sorted_band_indices[sorted_index] = a_sorted_band_indices[sorted_index - 1];
+		}
+		a_sorted_band_indices[sorted_index] = band_index;
+	}
+
+	for(u32 sorted_index = 1; sorted_index <= active_band_count; ++sorted_index) {
+		u32 band_index = a_sorted_band_indices[sorted_index % active_band_count];
+		Job *p_raster_job = job_create(&p_buffer->job_pool, raster_job, p_draw, band_index);
+		if(is_tile_ownership_enabled) {
+			// other workers only help out when the owner falls behind
+			job_set_worker_affinity(p_raster_job, get_band_owner(band_index), true);
+		}
+		if(p_buffer->a_last_raster_jobs[band_index]) {
+			job_add_dependency(p_raster_job, p_buffer->a_last_raster_jobs[band_index]);
+		}
+		p_buffer->a_last_raster_jobs[band_index] = p_raster_job;
+		job_add_dependency(p_draw->p_finish_job, p_raster_job);
+		job_submit(p_raster_job);
+	}
+}
+
+void finish_draw_job(void *p_data, u32 job_index) {
+	DrawContext *p_draw = p_data;
+	free(p_draw->p_attribute_planes);
+	free(p_draw->p_triangles);
+	free(p_draw->p_triangle_ids);
+	free(p_draw->p_tile_infos);
+	free(p_draw->p_compacted_bins);
+	free(p_draw);
+}
+
+// Only the immediate context submits draws, so the chains and the stats of the buffer need no locks
+void submit_draw_indexed(SwapChainBuffer *p_buffer, const Pipeline *p_pipeline, u32 index_count) {
+	rmt_BeginCPUSample(submit_draw_indexed, RMTSF_Aggregate);
 
 	assert((index_count % 3) == 0);
 	u32 triangle_count = index_count / 3;
-	stats.input_triangle_count += triangle_count;
+	p_buffer->stats.vertex_count += index_count;
+	p_buffer->stats.input_triangle_count += triangle_count;
+
+	DrawContext *p_draw = malloc(sizeof(DrawContext));
+	memset(p_draw, 0, sizeof(DrawContext));
+	p_draw->p_pipeline = p_pipeline;
+	p_draw->p_buffer = p_buffer;
+	p_draw->draw_index = p_buffer->draw_count++;
+	if(p_draw->draw_index < BAND_COST_HISTORY_DRAW_COUNT) {
+		p_buffer->ap_band_cost_index_buffers[p_draw->draw_index] = p_pipeline->ia.p_index_buffer;
+	}
+	p_draw->triangle_count = triangle_count;
+	const u32 max_clipper_generated_triangle_count = max(triangle_count * 2, 512);
+	const u32 max_assembled_triangle_count = triangle_count + max_clipper_generated_triangle_count;
+	p_draw->p_triangles = malloc(sizeof(Triangle) * max_assembled_triangle_count);
+	p_draw->p_attribute_planes = malloc(sizeof(PlaneEquation) * p_pipeline->vs.output_component_count * max_assembled_triangle_count);
+
+	Job *p_binner_job = job_create(&p_buffer->job_pool, binner_job, p_draw, 0);
+	p_draw->p_finish_job = job_create(&p_buffer->job_pool, finish_draw_job, p_draw, 0);
+	job_add_dependency(p_draw->p_finish_job, p_binner_job);
+	if(p_buffer->p_last_binner_job) {
+		job_add_dependency(p_binner_job, p_buffer->p_last_binner_job);
+	}
+	p_buffer->p_last_binner_job = p_binner_job;
 
-	Triangle *p_triangles = NULL;
-	v4f32 *p_attributes = NULL;
-	u32 assembled_triangle_count = 0;
-	primitive_assembly_stage(triangle_count, p_vertex_output_data, &assembled_triangle_count, &p_triangles, &p_attributes);
-	stats.assembled_triangle_count += assembled_triangle_count;
+	u32 geometry_job_count = (triangle_count + GEOMETRY_JOB_TRIANGLE_COUNT - 1) / GEOMETRY_JOB_TRIANGLE_COUNT;
+	for(u32 geometry_job_index = 0; geometry_job_index < geometry_job_count; ++geometry_job_index) {
+		Job *p_geometry_job = job_create(&p_buffer->job_pool, geometry_job, p_draw, geometry_job_index);
+		job_add_dependency(p_binner_job, p_geometry_job);
+		job_submit(p_geometry_job);
+	}
+	// the binner adds the raster jobs to the finish job before it finishes itself
+	job_submit(p_draw->p_finish_job);
+	job_submit(p_binner_job);
 
-	u32 *p_triangle_ids = NULL;
-	CompactedBin *p_compacted_bins = NULL;
-	u32 total_triangle_count_in_bins = 0;
-	u32  num_compacted_bins = 0;
-	binner(assembled_triangle_count, p_triangles, &p_triangle_ids, &p_compacted_bins, &num_compacted_bins, &total_triangle_count_in_bins);
-	stats.active_bin_count += num_compacted_bins;
-	stats.total_triangle_count_in_bins += total_triangle_count_in_bins;
+	rmt_EndCPUSample();
+}
 
-	TileInfo *p_tile_infos = NULL;
-	rasterizer(total_triangle_count_in_bins, num_compacted_bins, p_triangles, p_triangle_ids, p_compacted_bins, &p_tile_infos);
-	
-	pixel_shader_stage(p_tile_infos, p_triangles, p_compacted_bins, num_compacted_bins);
-
-	free(p_vertex_input_data);
-	free(p_vertex_output_data);
-	free(p_attributes);
-	free(p_triangles);
-	free(p_triangle_ids);
-	free(p_tile_infos);
-	free(p_compacted_bins);
+//----------------------------------------  COMMAND LISTS  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+// Starts recording with the default state and an empty command list, the list keeps its memory from earlier frames
+void deferred_context_begin(DeferredContext *p_context) {
+	memset(&p_context->pipeline, 0, sizeof(Pipeline));
+	p_context->command_list.command_count = 0;
+	p_context->command_list.pipeline_count = 0;
+}
+
+static Command* command_list_append(CommandList *p_command_list, CommandType type) {
+	if(p_command_list->command_count == p_command_list->command_capacity) {
+		p_command_list->command_capacity = MAX(p_command_list->command_capacity * 2, 64);
+		p_command_list->p_commands = realloc(p_command_list->p_commands, p_command_list->command_capacity * sizeof(Command));
+	}
+	Command *p_command = p_command_list->p_commands + p_command_list->command_count++;
+	p_command->type = type;
+	return p_command;
+}
+
+void deferred_context_clear_render_target_view(DeferredContext *p_context, TileMetadata *p_tile_metadata, const f32 *p_clear_color) {
+	Command *p_command = command_list_append(&p_context->command_list, COMMAND_TYPE_CLEAR_RENDER_TARGET_VIEW);
+	p_command->clear.p_tile_metadata = p_tile_metadata;
+	memcpy(p_command->clear.a_values, p_clear_color, sizeof(p_command->clear.a_values));
+}
+
+void deferred_context_clear_depth_stencil_view(DeferredContext *p_context, TileMetadata *p_tile_metadata, const f32 depth) {
+	Command *p_command = command_list_append(&p_context->command_list, COMMAND_TYPE_CLEAR_DEPTH_STENCIL_VIEW);
+	p_command->clear.p_tile_metadata = p_tile_metadata;
+	p_command->clear.a_values[0] = depth;
+}
+
+void deferred_context_draw_indexed(DeferredContext *p_context, UINT index_count /* TODO(cerlet): Use UINT start_index_location, int base_vertex_location*/) {
+	CommandList *p_command_list = &p_context->command_list;
+	// both are copied bytewise from a zeroed state, so the padding compares equal too
+	bool is_state_changed = (p_command_list->pipeline_count == 0) ||
+		memcmp(&p_context->pipeline, p_command_list->p_pipelines + p_command_list->pipeline_count - 1, sizeof(Pipeline));
+	if(is_state_changed) {
+		if(p_command_list->pipeline_count == p_command_list->pipeline_capacity) {
+			p_command_list->pipeline_capacity = MAX(p_command_list->pipeline_capacity * 2, 16);
+			p_command_list->p_pipelines = realloc(p_command_list->p_pipelines, p_command_list->pipeline_capacity * sizeof(Pipeline));
+		}
+		memcpy(p_command_list->p_pipelines + p_command_list->pipeline_count++, &p_context->pipeline, sizeof(Pipeline));
+	}
+	Command *p_command = command_list_append(p_command_list, COMMAND_TYPE_DRAW_INDEXED);
+	p_command->draw_indexed.pipeline_index = p_command_list->pipeline_count - 1;
+	p_command->draw_indexed.index_count = index_count;
+}
+
+// The immediate context. The command list must not be recorded into again until the buffer's frame has finished.
+void execute_command_list(SwapChainBuffer *p_buffer, const CommandList *p_command_list) {
+	rmt_BeginCPUSample(execute_command_list, 0);
+	for(u32 command_index = 0; command_index < p_command_list->command_count; ++command_index) {
+		const Command *p_command = p_command_list->p_commands + command_index;
+		switch(p_command->type) {
+			case COMMAND_TYPE_CLEAR_RENDER_TARGET_VIEW:
+				assert(p_buffer->draw_count == 0);
+				clear_render_target_view(p_command->clear.p_tile_metadata, p_command->clear.a_values);
+				break;
+			case COMMAND_TYPE_CLEAR_DEPTH_STENCIL_VIEW:
+				assert(p_buffer->draw_count == 0);
+				clear_depth_stencil_view(p_command->clear.p_tile_metadata, p_command->clear.a_values[0]);
+				break;
+			case COMMAND_TYPE_DRAW_INDEXED:
+				submit_draw_indexed(p_buffer, p_command_list->p_pipelines + p_command->draw_indexed.pipeline_index, p_command->draw_indexed.index_count);
+				break;
+		}
+	}
 	rmt_EndCPUSample();
 }
 
+//----------------------------------------  BENCHMARK  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+// Set associative LRU cache model, sized like a typical 32 KiB 8-way L1D
+#define CACHE_MODEL_LINE_SIZE 64
+#define CACHE_MODEL_SET_COUNT 64
+#define CACHE_MODEL_WAY_COUNT 8
+
+typedef struct CacheModel {
+	u64 a_tags[CACHE_MODEL_SET_COUNT][CACHE_MODEL_WAY_COUNT];
+	u64 a_last_uses[CACHE_MODEL_SET_COUNT][CACHE_MODEL_WAY_COUNT];
+	u64 clock;
+	u64 access_count;
+	u64 miss_count;
+} CacheModel;
+
+void cache_model_access(CacheModel *p_cache, u64 address) {
+	u64 line = address / CACHE_MODEL_LINE_SIZE;
+	u32 set_index = line % CACHE_MODEL_SET_COUNT;
+	u64 tag = line + 1; // 0 marks an empty way
+	u32 victim_way = 0;
+	p_cache->clock++;
+	p_cache->access_count++;
+	for(u32 way = 0; way < CACHE_MODEL_WAY_COUNT; ++way) {
+		if(p_cache->a_tags[set_index][way] == tag) {
+			p_cache->a_last_uses[set_index][way] = p_cache->clock;
+			return;
+		}
+		if(p_cache->a_last_uses[set_index][way] < p_cache->a_last_uses[set_index][victim_way]) victim_way = way;
+	}
+	p_cache->miss_count++;
+	p_cache->a_tags[set_index][victim_way] = tag;
+	p_cache->a_last_uses[set_index][victim_way] = p_cache->clock;
+}
+
+#define BENCHMARK_SCREEN_SIZE 512
+
+// Walks a screen of 8x8 tiles like the pixel stage does and maps every row of 8 pixels onto the texture with a rotation,
+// then reports the cache lines touched by the 2x2 bilinear footprints of the 8 lanes and the time spent in bilinear sampling
+void benchmark_texture_layout(const char *p_texture_name, Texture2D tex, f32 angle_deg) {
+	static CacheModel cache;
+	memset(&cache, 0, sizeof(cache));
+	u64 distinct_line_count = 0;
+	u64 sample_count = 0;
+	f32 cos_angle = cos(TO_RADIANS(angle_deg));
+	f32 sin_angle = sin(TO_RADIANS(angle_deg));
+
+	for(u32 tile_y = 0; tile_y < BENCHMARK_SCREEN_SIZE; tile_y += TILE_HEIGHT) {
+		for(u32 tile_x = 0; tile_x < BENCHMARK_SCREEN_SIZE; tile_x += TILE_WIDTH) {
+			for(u32 y = tile_y; y < tile_y + TILE_HEIGHT; ++y) {
+				u64 a_lines[VECTOR_WIDTH * 4];
+				u32 line_count = 0;
+				for(u32 x = tile_x; x < tile_x + TILE_WIDTH; ++x) {
+					f32 s_f32 = cos_angle * x - sin_angle * y + tex.width * 0.5f - 0.5f;
+					f32 t_f32 = sin_angle * x + cos_angle * y + tex.height * 0.25f - 0.5f;
+					i32 a_s[2] = { (i32)floor(s_f32), (i32)floor(s_f32) + 1 };
+					i32 a_t[2] = { (i32)floor(t_f32), (i32)floor(t_f32) + 1 };
+					for(u32 tap = 0; tap < 4; ++tap) {
+						i32 s = MAX(MIN(a_s[tap & 1], (i32)tex.width - 1), 0);
+						i32 t = MAX(MIN(a_t[tap >> 1], (i32)tex.height - 1), 0);
+						u64 address = (u64)get_texel_index(tex, s, t) * sizeof(u32);
+						cache_model_access(&cache, address);
+
+						u64 line = address / CACHE_MODEL_LINE_SIZE;
+						bool is_new_line = true;
+						for(u32 i = 0; i < line_count; ++i) { if(a_lines[i] == line) { is_new_line = false; break; } }
+						if(is_new_line) a_lines[line_count++] = line;
+					}
+				}
+				distinct_line_count += line_count;
+				sample_count++;
+			}
+		}
+	}
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+	f256 sink = _mm256_setzero_ps();
+	for(u32 y = 0; y < BENCHMARK_SCREEN_SIZE; ++y) {
+		for(u32 x = 0; x < BENCHMARK_SCREEN_SIZE; x += VECTOR_WIDTH) {
+			f256 x_f = _mm256_add_ps(_mm256_set1_ps((f32)x), _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0));
+			f256 y_f = _mm256_set1_ps((f32)y);
+			f256 s_f32 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(cos_angle), x_f), _mm256_mul_ps(_mm256_set1_ps(sin_angle), y_f)), _mm256_set1_ps(tex.width * 0.5f));
+			f256 t_f32 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(sin_angle), x_f), _mm256_mul_ps(_mm256_set1_ps(cos_angle), y_f)), _mm256_set1_ps(tex.height * 0.25f));
+			f256 u = _mm256_mul_ps(s_f32, _mm256_set1_ps(1.f / tex.width));
+			f256 v = _mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_mul_ps(t_f32, _mm256_set1_ps(1.f / tex.height)));
+			sink = _mm256_add_ps(sink, linear_clamp_sampler.sample_unorm8_x8(tex, &linear_clamp_sampler, u, v, _mm256_set1_epi32(-1)).x);
+		}
+	}
+	QueryPerformanceCounter(&end);
+	f64 elapsed_ms = (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
+
+	log_message("%-24s %-10s %6.1f deg | lines per x8 bilinear: %6.3f | L1 model misses per x8 bilinear: %6.3f | bilinear: %8.3f ms (%f)\n",
+		p_texture_name, (tex.layout == TEXTURE_LAYOUT_TILED_4X4) ? "tiled 4x4" : "linear", angle_deg,
+		(f64)distinct_line_count / sample_count, (f64)cache.miss_count / sample_count, elapsed_ms, _mm256_cvtss_f32(sink));
+}
+
+void benchmark_texture_layouts() {
+	const f32 a_angles_deg[] = { 0.f, 30.f, 45.f, 90.f };
+	Scene *p_scene = a_scenes + SceneType_FTM;
+	log_message("---- texture layouts (%d x %d screen, 1 texel per pixel) ----\n", BENCHMARK_SCREEN_SIZE, BENCHMARK_SCREEN_SIZE);
+	for(u32 object_index = 0; object_index < p_scene->num_objects; ++object_index) {
+		if(p_scene->a_textures[object_index].format != TEXTURE_FORMAT_R8G8B8A8_UNORM) continue;
+		char texture_name[32];
+		sprintf(texture_name, "ftm texture %u", object_index);
+		Texture2D linear_tex = create_texture_with_layout(p_scene->a_textures[object_index], TEXTURE_LAYOUT_LINEAR, sizeof(u32));
+		Texture2D tiled_tex = create_texture_with_layout(p_scene->a_textures[object_index], TEXTURE_LAYOUT_TILED_4X4, sizeof(u32));
+		for(u32 angle_index = 0; angle_index < ARRAYSIZE(a_angles_deg); ++angle_index) {
+			benchmark_texture_layout(texture_name, linear_tex, a_angles_deg[angle_index]);
+			benchmark_texture_layout(texture_name, tiled_tex, a_angles_deg[angle_index]);
+		}
+		free(linear_tex.p_data);
+		free(tiled_tex.p_data);
+	}
+}
+
+// The pow benchmarks use the exponent of the srgb encode
+f256 f256_pow_srgb_accurate(f256 x) { return f256_pow_accurate(x, _mm256_set1_ps(1.f / 2.4f)); }
+f256 f256_pow_srgb_fast(f256 x) { return f256_pow_fast(x, _mm256_set1_ps(1.f / 2.4f)); }
+f32 powf_srgb(f32 x) { return powf(x, 1.f / 2.4f); }
+f64 pow_srgb(f64 x) { return pow(x, 1.0 / 2.4); }
+
+typedef struct MathBenchmark {
+	const char *p_name;
+	f256(*simd)(f256);
+	f32(*libm)(f32);
+	f64(*reference)(f64);
+	f32 min_x, max_x;
+} MathBenchmark;
+
+// maps the bits of a float to an integer line, so that the distance between two floats is their ulp distance
+i64 get_ordered_float_bits(f32 x) {
+	i32 bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return (bits < 0) ? (i64)INT32_MIN - bits : bits;
+}
+
+#define MATH_BENCHMARK_SAMPLE_COUNT (1 << 20)
+#define MATH_BENCHMARK_REPEAT_COUNT 16
+
+void benchmark_math_function(const MathBenchmark *p_benchmark, f32 *p_inputs, f32 *p_outputs) {
+	for(u32 i = 0; i < MATH_BENCHMARK_SAMPLE_COUNT; ++i) {
+		p_inputs[i] = p_benchmark->min_x + (p_benchmark->max_x - p_benchmark->min_x) * ((f32)i / MATH_BENCHMARK_SAMPLE_COUNT);
+	}
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+	for(u32 repeat = 0; repeat < MATH_BENCHMARK_REPEAT_COUNT; ++repeat) {
+		for(u32 i = 0; i < MATH_BENCHMARK_SAMPLE_COUNT; ++i) {
+			p_outputs[i] = p_benchmark->libm(p_inputs[i]);
+		}
+	}
+	QueryPerformanceCounter(&end);
+	f64 libm_ns = (end.QuadPart - start.QuadPart) * 1e9 / frequency.QuadPart / ((f64)MATH_BENCHMARK_SAMPLE_COUNT * MATH_BENCHMARK_REPEAT_COUNT);
+
+	QueryPerformanceCounter(&start);
+	for(u32 repeat = 0; repeat < MATH_BENCHMARK_REPEAT_COUNT; ++repeat) {
+		for(u32 i = 0; i < MATH_BENCHMARK_SAMPLE_COUNT; i += VECTOR_WIDTH) {
+			_mm256_storeu_ps(p_outputs + i, p_benchmark->simd(_mm256_loadu_ps(p_inputs + i)));
+		}
+	}
+	QueryPerformanceCounter(&end);
+	f64 simd_ns = (end.QuadPart - start.QuadPart) * 1e9 / frequency.QuadPart / ((f64)MATH_BENCHMARK_SAMPLE_COUNT * MATH_BENCHMARK_REPEAT_COUNT);
+
+	i64 max_ulp_error = 0;
+	f64 max_relative_error = 0.0;
+	for(u32 i = 0; i < MATH_BENCHMARK_SAMPLE_COUNT; ++i) {
+		f64 reference = p_benchmark->reference(p_inputs[i]);
+		i64 ulp_error = llabs(get_ordered_float_bits(p_outputs[i]) - get_ordered_float_bits((f32)reference));
+		max_ulp_error = MAX(max_ulp_error, ulp_error);
+		if(reference != 0.0) max_relative_error = MAX(max_relative_error, fabs((p_outputs[i] - reference) / reference));
+	}
+
+	log_message("%-18s [%9.3g, %9.3g] | max ulp: %8lld | max rel: %10.3e | libm: %6.3f ns | simd: %6.3f ns | speedup: %6.2fx\n",
+		p_benchmark->p_name, p_benchmark->min_x, p_benchmark->max_x, max_ulp_error, max_relative_error, libm_ns, simd_ns, libm_ns / simd_ns);
+}
+
+void benchmark_math() {
+	const MathBenchmark a_benchmarks[] = {
+		{ "acos accurate", f256_acos_accurate, acosf, acos, -1.f, 1.f },
+		{ "acos fast", f256_acos_fast, acosf, acos, -1.f, 1.f },
+		{ "exp accurate", f256_exp_accurate, expf, exp, -87.f, 88.f },
+		{ "exp fast", f256_exp_fast, expf, exp, -87.f, 88.f },
+		{ "exp2 accurate", f256_exp2_accurate, exp2f, exp2, -126.f, 127.f },
+		{ "exp2 fast", f256_exp2_fast, exp2f, exp2, -126.f, 127.f },
+		{ "log2 accurate", f256_log2_accurate, log2f, log2, 1e-3f, 1e3f },
+		{ "log2 fast", f256_log2_fast, log2f, log2, 1e-3f, 1e3f },
+		{ "pow srgb accurate", f256_pow_srgb_accurate, powf_srgb, pow_srgb, 0.f, 1.f },
+		{ "pow srgb fast", f256_pow_srgb_fast, powf_srgb, pow_srgb, 0.f, 1.f },
+	};
+	f32 *p_inputs = malloc(MATH_BENCHMARK_SAMPLE_COUNT * sizeof(f32));
+	f32 *p_outputs = malloc(MATH_BENCHMARK_SAMPLE_COUNT * sizeof(f32));
+	log_message("---- transcendentals (%d samples, times per element, shaders use the %s tier) ----\n",
+		MATH_BENCHMARK_SAMPLE_COUNT, (MATH_PRECISION == MATH_PRECISION_ACCURATE) ? "accurate" : "fast");
+	for(u32 benchmark_index = 0; benchmark_index < ARRAYSIZE(a_benchmarks); ++benchmark_index) {
+		benchmark_math_function(a_benchmarks + benchmark_index, p_inputs, p_outputs);
+	}
+	free(p_inputs);
+	free(p_outputs);
+}
+
+void run_benchmarks() {
+	wait_for_scene(a_scenes + SceneType_FTM);
+	p_log_file = fopen("../benchmark_results.txt", "w");
+	log_message("cpu: %s, logical processor count: %d\n", cpu_brand_name, num_logical_processors);
+	benchmark_texture_layouts();
+	benchmark_math();
+	fclose(p_log_file);
+	p_log_file = NULL;
+}
+
 //----------------------------------------  APPLICATION  ----------------------------------------------------------------------------------------------------------------------------------------------------//
 
-void render(f32 delta_t_ms) {
-	rmt_BeginCPUSample(render, 0);
-	
-	memset(&stats, 0, sizeof(Stats));
-	stats.frame_time = delta_t_ms;
+// The present thread takes the recorded frames in order, waits for their jobs, resolves them into the back present buffer
+// and flips. Frame slots are given back once a frame's swap chain buffer is resolved, so the screen never waits for it.
+DWORD WINAPI present_thread_main(LPVOID p_parameter) {
+	rmt_SetCurrentThreadName("present");
+	for(;;) {
+		WaitForSingleObject(swap_chain.h_recorded_frame_semaphore, INFINITE);
+		SwapChainBuffer *p_buffer = swap_chain.a_buffers + ((u64)swap_chain.presented_frame_count % SWAP_CHAIN_BUFFER_COUNT);
+		job_pool_wait(&p_buffer->job_pool);
+
+		rmt_BeginCPUSample(present, 0);
+		u32 back_present_buffer_index = 1 - swap_chain.front_present_buffer_index;
+		resolve_frame_buffer(p_buffer, swap_chain.a_present_buffers[back_present_buffer_index]);
+		u32 history_draw_count = MIN(p_buffer->draw_count, BAND_COST_HISTORY_DRAW_COUNT);
+		memcpy(swap_chain.a_band_cost_estimates, p_buffer->a_band_costs, history_draw_count * sizeof(p_buffer->a_band_costs[0]));
+		memset(swap_chain.a_band_cost_estimates + history_draw_count, 0, (BAND_COST_HISTORY_DRAW_COUNT - history_draw_count) * sizeof(p_buffer->a_band_costs[0]));
+		memcpy(swap_chain.ap_band_cost_estimate_index_buffers, p_buffer->ap_band_cost_index_buffers, sizeof(p_buffer->ap_band_cost_index_buffers));
+		for(u32 worker_index = 0; worker_index < job_system_get_worker_count(); ++worker_index) {
+			f64 idle_time = job_system_get_worker_idle_time(worker_index);
+			p_buffer->stats.a_worker_idle_times[worker_index] = (f32)(idle_time - swap_chain.a_worker_idle_times[worker_index]);
+			swap_chain.a_worker_idle_times[worker_index] = idle_time;
+		}
+		AcquireSRWLockExclusive(&swap_chain.present_lock);
+		swap_chain.front_present_buffer_index = back_present_buffer_index;
+		stats = p_buffer->stats;
+		ReleaseSRWLockExclusive(&swap_chain.present_lock);
+		rmt_EndCPUSample();
+
+		InterlockedIncrement64(&swap_chain.presented_frame_count);
+		ReleaseSemaphore(swap_chain.h_frame_slot_semaphore, 1, NULL);
+		InvalidateRect(h_window, NULL, FALSE);
+	}
+	return 0;
+}
+
+void init_swap_chain() {
+	for(u32 buffer_index = 0; buffer_index < SWAP_CHAIN_BUFFER_COUNT; ++buffer_index) {
+		job_pool_init(&swap_chain.a_buffers[buffer_index].job_pool);
+	}
+	swap_chain.h_frame_slot_semaphore = CreateSemaphore(NULL, MAX_FRAMES_IN_FLIGHT, MAX_FRAMES_IN_FLIGHT, NULL);
+	swap_chain.h_recorded_frame_semaphore = CreateSemaphore(NULL, 0, MAX_FRAMES_IN_FLIGHT, NULL);
+	InitializeSRWLock(&swap_chain.present_lock);
+	HANDLE h_present_thread = CreateThread(NULL, 0, present_thread_main, NULL, 0, NULL);
+	if(!h_present_thread) {
+		error_win32("CreateThread", GetLastError());
+	}
+	CloseHandle(h_present_thread);
+}
+
+void first_touch_band_job(void *p_data, u32 band_index) {
+	const u32 first_bin = band_index * RASTER_JOB_TILE_ROW_COUNT * WIDTH_IN_TILES;
+	const u32 bin_count = MIN(RASTER_JOB_TILE_ROW_COUNT * WIDTH_IN_TILES, NUM_BINS - first_bin);
+	for(u32 buffer_index = 0; buffer_index < SWAP_CHAIN_BUFFER_COUNT; ++buffer_index) {
+		SwapChainBuffer *p_buffer = swap_chain.a_buffers + buffer_index;
+		memset(p_buffer->a_colors + first_bin, 0, bin_count * TILE_TEXEL_COUNT * sizeof(u32));
+		memset(p_buffer->a_depths + first_bin * TILE_TEXEL_COUNT * sizeof(f32), 0, bin_count * TILE_TEXEL_COUNT * sizeof(f32));
+	}
+}
 
-	const f32 clear_color[4] = { (f32)227/255, (f32)223/255, (f32)216/255, 0.f };
-	clear_render_target_view(clear_color); // TODO(cerlet): Implement clearing via render target view pointer!
-	clear_depth_stencil_view(0.0);
+// Pages are placed on the node of the thread that writes them first, so every band's owner writes its tiles before
+// anything else does. Bands are contiguous in the tile-major targets, only the pages at band edges are shared.
+void first_touch_swap_chain() {
+	rmt_BeginCPUSample(first_touch_swap_chain, 0);
+	JobPool *p_pool = &swap_chain.a_buffers[0].job_pool;
+	job_pool_begin(p_pool);
+	for(u32 band_index = 0; band_index < RASTER_BAND_COUNT; ++band_index) {
+		Job *p_job = job_create(p_pool, first_touch_band_job, NULL, band_index);
+		job_set_worker_affinity(p_job, get_band_owner(band_index), false);
+		job_submit(p_job);
+	}
+	job_pool_end(p_pool);
+	job_pool_wait(p_pool);
+	rmt_EndCPUSample();
+}
+
+// Blocks while MAX_FRAMES_IN_FLIGHT frames are in flight, then makes the next swap chain buffer the back buffer
+void begin_frame() {
+	rmt_BeginCPUSample(begin_frame, 0);
+	WaitForSingleObject(swap_chain.h_frame_slot_semaphore, INFINITE);
+	SwapChainBuffer *p_buffer = swap_chain.a_buffers + (swap_chain.recorded_frame_count % SWAP_CHAIN_BUFFER_COUNT);
+	job_pool_begin(&p_buffer->job_pool);
+	memset(&p_buffer->stats, 0, sizeof(Stats));
+	p_buffer->p_last_binner_job = NULL;
+	memset(p_buffer->a_last_raster_jobs, 0, sizeof(p_buffer->a_last_raster_jobs));
+	p_buffer->draw_count = 0;
+	memset(p_buffer->a_band_costs, 0, sizeof(p_buffer->a_band_costs));
+	memset(p_buffer->ap_band_cost_index_buffers, 0, sizeof(p_buffer->ap_band_cost_index_buffers));
+	p_back_buffer = p_buffer;
+	rmt_EndCPUSample();
+}
+
+// Waits until every frame in flight is on screen
+void flush_swap_chain() {
+	for(u32 slot_index = 0; slot_index < MAX_FRAMES_IN_FLIGHT; ++slot_index) {
+		WaitForSingleObject(swap_chain.h_frame_slot_semaphore, INFINITE);
+	}
+	ReleaseSemaphore(swap_chain.h_frame_slot_semaphore, MAX_FRAMES_IN_FLIGHT, NULL);
+}
+
+// The coarsest LOD whose error, seen from the nearest point of the mesh's bounding sphere, spans at most
+// LOD_MAX_SCREEN_ERROR pixels. The projection's vertical scale maps a view space length at distance d to
+// length * scale_y / d of the half height of the frame. The LOD errors only grow along the chain.
+u32 select_mesh_lod(const Mesh *p_mesh, const PerFrameCB *p_per_frame_cb) {
+	v4f32 eye = m4x4f32_mul_v4f32(&p_per_frame_cb->world_from_view, (v4f32) { 0.f, 0.f, 0.f, 1.f });
+	f32 distance = MAX(v3f32_length(v3f32_subtract_v3f32(p_mesh->center, eye.xyz)) - p_mesh->radius, p_per_frame_cb->near_plane);
+	f32 pixels_per_unit = p_per_frame_cb->projection_scale_y * frame_height * 0.5f / distance;
+	u32 lod_index = 0;
+	while(lod_index + 1 < p_mesh->lod_count && p_mesh->a_lods[lod_index + 1].error * pixels_per_unit <= LOD_MAX_SCREEN_ERROR) {
+		++lod_index;
+	}
+	return lod_index;
+}
+
+// Every context records a contiguous share of the scene's objects, so executing the lists in order keeps the draw order.
+// The first context also clears the targets.
+void record_scene_job(void *p_data, u32 context_index) {
+	SwapChainBuffer *p_buffer = p_data;
+	DeferredContext *p_context = p_buffer->a_deferred_contexts + context_index;
+	Pipeline *p_pipeline = &p_context->pipeline;
+	const Scene *p_scene = p_buffer->p_scene;
+	deferred_context_begin(p_context);
+
+	if(context_index == 0) {
+		const f32 clear_color[4] = { (f32)227/255, (f32)223/255, (f32)216/255, 0.f };
+		deferred_context_clear_render_target_view(p_context, &p_buffer->tile_metadata, clear_color);
+		deferred_context_clear_depth_stencil_view(p_context, &p_buffer->tile_metadata, 0.0);
+	}
+	// nothing to draw until the first scene is resident
+	if(!p_scene) return;
 
 	// Set the common part of the pipeline
-	graphics_pipeline.ia.primitive_topology = PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	p_pipeline->ia.primitive_topology = PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 	Viewport viewport = { 0.f,0.f,(f32)frame_width,(f32)frame_height,0.f,1.f };
-	graphics_pipeline.rs.viewport = viewport;
-	graphics_pipeline.om.p_colors = &frame_buffer[0][0];
-	graphics_pipeline.om.p_depth = &depth_buffer[0][0];
-	graphics_pipeline.vs.p_constant_buffers[0] = &per_frame_cb;
-	
-	Scene *p_scene = a_scenes + current_scene_index;
-	for(i32 object_index = 0; object_index < p_scene->num_objects; ++object_index) {
+	p_pipeline->rs.viewport = viewport;
+	p_pipeline->om.p_colors = &p_buffer->a_colors[0][0];
+	p_pipeline->om.p_tile_metadata = &p_buffer->tile_metadata;
+	p_pipeline->vs.p_constant_buffers[0] = &p_buffer->per_frame_cb;
+	p_pipeline->om.p_depth = p_buffer->a_depths;
+	p_pipeline->om.depth_format = p_scene->depth_format;
+
+	u32 first_object_index = p_scene->num_objects * context_index / DEFERRED_CONTEXT_COUNT;
+	u32 end_object_index = p_scene->num_objects * (context_index + 1) / DEFERRED_CONTEXT_COUNT;
+	for(u32 object_index = first_object_index; object_index < end_object_index; ++object_index) {
 		// Set the draw call specific part of the pipeline
-		graphics_pipeline.ia.input_layout = p_scene->a_vertex_shaders[object_index].in_vertex_size / VECTOR_WIDTH;
-		graphics_pipeline.vs.output_register_count = p_scene->a_vertex_shaders[object_index].out_vertex_size / (sizeof(v4f32)*VECTOR_WIDTH);
-		graphics_pipeline.vs.shader = p_scene->a_vertex_shaders[object_index].vs_main;
-		graphics_pipeline.ps.shader = p_scene->a_pixel_shaders[object_index].ps_main;
+		p_pipeline->vs.output_component_count = p_scene->a_vertex_shaders[object_index].out_vertex_size / sizeof(f256);
+		p_pipeline->vs.shader = p_scene->a_vertex_shaders[object_index].vs_main;
+		p_pipeline->ps.shader = p_scene->a_pixel_shaders[object_index].ps_main;
+		p_pipeline->ps.tile_shader = p_scene->a_pixel_shaders[object_index].ps_tile_main;
+		p_pipeline->p_variant = find_pipeline_variant(p_pipeline->vs.shader, p_pipeline->ps.shader, p_pipeline->vs.output_component_count);
+
+		const Mesh *p_mesh = p_scene->a_meshes + object_index;
+		assert(p_mesh->input_layout.component_count * sizeof(f256) == p_scene->a_vertex_shaders[object_index].in_vertex_size);
+		u32 lod_index = select_mesh_lod(p_mesh, &p_buffer->per_frame_cb);
+		const MeshLod *p_lod = p_mesh->a_lods + lod_index;
+		u32 index_size = (p_mesh->index_format == INDEX_FORMAT_R16_UINT) ? sizeof(u16) : sizeof(u32);
+		p_pipeline->ia.p_index_buffer = (const u8*)p_mesh->p_index_buffer + p_lod->first_index * index_size;
+		p_pipeline->ia.index_format = p_mesh->index_format;
+		memcpy(p_pipeline->ia.ap_vertex_buffers, p_mesh->ap_vertex_buffers, sizeof(p_mesh->ap_vertex_buffers));
+		memcpy(p_pipeline->ia.a_vertex_buffer_strides, p_mesh->a_vertex_buffer_strides, sizeof(p_mesh->a_vertex_buffer_strides));
+		p_pipeline->ia.p_input_layout = &p_mesh->input_layout;
+		p_pipeline->cc.p_clusters = p_mesh->p_clusters ? p_mesh->p_clusters + p_mesh->a_lod_first_clusters[lod_index] : NULL;
+		p_pipeline->cc.p_per_frame_cb = &p_buffer->per_frame_cb;
+		p_pipeline->vs.p_shader_resource_views[0] = &p_scene->a_textures[object_index];
+		p_pipeline->ps.p_shader_resource_views[0] = &p_scene->a_textures[object_index];
+		p_pipeline->vs.p_shader_resource_views[1] = &p_scene->a_texture_cubes[object_index];
+		p_pipeline->ps.p_shader_resource_views[1] = &p_scene->a_texture_cubes[object_index];
+		p_pipeline->vs.p_samplers[0] = p_scene->a_samplers[object_index];
+		p_pipeline->ps.p_samplers[0] = p_scene->a_samplers[object_index];
+		deferred_context_draw_indexed(p_context, p_lod->index_count);
+	}
+}
 
-		graphics_pipeline.ia.p_index_buffer = p_scene->a_meshes[object_index].p_index_buffer;
-		graphics_pipeline.ia.p_vertex_buffer = p_scene->a_meshes[object_index].p_vertex_buffer;
-		graphics_pipeline.vs.p_shader_resource_views[0] = &p_scene->a_textures[object_index];
-		graphics_pipeline.ps.p_shader_resource_views[0] = &p_scene->a_textures[object_index];
-		draw_indexed(p_scene->a_meshes[object_index].header.index_count);
+void execute_command_lists_job(void *p_data, u32 job_index) {
+	SwapChainBuffer *p_buffer = p_data;
+	for(u32 context_index = 0; context_index < DEFERRED_CONTEXT_COUNT; ++context_index) {
+		execute_command_list(p_buffer, &p_buffer->a_deferred_contexts[context_index].command_list);
 	}
+}
+
+// The frame is recorded by jobs into deferred contexts and executed by another job once they are done, so the main
+// thread moves on to the next frame right away
+void render(f32 delta_t_ms) {
+	rmt_BeginCPUSample(render, 0);
+	SwapChainBuffer *p_buffer = p_back_buffer;
+	p_buffer->stats.frame_time = delta_t_ms;
+	// the draws of this frame read the constants while update already writes the next frame's
+	p_buffer->per_frame_cb = per_frame_cb;
+	p_buffer->p_scene = stream_scenes(swap_chain.recorded_frame_count);
+
+	Job *p_execute_job = job_create(&p_buffer->job_pool, execute_command_lists_job, p_buffer, 0);
+	for(u32 context_index = 0; context_index < DEFERRED_CONTEXT_COUNT; ++context_index) {
+		Job *p_record_job = job_create(&p_buffer->job_pool, record_scene_job, p_buffer, context_index);
+		job_add_dependency(p_execute_job, p_record_job);
+		job_submit(p_record_job);
+	}
+	job_submit(p_execute_job);
 
 	rmt_EndCPUSample();
 }
 
-void present(HWND h_window, f32 delta_t) {
-	rmt_BeginCPUSample(present, 0);
-	InvalidateRect(h_window, NULL, FALSE);
-	//UpdateWindow(h_window);
-	rmt_EndCPUSample();
+// Hands the back buffer over to the present thread, the frame's jobs may still be running
+void present() {
+	job_pool_end(&p_back_buffer->job_pool);
+	p_back_buffer = NULL;
+	swap_chain.recorded_frame_count++;
+	ReleaseSemaphore(swap_chain.h_recorded_frame_semaphore, 1, NULL);
 }
 
 void init(HINSTANCE h_instance, i32 n_cmd_show) {
@@ -1311,51 +3041,73 @@ void init(HINSTANCE h_instance, i32 n_cmd_show) {
 		error("init", "Malevich requires AVX support to run!");
 	}
 	get_cpu_info();
-
+	job_system_init(num_logical_processors, is_tile_ownership_enabled);
+	init_swap_chain();
+	if(is_tile_ownership_enabled) {
+		first_touch_swap_chain();
+	}
 	init_window(h_instance, n_cmd_show);
 
+	init_linear_from_srgb_table();
+	init_asset_loader();
+
+	{ // Samplers
+		SamplerDesc linear_clamp_desc = { FILTER_LINEAR, TEXTURE_ADDRESS_CLAMP, TEXTURE_ADDRESS_CLAMP, { 0.f, 0.f, 0.f, 0.f } };
+		create_sampler_state(&linear_clamp_desc, &linear_clamp_sampler);
+
+		SamplerDesc latlon_desc = { FILTER_LINEAR, TEXTURE_ADDRESS_WRAP, TEXTURE_ADDRESS_CLAMP, { 0.f, 0.f, 0.f, 0.f } };
+		create_sampler_state(&latlon_desc, &latlon_sampler);
+	}
+
 	{ // Scene ftm
 		u32 num_objects = 0;
-		load_mesh("../assets/ftm_piedras_mesh.octrn", a_scenes[SceneType_FTM].a_meshes + num_objects);
-		load_texture("../assets/ftm_piedras_tex.octrn", a_scenes[SceneType_FTM].a_textures + num_objects, true);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_MESH, num_objects, "../assets/ftm_piedras_mesh.octrn2", false);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_TEXTURE, num_objects, "../assets/ftm_piedras_tex.octrn", true);
 		a_scenes[SceneType_FTM].a_vertex_shaders[num_objects] = basic_vs;
 		a_scenes[SceneType_FTM].a_pixel_shaders[num_objects] = basic_ps;
+		a_scenes[SceneType_FTM].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
-		load_mesh("../assets/ftm_madera_mesh.octrn", a_scenes[SceneType_FTM].a_meshes + num_objects);
-		load_texture("../assets/ftm_madera_tex.octrn", a_scenes[SceneType_FTM].a_textures + num_objects, true);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_MESH, num_objects, "../assets/ftm_madera_mesh.octrn2", false);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_TEXTURE, num_objects, "../assets/ftm_madera_tex.octrn", true);
 		a_scenes[SceneType_FTM].a_vertex_shaders[num_objects] = basic_vs;
 		a_scenes[SceneType_FTM].a_pixel_shaders[num_objects] = basic_ps;
+		a_scenes[SceneType_FTM].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
-		load_mesh("../assets/ftm_leaves_mesh.octrn", a_scenes[SceneType_FTM].a_meshes + num_objects);
-		load_texture("../assets/ftm_leaves_tex.octrn", a_scenes[SceneType_FTM].a_textures + num_objects, true);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_MESH, num_objects, "../assets/ftm_leaves_mesh.octrn2", false);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_TEXTURE, num_objects, "../assets/ftm_leaves_tex.octrn", true);
 		a_scenes[SceneType_FTM].a_vertex_shaders[num_objects] = basic_vs;
 		a_scenes[SceneType_FTM].a_pixel_shaders[num_objects] = basic_ps;
+		a_scenes[SceneType_FTM].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
-		load_mesh("../assets/ftm_dec_mesh.octrn", a_scenes[SceneType_FTM].a_meshes + num_objects);
-		load_texture("../assets/ftm_dec_tex.octrn", a_scenes[SceneType_FTM].a_textures + num_objects, true);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_MESH, num_objects, "../assets/ftm_dec_mesh.octrn2", false);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_TEXTURE, num_objects, "../assets/ftm_dec_tex.octrn", true);
 		a_scenes[SceneType_FTM].a_vertex_shaders[num_objects] = basic_vs;
 		a_scenes[SceneType_FTM].a_pixel_shaders[num_objects] = basic_ps;
+		a_scenes[SceneType_FTM].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
-		load_mesh("../assets/ftm_roof_mesh.octrn", a_scenes[SceneType_FTM].a_meshes + num_objects);
-		load_texture("../assets/ftm_roof_tex.octrn", a_scenes[SceneType_FTM].a_textures + num_objects, true);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_MESH, num_objects, "../assets/ftm_roof_mesh.octrn2", false);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_TEXTURE, num_objects, "../assets/ftm_roof_tex.octrn", true);
 		a_scenes[SceneType_FTM].a_vertex_shaders[num_objects] = basic_vs;
 		a_scenes[SceneType_FTM].a_pixel_shaders[num_objects] = basic_ps;
+		a_scenes[SceneType_FTM].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
-		load_mesh("../assets/ftm_ground_mesh.octrn", a_scenes[SceneType_FTM].a_meshes + num_objects);
-		load_texture("../assets/ftm_ground_tex.octrn", a_scenes[SceneType_FTM].a_textures + num_objects, true);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_MESH, num_objects, "../assets/ftm_ground_mesh.octrn2", false);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_TEXTURE, num_objects, "../assets/ftm_ground_tex.octrn", true);
 		a_scenes[SceneType_FTM].a_vertex_shaders[num_objects] = basic_vs;
 		a_scenes[SceneType_FTM].a_pixel_shaders[num_objects] = basic_ps;
+		a_scenes[SceneType_FTM].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
-		load_mesh("../assets/ftm_sky_mesh.octrn", a_scenes[SceneType_FTM].a_meshes + num_objects);
-		load_texture("../assets/ftm_sky_tex.octrn", a_scenes[SceneType_FTM].a_textures + num_objects, true);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_MESH, num_objects, "../assets/ftm_sky_mesh.octrn2", false);
+		add_scene_asset(a_scenes + SceneType_FTM, ASSET_TYPE_TEXTURE, num_objects, "../assets/ftm_sky_tex.octrn", true);
 		a_scenes[SceneType_FTM].a_vertex_shaders[num_objects] = basic_vs;
 		a_scenes[SceneType_FTM].a_pixel_shaders[num_objects] = basic_ps;
+		a_scenes[SceneType_FTM].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
 		a_scenes[SceneType_FTM].num_objects = num_objects;
@@ -1363,46 +3115,48 @@ void init(HINSTANCE h_instance, i32 n_cmd_show) {
 
 	{ // Scene toon
 		u32 num_objects = 0;
-		load_mesh("../assets/toon_house_mesh.octrn", a_scenes[SceneType_TOON].a_meshes + num_objects);
-		load_texture("../assets/toon_house_tex.octrn", a_scenes[SceneType_TOON].a_textures + num_objects, true);
+		add_scene_asset(a_scenes + SceneType_TOON, ASSET_TYPE_MESH, num_objects, "../assets/toon_house_mesh.octrn2", false);
+		add_scene_asset(a_scenes + SceneType_TOON, ASSET_TYPE_TEXTURE, num_objects, "../assets/toon_house_tex.octrn", true);
 		a_scenes[SceneType_TOON].a_vertex_shaders[num_objects] = basic_vs;
 		a_scenes[SceneType_TOON].a_pixel_shaders[num_objects] = basic_ps;
+		a_scenes[SceneType_TOON].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
-		load_mesh("../assets/toon_sky_mesh.octrn", a_scenes[SceneType_TOON].a_meshes + num_objects);
-		load_texture("../assets/toon_sky_tex.octrn", a_scenes[SceneType_TOON].a_textures + num_objects, true);
+		add_scene_asset(a_scenes + SceneType_TOON, ASSET_TYPE_MESH, num_objects, "../assets/toon_sky_mesh.octrn2", false);
+		add_scene_asset(a_scenes + SceneType_TOON, ASSET_TYPE_TEXTURE, num_objects, "../assets/toon_sky_tex.octrn", true);
 		a_scenes[SceneType_TOON].a_vertex_shaders[num_objects] = basic_vs;
 		a_scenes[SceneType_TOON].a_pixel_shaders[num_objects] = basic_ps;
+		a_scenes[SceneType_TOON].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
 		a_scenes[SceneType_TOON].num_objects = num_objects;
+		a_scenes[SceneType_TOON].depth_format = DEPTH_FORMAT_D24_UNORM;
 	}
 
 	{ // Scene suprematism
 		u32 num_objects = 0;
-		a_scenes[SceneType_SUPREMATISM].a_meshes[0].p_vertex_buffer = &suprematist_vertex_buffer;
-		a_scenes[SceneType_SUPREMATISM].a_meshes[0].p_index_buffer = &suprematist_index_buffer;
-		a_scenes[SceneType_SUPREMATISM].a_meshes[0].header.index_count = 24;
+		init_interleaved_mesh(a_scenes[SceneType_SUPREMATISM].a_meshes, suprematist_vertex_buffer, sizeof(SuprematistVertex), suprematist_index_buffer, 24);
 		a_scenes[SceneType_SUPREMATISM].num_objects = 1;
 		a_scenes[SceneType_SUPREMATISM].a_vertex_shaders[0] = passthrough_vs;
 		a_scenes[SceneType_SUPREMATISM].a_pixel_shaders[0] = passthrough_ps;
+		a_scenes[SceneType_SUPREMATISM].depth_format = DEPTH_FORMAT_D16_UNORM; // three flat layers at fixed depths
 	}
 
 	{ // Scene Emily
 		u32 num_objects = 0;
-		load_mesh("../assets/emily_head_mesh.octrn", a_scenes[SceneType_EMILY].a_meshes + num_objects);
+		add_scene_asset(a_scenes + SceneType_EMILY, ASSET_TYPE_MESH, num_objects, "../assets/emily_head_mesh.octrn2", false);
 		//load_mesh("../assets/sphere_x8.octrn", a_scenes[SceneType_EMILY].a_meshes + num_objects);
-		load_texture("../assets/ninomaru_teien_panorama_irradiance.octrn", a_scenes[SceneType_EMILY].a_textures + num_objects, false);
+		add_scene_asset(a_scenes + SceneType_EMILY, ASSET_TYPE_TEXTURE_CUBE, num_objects, "../assets/ninomaru_teien_panorama_irradiance.octrn", false);
 		a_scenes[SceneType_EMILY].a_vertex_shaders[num_objects] = basic_vs;
 		a_scenes[SceneType_EMILY].a_pixel_shaders[num_objects] = env_lighting_ps;
+		a_scenes[SceneType_EMILY].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
-		a_scenes[SceneType_EMILY].a_meshes[num_objects].p_vertex_buffer = &fullscreen_vertex_buffer;
-		a_scenes[SceneType_EMILY].a_meshes[num_objects].p_index_buffer = &fullscreen_index_buffer;
-		a_scenes[SceneType_EMILY].a_meshes[num_objects].header.index_count = 24;
-		load_texture("../assets/ninomaru_teien_panorama_radiance.octrn", a_scenes[SceneType_EMILY].a_textures + num_objects, false);
+		init_interleaved_mesh(a_scenes[SceneType_EMILY].a_meshes + num_objects, fullscreen_vertex_buffer, sizeof(SuprematistVertex), fullscreen_index_buffer, 24);
+		add_scene_asset(a_scenes + SceneType_EMILY, ASSET_TYPE_TEXTURE_CUBE, num_objects, "../assets/ninomaru_teien_panorama_radiance.octrn", false);
 		a_scenes[SceneType_EMILY].a_vertex_shaders[num_objects] = fullscreen_vs;
 		a_scenes[SceneType_EMILY].a_pixel_shaders[num_objects] = env_lighting_ps;
+		a_scenes[SceneType_EMILY].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
 		a_scenes[SceneType_EMILY].num_objects = num_objects;
@@ -1410,15 +3164,19 @@ void init(HINSTANCE h_instance, i32 n_cmd_show) {
 
 	{ // Scene Locomotive
 		u32 num_objects = 0;
-		load_mesh("../assets/locomotive_mesh.octrn", a_scenes[SceneType_LOCOMOTIVE].a_meshes + num_objects);
-		load_texture("../assets/ninomaru_teien_panorama_irradiance.octrn", a_scenes[SceneType_LOCOMOTIVE].a_textures + num_objects, false);
+		add_scene_asset(a_scenes + SceneType_LOCOMOTIVE, ASSET_TYPE_MESH, num_objects, "../assets/locomotive_mesh.octrn2", false);
+		add_scene_asset(a_scenes + SceneType_LOCOMOTIVE, ASSET_TYPE_TEXTURE_CUBE, num_objects, "../assets/ninomaru_teien_panorama_irradiance.octrn", false);
 		a_scenes[SceneType_LOCOMOTIVE].a_vertex_shaders[num_objects] = vertex_lighting_vs;
 		a_scenes[SceneType_LOCOMOTIVE].a_pixel_shaders[num_objects] = passthrough_ps;
+		a_scenes[SceneType_LOCOMOTIVE].a_samplers[num_objects] = &linear_clamp_sampler;
 		++num_objects;
 
 		a_scenes[SceneType_LOCOMOTIVE].num_objects = num_objects;
 	}
 
+	// only the first scene is paged in up front, the others when they are switched to
+	request_scene(a_scenes + current_scene_index);
+
 	{ // Init Camera
 		camera.pos = (v3f32){ 3.5f, 1.0f, 1.0f};
 		camera.yaw_rad = TO_RADIANS(0.0);
@@ -1557,6 +3315,8 @@ void update(f32 delta_t) {
 	per_frame_cb.clip_from_world = clip_from_world;
 	per_frame_cb.view_from_clip = m4x4f32_inverse(&camera.clip_from_view);
 	per_frame_cb.world_from_view = world_from_view;
+	per_frame_cb.projection_scale_y = camera.clip_from_view.m11;
+	per_frame_cb.near_plane = camera.near_plane;
 
 	rmt_EndCPUSample();
 }
@@ -1575,8 +3335,37 @@ int CALLBACK WinMain(
 	Remotery* p_remotery;
 	rmt_CreateGlobalInstance(&p_remotery);
 
+	// malevich.exe -convert_mesh in.octrn out.octrn2 : converts a v1 mesh to the mapped v2 container and exits
+	const char *p_convert_arg = strstr(lp_cmd_line, "-convert_mesh");
+	if(p_convert_arg) {
+		char octrn_file_name[MAX_PATH], mesh_file_name[MAX_PATH];
+		MeshOptimizationStats optimization_stats;
+		bool is_converted = (sscanf(p_convert_arg + strlen("-convert_mesh"), "%259s %259s", octrn_file_name, mesh_file_name) == 2) &&
+			mesh_file_convert_from_octrn(octrn_file_name, mesh_file_name, &optimization_stats);
+		if(is_converted) {
+			log_mesh_optimization_stats(mesh_file_name, &optimization_stats);
+		}
+		clean_up(p_remotery);
+		return is_converted ? 0 : 1;
+	}
+
+	// malevich.exe -tile_ownership : pins the workers and gives each one a fixed screen region, for NUMA machines
+	is_tile_ownership_enabled = strstr(lp_cmd_line, "-tile_ownership") != NULL;
+	// malevich.exe -asset_budget_mb 512 : evicts scenes that aren't drawn while the loaded assets take more memory than this
+	const char *p_budget_arg = strstr(lp_cmd_line, "-asset_budget_mb");
+	if(p_budget_arg) {
+		asset_memory_budget = strtoull(p_budget_arg + strlen("-asset_budget_mb"), NULL, 10) << 20;
+	}
+
 	init(h_instance, n_cmd_show);
 
+	// malevich.exe -benchmark : runs the micro benchmarks, writes ../benchmark_results.txt and exits
+	if(strstr(lp_cmd_line, "-benchmark")) {
+		run_benchmarks();
+		clean_up(p_remotery);
+		return 0;
+	}
+
 	MSG msg = { 0 };
 	f64 delta_time_ms = 0.0;
 	LARGE_INTEGER performance_frequency;
@@ -1592,15 +3381,17 @@ int CALLBACK WinMain(
 		}
 		else {
 			rmt_BeginCPUSample(Malevich, 0);
+			begin_frame();
 			update(delta_time_ms);
 			render(delta_time_ms);
-			present(h_window, delta_time_ms);
+			present();
 			rmt_EndCPUSample();
 			QueryPerformanceCounter(&end_frame_time);
 			delta_time_ms = ((end_frame_time.QuadPart - start_frame_time.QuadPart) * counter_scale);
 		}
 	}
 
+	flush_swap_chain();
 	clean_up(p_remotery);
 
 	return 0;
@@ -17,11 +17,6 @@ typedef float		f32;
 typedef double		f64;
 typedef __m256		f256;
 
-// WARNING(cerlet): When using visual studio 2017's "immintrin.h" we need to manually export the symbol names for intel's svml
-extern __m256 __cdecl _mm256_acos_ps(__m256);
-extern __m256 __cdecl _mm256_exp_ps(__m256);
-extern __m256 __cdecl _mm256_pow_ps(__m256, __m256);
-
 #ifndef MIN
 	#define MIN(x,y) ((x<y)?(x):(y))
 #endif
@@ -37,6 +32,178 @@ extern __m256 __cdecl _mm256_pow_ps(__m256, __m256);
 #define TO_RADIANS(Degrees) (Degrees * (PI / 180.0f))
 #define TO_DEGREES(Radians) (Radians * (180.0f / PI))
 
+//----------------------------------------  TRANSCENDENTALS  ---------------------------------------------------------------//
+// AVX2 acos, exp, exp2, log2 and pow in two precision tiers.
+// accurate: minimax polynomials from cephes, within 2 ulp of libm for normal inputs, pow within ~10 ulp in [0, 1].
+// fast: lower degree polynomials, ~1e-4 relative error, below what an 8 bit render target can show.
+// The untiered f256_* functions, which the shaders use, pick the tier with MATH_PRECISION.
+// Denormal inputs are treated as zero.
+
+#define MATH_PRECISION_FAST 0
+#define MATH_PRECISION_ACCURATE 1
+#ifndef MATH_PRECISION
+	#define MATH_PRECISION MATH_PRECISION_FAST
+#endif
+
+// 2^n for integral n in [-127, 128], -127 gives 0 and 128 gives inf
+inline f256 f256_pow2i(f256 n) {
+	return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23));
+}
+
+inline f256 f256_exp2_accurate(f256 x) {
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-127.f)), _mm256_set1_ps(128.f));
+	f256 n = _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	f256 f = _mm256_sub_ps(x, n);
+	f256 p = _mm256_set1_ps(1.535336188319500e-4f);
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.339887440266574e-3f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(9.618437357674640e-3f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(5.550332471162809e-2f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(2.402264791363012e-1f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(6.931472028550421e-1f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.f));
+	return _mm256_mul_ps(p, f256_pow2i(n));
+}
+
+inline f256 f256_exp2_fast(f256 x) {
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-127.f)), _mm256_set1_ps(128.f));
+	f256 n = _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	f256 f = _mm256_sub_ps(x, n);
+	f256 p = _mm256_set1_ps(5.583828294e-2f);
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(2.426394785e-1f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(6.931367339e-1f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(9.999245570e-1f));
+	return _mm256_mul_ps(p, f256_pow2i(n));
+}
+
+// exp(x) = 2^n * exp(r), with r = x - n * ln(2) reduced in two steps to keep the bits of r exact
+inline f256 f256_exp_accurate(f256 x) {
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f)), _mm256_set1_ps(88.7228391116729f));
+	f256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	f256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+	r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+	f256 p = _mm256_set1_ps(1.9875691500e-4f);
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+	p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.f)));
+	// 2^128 does not fit in the exponent, so the top of the range scales in two steps
+	f256 n_half = _mm256_floor_ps(_mm256_mul_ps(n, _mm256_set1_ps(0.5f)));
+	return _mm256_mul_ps(_mm256_mul_ps(p, f256_pow2i(n_half)), f256_pow2i(_mm256_sub_ps(n, n_half)));
+}
+
+inline f256 f256_exp_fast(f256 x) {
+	return f256_exp2_fast(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)));
+}
+
+// ln(x) = e * ln(2) + ln(m), with m in [sqrt(0.5), sqrt(2))
+inline f256 f256_log_accurate(f256 x) {
+	i256 bits = _mm256_castps_si256(x);
+	f256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+	f256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F000000)));
+	f256 is_small = _mm256_cmp_ps(m, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+	e = _mm256_sub_ps(e, _mm256_and_ps(is_small, _mm256_set1_ps(1.f)));
+	m = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(is_small, m)), _mm256_set1_ps(1.f));
+
+	f256 z = _mm256_mul_ps(m, m);
+	f256 p = _mm256_set1_ps(7.0376836292e-2f);
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-1.1514610310e-1f));
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(1.1676998740e-1f));
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-1.2420140846e-1f));
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(1.4249322787e-1f));
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-1.6668057665e-1f));
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(2.0000714765e-1f));
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-2.4999993993e-1f));
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(3.3333331174e-1f));
+	f256 y = _mm256_mul_ps(_mm256_mul_ps(p, m), z);
+	y = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), y);
+	y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+	f256 result = _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), _mm256_add_ps(m, y));
+
+	f256 is_zero = _mm256_cmp_ps(x, _mm256_set1_ps(1.17549435e-38f), _CMP_LT_OQ);
+	f256 is_negative_or_nan = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_NGE_UQ);
+	f256 is_inf = _mm256_cmp_ps(x, _mm256_set1_ps(INFINITY), _CMP_EQ_OQ);
+	result = _mm256_blendv_ps(result, _mm256_set1_ps(-INFINITY), is_zero);
+	result = _mm256_blendv_ps(result, _mm256_set1_ps(INFINITY), is_inf);
+	return _mm256_blendv_ps(result, _mm256_set1_ps(NAN), is_negative_or_nan);
+}
+
+inline f256 f256_log2_accurate(f256 x) {
+	return _mm256_mul_ps(f256_log_accurate(x), _mm256_set1_ps(1.44269504088896341f));
+}
+
+// zero, negative and inf inputs are not special cased, zero gives -127
+inline f256 f256_log2_fast(f256 x) {
+	i256 bits = _mm256_castps_si256(x);
+	f256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+	f256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000)));
+	f256 is_big = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356237309505f), _CMP_GT_OQ);
+	e = _mm256_add_ps(e, _mm256_and_ps(is_big, _mm256_set1_ps(1.f)));
+	m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), is_big);
+	m = _mm256_sub_ps(m, _mm256_set1_ps(1.f));
+	f256 p = _mm256_set1_ps(2.502878470e-1f);
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-3.896752238e-1f));
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(4.857378424e-1f));
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-7.206292159e-1f));
+	p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(1.442640464f));
+	return _mm256_fmadd_ps(p, m, e);
+}
+
+// x^y = 2^(y * log2(x)) for x >= 0, 0^y is 0
+inline f256 f256_pow_accurate(f256 x, f256 y) {
+	f256 result = f256_exp2_accurate(_mm256_mul_ps(y, f256_log2_accurate(x)));
+	return _mm256_andnot_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ), result);
+}
+
+inline f256 f256_pow_fast(f256 x, f256 y) {
+	f256 result = f256_exp2_fast(_mm256_mul_ps(y, f256_log2_fast(x)));
+	return _mm256_andnot_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ), result);
+}
+
+// acos(|x|) = pi/2 - asin(|x|) below 0.5 and 2 * asin(sqrt((1 - |x|) / 2)) above, acos(-x) = pi - acos(x)
+inline f256 f256_acos_accurate(f256 x) {
+	f256 a = _mm256_andnot_ps(_mm256_set1_ps(-0.f), x);
+	f256 is_big = _mm256_cmp_ps(a, _mm256_set1_ps(0.5f), _CMP_GT_OQ);
+	f256 z = _mm256_blendv_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), a), _mm256_set1_ps(0.5f)), is_big);
+	f256 s = _mm256_blendv_ps(a, _mm256_sqrt_ps(z), is_big);
+	f256 p = _mm256_set1_ps(4.2163199048e-2f);
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(2.4181311049e-2f));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(4.5470025998e-2f));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(7.4953002686e-2f));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(1.6666752422e-1f));
+	f256 asin_s = _mm256_fmadd_ps(_mm256_mul_ps(p, z), s, s);
+	f256 result = _mm256_blendv_ps(_mm256_sub_ps(_mm256_set1_ps(PI_OVER_TWO), asin_s), _mm256_add_ps(asin_s, asin_s), is_big);
+	f256 is_negative = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ);
+	return _mm256_blendv_ps(result, _mm256_sub_ps(_mm256_set1_ps(PI), result), is_negative);
+}
+
+// Abramowitz and Stegun 4.4.45
+inline f256 f256_acos_fast(f256 x) {
+	f256 a = _mm256_andnot_ps(_mm256_set1_ps(-0.f), x);
+	f256 p = _mm256_set1_ps(-0.0187293f);
+	p = _mm256_fmadd_ps(p, a, _mm256_set1_ps(0.0742610f));
+	p = _mm256_fmadd_ps(p, a, _mm256_set1_ps(-0.2121144f));
+	p = _mm256_fmadd_ps(p, a, _mm256_set1_ps(1.5707288f));
+	f256 result = _mm256_mul_ps(p, _mm256_sqrt_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), a)));
+	f256 is_negative = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ);
+	return _mm256_blendv_ps(result, _mm256_sub_ps(_mm256_set1_ps(PI), result), is_negative);
+}
+
+#if MATH_PRECISION == MATH_PRECISION_ACCURATE
+	#define f256_acos f256_acos_accurate
+	#define f256_exp f256_exp_accurate
+	#define f256_exp2 f256_exp2_accurate
+	#define f256_log2 f256_log2_accurate
+	#define f256_pow f256_pow_accurate
+#else
+	#define f256_acos f256_acos_fast
+	#define f256_exp f256_exp_fast
+	#define f256_exp2 f256_exp2_fast
+	#define f256_log2 f256_log2_fast
+	#define f256_pow f256_pow_fast
+#endif
+
 typedef struct v2f32
 {
 	union {
@@ -150,6 +317,18 @@ inline f32 v3f32_dot(v3f32 v0, v3f32 v1) {
 	return result;
 }
 
+inline v3f32 v3f32_cross(v3f32 v0, v3f32 v1) {
+	v3f32 result = { v0.y * v1.z - v0.z * v1.y, v0.z * v1.x - v0.x * v1.z, v0.x * v1.y - v0.y * v1.x };
+	return result;
+}
+
+// The index-th of a stream of vectors that are stride bytes apart, like the positions of interleaved vertices
+inline v3f32 v3f32_load_strided(const f32 *p_base, u32 stride, u32 index) {
+	const f32 *p_v = (const f32*)((const u8*)p_base + (u64)index * stride);
+	v3f32 result = { p_v[0], p_v[1], p_v[2] };
+	return result;
+}
+
 inline f256 v3f256_dot(v3f256 v0, v3f256 v1) {
 	f256 result = _mm256_add_ps(_mm256_mul_ps(v0.x, v1.x), _mm256_mul_ps(v0.y, v1.y));
 	result = _mm256_add_ps(result, _mm256_mul_ps(v0.z, v1.z));
@@ -256,6 +435,13 @@ inline v4f256 v4f256_mul_f256(v4f256 v0, f256 f) {
 	return result;
 }
 
+// rcp is only accurate to ~12 bits, one Newton-Raphson step brings it close to full precision
+inline f256 f256_reciprocal(f256 v) {
+	f256 r = _mm256_rcp_ps(v);
+	r = _mm256_mul_ps(r, _mm256_fnmadd_ps(v, r, _mm256_set1_ps(2.0)));
+	return r;
+}
+
 inline f32 v4f32_length(v4f32 v) {
 	return sqrt(v4f32_dot(v, v));
 }
@@ -343,13 +529,37 @@ inline v4f256 decode_u32_as_color_x8(i256 encoded_color) {
 	return result;
 }
 
+// Octahedral encoding of unit vectors: the octahedron |x| + |y| + |z| = 1 is unfolded onto the [-1, 1] square, the lower
+// half mirrored into the corners
+inline v2f32 encode_octahedral(v3f32 n) {
+	f32 one_over_l1_norm = 1.f / (fabsf(n.x) + fabsf(n.y) + fabsf(n.z));
+	v2f32 result = { n.x * one_over_l1_norm, n.y * one_over_l1_norm };
+	if(n.z < 0.f) {
+		f32 x = result.x;
+		result.x = (1.f - fabsf(result.y)) * (x >= 0.f ? 1.f : -1.f);
+		result.y = (1.f - fabsf(x)) * (result.y >= 0.f ? 1.f : -1.f);
+	}
+	return result;
+}
+
+inline v3f256 decode_octahedral_x8(f256 x, f256 y) {
+	v3f256 result;
+	f256 sign_mask = _mm256_set1_ps(-0.f);
+	result.z = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_andnot_ps(sign_mask, x)), _mm256_andnot_ps(sign_mask, y));
+	// folds the corners back below the equator: x -= sign(x) * max(-z, 0)
+	f256 fold = _mm256_max_ps(_mm256_sub_ps(_mm256_setzero_ps(), result.z), _mm256_setzero_ps());
+	result.x = _mm256_sub_ps(x, _mm256_or_ps(fold, _mm256_and_ps(sign_mask, x)));
+	result.y = _mm256_sub_ps(y, _mm256_or_ps(fold, _mm256_and_ps(sign_mask, y)));
+	return v3f256_normalize(result);
+}
+
 inline v3f32 v3f32_exp(v3f32 v) {
 	v3f32 result = { exp(v.x), exp(v.y), exp(v.z) };
 	return result;
 }
 
 inline v3f256 v3f256_exp(v3f256 v) {
-	v3f256 result = { _mm256_exp_ps(v.x), _mm256_exp_ps(v.y), _mm256_exp_ps(v.z) };
+	v3f256 result = { f256_exp(v.x), f256_exp(v.y), f256_exp(v.z) };
 	return result;
 }
 
@@ -369,7 +579,7 @@ inline v3f32 v3f32_pow(v3f32 v, f32 p) {
 }
 
 inline v3f256 v3f256_pow(v3f256 v, f256 p) {
-	v3f256 result = { _mm256_pow_ps(v.x,p),_mm256_pow_ps(v.y,p), _mm256_pow_ps(v.z,p) };
+	v3f256 result = { f256_pow(v.x, p), f256_pow(v.y, p), f256_pow(v.z, p) };
 	return result;
 }
 
@@ -417,7 +627,7 @@ inline f32 srgb_from_linear_approx(f32 c_linear) {
 }
 
 inline f256 f256_srgb_from_linear_approx(f256 c_linear) {
-	f256 c_srgb = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(1.055), _mm256_pow_ps(c_linear, _mm256_set1_ps(0.416666667))), _mm256_set1_ps(-0.055)), _mm256_set1_ps(0.0));
+	f256 c_srgb = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(1.055), f256_pow(c_linear, _mm256_set1_ps(0.416666667))), _mm256_set1_ps(-0.055)), _mm256_set1_ps(0.0));
 	return c_srgb;
 }
 
@@ -0,0 +1,267 @@
+#define LEAN_AND_MEAN
+#include <windows.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh_file.h"
+#include "external/octarine/octarine_mesh.h"
+
+#define ALIGN_UP(x, alignment) (((x) + (alignment) - 1) & ~((u64)(alignment) - 1))
+// The input assembler gathers 16-bit components as 32-bit words, the last one of a stream reads past its end
+#define STREAM_GATHER_SLACK sizeof(u32)
+// The LOD chain ends before a LOD would fall below this many triangles, or when simplification stalls and can't remove
+// at least a quarter of the previous LOD's triangles
+#define LOD_MIN_TRIANGLE_COUNT 256
+
+//----------------------------------------  READING  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+// 0 for an unknown format
+static u32 get_attribute_stride(const MeshAttribute *p_attribute) {
+	switch(p_attribute->format) {
+		case MESH_ATTRIBUTE_FORMAT_FLOAT32: return p_attribute->component_count * sizeof(f32);
+		case MESH_ATTRIBUTE_FORMAT_FLOAT16: return p_attribute->component_count * sizeof(u16);
+		case MESH_ATTRIBUTE_FORMAT_UNORM16: return p_attribute->component_count * sizeof(u16);
+		case MESH_ATTRIBUTE_FORMAT_OCTAHEDRAL_SNORM16: return 2 * sizeof(i16);
+		default: return 0;
+	}
+}
+
+bool mesh_file_map(const char *p_file_name, MeshFile *p_mesh_file) {
+	memset(p_mesh_file, 0, sizeof(MeshFile));
+	// the input assembler gathers vertices in index order, read ahead wouldn't help
+	HANDLE h_file = CreateFileA(p_file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if(h_file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(h_file, &file_size) || file_size.QuadPart < (LONGLONG)sizeof(MeshFileHeader)) {
+		CloseHandle(h_file);
+		return false;
+	}
+	HANDLE h_mapping = CreateFileMappingA(h_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(!h_mapping) {
+		CloseHandle(h_file);
+		return false;
+	}
+	const MeshFileHeader *p_header = MapViewOfFile(h_mapping, FILE_MAP_READ, 0, 0, 0);
+	if(!p_header) {
+		CloseHandle(h_mapping);
+		CloseHandle(h_file);
+		return false;
+	}
+
+	p_mesh_file->p_header = p_header;
+	p_mesh_file->h_file = h_file;
+	p_mesh_file->h_mapping = h_mapping;
+	bool is_valid = (p_header->magic == MESH_FILE_MAGIC) && (p_header->version == MESH_FILE_VERSION) &&
+		(p_header->file_size == (u64)file_size.QuadPart) && (p_header->attribute_count <= MESH_FILE_MAX_ATTRIBUTE_COUNT) &&
+		(p_header->index_size == 2 || p_header->index_size == 4) && (p_header->lod_count >= 1) && (p_header->lod_count <= MESH_FILE_MAX_LOD_COUNT);
+	for(u32 lod_index = 0; is_valid && lod_index < p_header->lod_count; ++lod_index) {
+		const MeshLod *p_lod = p_header->a_lods + lod_index;
+		is_valid = ((u64)p_lod->first_index + p_lod->index_count <= p_header->index_count) && (p_lod->first_index % 8 == 0);
+	}
+	// every gather of the input assembler has to stay inside the view
+	for(u32 attribute_index = 0; is_valid && attribute_index < p_header->attribute_count; ++attribute_index) {
+		const MeshAttribute *p_attribute = p_header->a_attributes + attribute_index;
+		u32 stride = get_attribute_stride(p_attribute);
+		is_valid = (p_attribute->component_count >= 1) && (p_attribute->component_count <= 4) && (stride != 0) && (p_attribute->stride == stride) &&
+			(p_attribute->offset >= sizeof(MeshFileHeader)) && (p_attribute->offset <= p_header->file_size) &&
+			((u64)p_header->vertex_count * stride + STREAM_GATHER_SLACK <= p_header->file_size - p_attribute->offset);
+	}
+	is_valid = is_valid && (p_header->index_offset >= sizeof(MeshFileHeader)) && (p_header->index_offset <= p_header->file_size) &&
+		((u64)p_header->index_count * p_header->index_size <= p_header->file_size - p_header->index_offset);
+	if(!is_valid) {
+		mesh_file_unmap(p_mesh_file);
+		return false;
+	}
+	return true;
+}
+
+void mesh_file_unmap(MeshFile *p_mesh_file) {
+	if(!p_mesh_file->p_header) return;
+	UnmapViewOfFile(p_mesh_file->p_header);
+	CloseHandle(p_mesh_file->h_mapping);
+	CloseHandle(p_mesh_file->h_file);
+	memset(p_mesh_file, 0, sizeof(MeshFile));
+}
+
+const void* mesh_file_get_stream(const MeshFile *p_mesh_file, u32 attribute_index) {
+	assert(attribute_index < p_mesh_file->p_header->attribute_count);
+	return (const u8*)p_mesh_file->p_header + p_mesh_file->p_header->a_attributes[attribute_index].offset;
+}
+
+const void* mesh_file_get_indices(const MeshFile *p_mesh_file) {
+	return (const u8*)p_mesh_file->p_header + p_mesh_file->p_header->index_offset;
+}
+
+//----------------------------------------  WRITING  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+// Writes zeros up to the next multiple of MESH_FILE_ALIGNMENT
+static void write_padding(FILE *p_file, u64 *p_offset) {
+	static const u8 a_zeros[MESH_FILE_ALIGNMENT] = { 0 };
+	u64 aligned_offset = ALIGN_UP(*p_offset, MESH_FILE_ALIGNMENT);
+	fwrite(a_zeros, 1, (size_t)(aligned_offset - *p_offset), p_file);
+	*p_offset = aligned_offset;
+}
+
+bool mesh_file_write(const char *p_file_name, u32 vertex_count, u32 attribute_count, MeshAttribute *p_attributes, const void **pp_streams,
+	u32 lod_count, MeshLod *p_lods, const u32 *p_indices) {
+	assert(attribute_count <= MESH_FILE_MAX_ATTRIBUTE_COUNT);
+	assert(lod_count >= 1 && lod_count <= MESH_FILE_MAX_LOD_COUNT);
+	MeshFileHeader header = { 0 };
+	header.magic = MESH_FILE_MAGIC;
+	header.version = MESH_FILE_VERSION;
+	header.vertex_count = vertex_count;
+	header.index_size = (vertex_count <= 0x10000) ? sizeof(u16) : sizeof(u32);
+	header.attribute_count = attribute_count;
+	header.lod_count = lod_count;
+	for(u32 lod_index = 0; lod_index < lod_count; ++lod_index) {
+		p_lods[lod_index].first_index = header.index_count;
+		header.a_lods[lod_index] = p_lods[lod_index];
+		header.index_count += (p_lods[lod_index].index_count + 7) & ~7u;
+	}
+
+	u64 offset = ALIGN_UP(sizeof(MeshFileHeader), MESH_FILE_ALIGNMENT);
+	for(u32 attribute_index = 0; attribute_index < attribute_count; ++attribute_index) {
+		MeshAttribute *p_attribute = p_attributes + attribute_index;
+		p_attribute->stride = get_attribute_stride(p_attribute);
+		assert(p_attribute->stride);
+		p_attribute->offset = offset;
+		header.a_attributes[attribute_index] = *p_attribute;
+		offset = ALIGN_UP(offset + (u64)vertex_count * p_attribute->stride + STREAM_GATHER_SLACK, MESH_FILE_ALIGNMENT);
+	}
+	header.index_offset = offset;
+	header.file_size = ALIGN_UP(offset + (u64)header.index_count * header.index_size, MESH_FILE_ALIGNMENT);
+
+	FILE *p_file = fopen(p_file_name, "wb");
+	if(!p_file) return false;
+	fwrite(&header, sizeof(header), 1, p_file);
+	offset = sizeof(header);
+	write_padding(p_file, &offset);
+	for(u32 attribute_index = 0; attribute_index < attribute_count; ++attribute_index) {
+		u64 stream_size = (u64)vertex_count * p_attributes[attribute_index].stride;
+		fwrite(pp_streams[attribute_index], 1, (size_t)stream_size, p_file);
+		const u32 slack = 0;
+		fwrite(&slack, STREAM_GATHER_SLACK, 1, p_file);
+		offset += stream_size + STREAM_GATHER_SLACK;
+		write_padding(p_file, &offset);
+	}
+	for(u32 lod_index = 0; lod_index < lod_count; ++lod_index) {
+		u32 index_count = p_lods[lod_index].index_count;
+		u32 padded_index_count = (index_count + 7) & ~7u;
+		for(u32 index_index = 0; index_index < padded_index_count; ++index_index) {
+			u32 index = (index_index < index_count) ? p_indices[index_index] : 0;
+			if(header.index_size == sizeof(u16)) {
+				u16 index_u16 = (u16)index;
+				fwrite(&index_u16, sizeof(u16), 1, p_file);
+			}
+			else {
+				fwrite(&index, sizeof(u32), 1, p_file);
+			}
+		}
+		p_indices += index_count;
+	}
+	offset += (u64)header.index_count * header.index_size;
+	write_padding(p_file, &offset);
+	assert(offset == header.file_size);
+
+	bool is_written = !ferror(p_file);
+	is_written &= (fclose(p_file) == 0);
+	return is_written;
+}
+
+bool mesh_file_convert_from_octrn(const char *p_octrn_file_name, const char *p_file_name, MeshOptimizationStats *p_stats) {
+	OctarineMeshHeader octrn_header;
+	void *p_data = NULL;
+	if(octarine_mesh_read_from_file(p_octrn_file_name, &octrn_header, &p_data) != OCTARINE_MESH_OK) return false;
+
+	typedef struct OctrnVertex {
+		v3f32 position;
+		v3f32 normal;
+		v2f32 texcoord;
+	} OctrnVertex;
+	const OctrnVertex *p_unoptimized_vertices = p_data;
+	u32 *p_octrn_indices = (u32*)(p_unoptimized_vertices + octrn_header.num_vertices);
+	u32 *p_remap = malloc(octrn_header.num_vertices * sizeof(u32));
+	u32 vertex_count = mesh_optimize(p_octrn_indices, octrn_header.num_indices, p_unoptimized_vertices->position.xyz, sizeof(OctrnVertex),
+		octrn_header.num_vertices, p_remap, p_stats);
+	OctrnVertex *p_octrn_vertices = malloc((u64)vertex_count * sizeof(OctrnVertex));
+	for(u32 vertex_index = 0; vertex_index < octrn_header.num_vertices; ++vertex_index) {
+		if(p_remap[vertex_index] != ~0u) {
+			p_octrn_vertices[p_remap[vertex_index]] = p_unoptimized_vertices[vertex_index];
+		}
+	}
+	free(p_remap);
+
+	// Every LOD is simplified from the previous one, so the errors add up. Each LOD that is kept has at most 3/4 of its
+	// predecessor's indices, all of them fit in 4 times LOD 0's.
+	u32 *p_lod_indices = malloc((u64)octrn_header.num_indices * 4 * sizeof(u32));
+	memcpy(p_lod_indices, p_octrn_indices, octrn_header.num_indices * sizeof(u32));
+	MeshLod a_lods[MESH_FILE_MAX_LOD_COUNT] = { { 0, octrn_header.num_indices, 0.f } };
+	u32 lod_count = 1;
+	u32 lod_index_count = octrn_header.num_indices;
+	while(lod_count < MESH_FILE_MAX_LOD_COUNT) {
+		const MeshLod *p_previous_lod = a_lods + lod_count - 1;
+		const u32 *p_previous_indices = p_lod_indices + lod_index_count - p_previous_lod->index_count;
+		u32 target_index_count = p_previous_lod->index_count / 6 * 3;
+		if(target_index_count < LOD_MIN_TRIANGLE_COUNT * 3) break;
+		u32 *p_indices = p_lod_indices + lod_index_count;
+		f32 error;
+		u32 index_count = mesh_simplify(p_indices, p_previous_indices, p_previous_lod->index_count, p_octrn_vertices->position.xyz, sizeof(OctrnVertex),
+			vertex_count, target_index_count, &error);
+		if(index_count > p_previous_lod->index_count / 4 * 3) break;
+		mesh_optimize_vertex_cache(p_indices, index_count, vertex_count);
+		mesh_optimize_overdraw(p_indices, index_count, p_octrn_vertices->position.xyz, sizeof(OctrnVertex), vertex_count);
+		MeshLod lod = { 0, index_count, p_previous_lod->error + error };
+		a_lods[lod_count++] = lod;
+		lod_index_count += index_count;
+	}
+
+	MeshAttribute a_attributes[3] = {
+		{ MESH_ATTRIBUTE_SEMANTIC_POSITION, MESH_ATTRIBUTE_FORMAT_UNORM16, 3 },
+		{ MESH_ATTRIBUTE_SEMANTIC_NORMAL, MESH_ATTRIBUTE_FORMAT_OCTAHEDRAL_SNORM16, 3 },
+		{ MESH_ATTRIBUTE_SEMANTIC_TEXCOORD, MESH_ATTRIBUTE_FORMAT_FLOAT16, 2 },
+	};
+	// positions are quantized over the bounding box
+	v3f32 min_position = { INFINITY, INFINITY, INFINITY };
+	v3f32 max_position = { -INFINITY, -INFINITY, -INFINITY };
+	for(u32 vertex_index = 0; vertex_index < vertex_count; ++vertex_index) {
+		for(u32 i = 0; i < 3; ++i) {
+			min_position.xyz[i] = MIN(min_position.xyz[i], p_octrn_vertices[vertex_index].position.xyz[i]);
+			max_position.xyz[i] = MAX(max_position.xyz[i], p_octrn_vertices[vertex_index].position.xyz[i]);
+		}
+	}
+	f32 a_quantization_scales[3];
+	for(u32 i = 0; i < 3; ++i) {
+		f32 extent = max_position.xyz[i] - min_position.xyz[i];
+		a_attributes[0].a_scale[i] = extent;
+		a_attributes[0].a_bias[i] = min_position.xyz[i];
+		a_quantization_scales[i] = (extent > 0.f) ? 65535.f / extent : 0.f;
+	}
+
+	u16 *p_positions = malloc((u64)vertex_count * 3 * sizeof(u16));
+	i16 *p_normals = malloc((u64)vertex_count * 2 * sizeof(i16));
+	u16 *p_texcoords = malloc((u64)vertex_count * 2 * sizeof(u16));
+	for(u32 vertex_index = 0; vertex_index < vertex_count; ++vertex_index) {
+		const OctrnVertex *p_vertex = p_octrn_vertices + vertex_index;
+		for(u32 i = 0; i < 3; ++i) {
+			f32 quantized = (p_vertex->position.xyz[i] - min_position.xyz[i]) * a_quantization_scales[i];
+			p_positions[vertex_index * 3 + i] = (u16)MIN(quantized + 0.5f, 65535.f);
+		}
+		v2f32 octahedral = encode_octahedral(p_vertex->normal);
+		p_normals[vertex_index * 2 + 0] = (i16)lrintf(octahedral.x * 32767.f);
+		p_normals[vertex_index * 2 + 1] = (i16)lrintf(octahedral.y * 32767.f);
+		p_texcoords[vertex_index * 2 + 0] = _cvtss_sh(p_vertex->texcoord.x, _MM_FROUND_TO_NEAREST_INT);
+		p_texcoords[vertex_index * 2 + 1] = _cvtss_sh(p_vertex->texcoord.y, _MM_FROUND_TO_NEAREST_INT);
+	}
+	const void *a_streams[3] = { p_positions, p_normals, p_texcoords };
+	bool is_converted = mesh_file_write(p_file_name, vertex_count, ARRAYSIZE(a_attributes), a_attributes, a_streams, lod_count, a_lods, p_lod_indices);
+
+	free(p_positions);
+	free(p_normals);
+	free(p_texcoords);
+	free(p_lod_indices);
+	free(p_octrn_vertices);
+	free(p_data);
+	return is_converted;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include "math.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+
+// Mesh container v2 (.octrn2). A file is used in place from a read-only mapping: a MeshFileHeader, then one stream per
+// vertex attribute (structure of arrays, the components of an attribute stay interleaved), then the index buffer. Streams
+// and indices start on MESH_FILE_ALIGNMENT byte boundaries.
+//
+// The index buffer holds a chain of levels of detail back to back, LOD 0 is the full mesh and every next one is simplified
+// further. They all index the same vertices. Every LOD is zero padded to a multiple of 8 indices, so the input assembler
+// can always load 8 of them at a time.
+//
+// Attributes can be quantized, the input assembler decodes them to 32-bit floats as it gathers them. The component count
+// of an attribute is the decoded one, an octahedral normal stores 2 components and decodes to 3.
+
+#define MESH_FILE_MAGIC					0x324D434F	// "OCM2"
+#define MESH_FILE_VERSION				4
+#define MESH_FILE_ALIGNMENT				64
+#define MESH_FILE_MAX_ATTRIBUTE_COUNT	8
+#define MESH_FILE_MAX_LOD_COUNT			8
+
+typedef enum MeshAttributeSemantic {
+	MESH_ATTRIBUTE_SEMANTIC_POSITION = 0,
+	MESH_ATTRIBUTE_SEMANTIC_NORMAL,
+	MESH_ATTRIBUTE_SEMANTIC_TEXCOORD,
+	MESH_ATTRIBUTE_SEMANTIC_COLOR
+} MeshAttributeSemantic;
+
+typedef enum MeshAttributeFormat {
+	MESH_ATTRIBUTE_FORMAT_FLOAT32 = 0,
+	MESH_ATTRIBUTE_FORMAT_FLOAT16,
+	MESH_ATTRIBUTE_FORMAT_UNORM16,			// decoded as unorm * scale + bias, per component
+	MESH_ATTRIBUTE_FORMAT_OCTAHEDRAL_SNORM16	// a unit vector, 2 snorm16 components
+} MeshAttributeFormat;
+
+typedef struct MeshAttribute {
+	u32 semantic;
+	u32 format;
+	u32 component_count;
+	u32 stride;		// bytes from one vertex to the next
+	u64 offset;		// of the stream, from the start of the file
+	f32 a_scale[4];	// of the UNORM16 components
+	f32 a_bias[4];
+} MeshAttribute;
+
+typedef struct MeshLod {
+	u32 first_index;	// into the index buffer, a multiple of 8
+	u32 index_count;	// without the padding
+	f32 error;			// how far the LOD's surface is from LOD 0's, in the units of the positions
+} MeshLod;
+
+typedef struct MeshFileHeader {
+	u32 magic;
+	u32 version;
+	u32 vertex_count;
+	u32 index_count;	// of all the LODs, the padding included
+	u32 index_size;		// 2 or 4 bytes
+	u32 attribute_count;
+	u32 lod_count;
+	u64 index_offset;
+	u64 file_size;
+	MeshAttribute a_attributes[MESH_FILE_MAX_ATTRIBUTE_COUNT];
+	MeshLod a_lods[MESH_FILE_MAX_LOD_COUNT];
+} MeshFileHeader;
+
+typedef struct MeshFile {
+	const MeshFileHeader *p_header; // the start of the mapped view
+	void *h_file;
+	void *h_mapping;
+} MeshFile;
+
+// Fails if the file is missing, isn't a v2 mesh of this version, or its streams and indices don't fit in it
+bool mesh_file_map(const char *p_file_name, MeshFile *p_mesh_file);
+void mesh_file_unmap(MeshFile *p_mesh_file);
+const void* mesh_file_get_stream(const MeshFile *p_mesh_file, u32 attribute_index);
+const void* mesh_file_get_indices(const MeshFile *p_mesh_file);
+// pp_streams hold tightly packed attributes that are already encoded in their formats, the strides and offsets of
+// p_attributes are filled in. p_indices holds the indices of the LODs back to back, the first indices of p_lods are filled
+// in. Indices are stored in 16 bits when every vertex can be addressed with them.
+bool mesh_file_write(const char *p_file_name, u32 vertex_count, u32 attribute_count, MeshAttribute *p_attributes, const void **pp_streams,
+	u32 lod_count, MeshLod *p_lods, const u32 *p_indices);
+// Converts a v1 .octrn mesh, whose vertices interleave a position, a normal and a texture coordinate. The triangles and
+// vertices are reordered by mesh_optimize, p_stats can be NULL. The LOD chain is simplified from there by mesh_simplify,
+// halving the triangle count from one LOD to the next. Positions are quantized to UNORM16 over the bounding box, normals
+// to octahedral SNORM16 and texture coordinates to FLOAT16.
+bool mesh_file_convert_from_octrn(const char *p_octrn_file_name, const char *p_file_name, MeshOptimizationStats *p_stats);
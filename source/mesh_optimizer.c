@@ -0,0 +1,391 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh_optimizer.h"
+#include "external/Remotery/Remotery.h"
+
+//----------------------------------------  VERTEX CACHE  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+// FIFO cache simulation: a vertex is cached while fewer than MESH_OPTIMIZER_CACHE_SIZE misses happened since its own.
+// Timestamps start at 0 and time at MESH_OPTIMIZER_CACHE_SIZE + 1, so every vertex misses the first time.
+static u32 vertex_cache_access(u32 *p_timestamps, u32 *p_time, u32 vertex_index) {
+	if(*p_time - p_timestamps[vertex_index] > MESH_OPTIMIZER_CACHE_SIZE) {
+		p_timestamps[vertex_index] = (*p_time)++;
+		return 1;
+	}
+	return 0;
+}
+
+// Adjacent triangles of vertex v are p_adjacent_triangles[p_offsets[v] .. p_offsets[v + 1])
+static void build_vertex_adjacency(const u32 *p_indices, u32 index_count, u32 vertex_count, u32 **pp_offsets, u32 **pp_adjacent_triangles) {
+	u32 *p_offsets = calloc(vertex_count + 1, sizeof(u32));
+	u32 *p_adjacent_triangles = malloc(index_count * sizeof(u32));
+	for(u32 i = 0; i < index_count; ++i) {
+		p_offsets[p_indices[i] + 1]++;
+	}
+	for(u32 vertex_index = 0; vertex_index < vertex_count; ++vertex_index) {
+		p_offsets[vertex_index + 1] += p_offsets[vertex_index];
+	}
+	u32 *p_fill_counts = calloc(vertex_count, sizeof(u32));
+	for(u32 i = 0; i < index_count; ++i) {
+		u32 vertex_index = p_indices[i];
+		p_adjacent_triangles[p_offsets[vertex_index] + p_fill_counts[vertex_index]++] = i / 3;
+	}
+	free(p_fill_counts);
+	*pp_offsets = p_offsets;
+	*pp_adjacent_triangles = p_adjacent_triangles;
+}
+
+f32 mesh_get_acmr(const u32 *p_indices, u32 index_count, u32 vertex_count) {
+	u32 triangle_count = index_count / 3;
+	if(!triangle_count) return 0.f;
+	u32 *p_timestamps = calloc(vertex_count, sizeof(u32));
+	u32 time = MESH_OPTIMIZER_CACHE_SIZE + 1;
+	u32 miss_count = 0;
+	for(u32 i = 0; i < triangle_count * 3; ++i) {
+		miss_count += vertex_cache_access(p_timestamps, &time, p_indices[i]);
+	}
+	free(p_timestamps);
+	return (f32)miss_count / triangle_count;
+}
+
+// Tipsify: emits all remaining triangles around a fanning vertex, then fans around the emitted vertex that has been in
+// the cache the longest and would still be in it after its own fan. When there is none, it backtracks through the
+// vertices emitted so far, and at last falls back to the next vertex in index order.
+void mesh_optimize_vertex_cache(u32 *p_indices, u32 index_count, u32 vertex_count) {
+	rmt_BeginCPUSample(mesh_optimize_vertex_cache, 0);
+	u32 triangle_count = index_count / 3;
+	if(!triangle_count) {
+		rmt_EndCPUSample();
+		return;
+	}
+	u32 *p_offsets, *p_adjacent_triangles;
+	build_vertex_adjacency(p_indices, triangle_count * 3, vertex_count, &p_offsets, &p_adjacent_triangles);
+	u32 *p_live_triangle_counts = malloc(vertex_count * sizeof(u32));
+	for(u32 vertex_index = 0; vertex_index < vertex_count; ++vertex_index) {
+		p_live_triangle_counts[vertex_index] = p_offsets[vertex_index + 1] - p_offsets[vertex_index];
+	}
+	u32 *p_timestamps = calloc(vertex_count, sizeof(u32));
+	u32 *p_dead_end_stack = malloc(triangle_count * 3 * sizeof(u32));
+	u8 *p_is_emitted = calloc(triangle_count, sizeof(u8));
+	u32 *p_output = malloc(triangle_count * 3 * sizeof(u32));
+	u32 output_count = 0;
+	u32 dead_end_count = 0;
+	u32 time = MESH_OPTIMIZER_CACHE_SIZE + 1;
+	u32 scan_vertex_index = 0;
+
+	u32 fanning_vertex = 0;
+	while(fanning_vertex != ~0u) {
+		// the vertices pushed to the dead-end stack by this fan are the candidates for the next one
+		u32 first_candidate = dead_end_count;
+		for(u32 i = p_offsets[fanning_vertex]; i < p_offsets[fanning_vertex + 1]; ++i) {
+			u32 triangle_index = p_adjacent_triangles[i];
+			if(p_is_emitted[triangle_index]) continue;
+			p_is_emitted[triangle_index] = 1;
+			for(u32 corner = 0; corner < 3; ++corner) {
+				u32 vertex_index = p_indices[triangle_index * 3 + corner];
+				p_output[output_count++] = vertex_index;
+				p_dead_end_stack[dead_end_count++] = vertex_index;
+				p_live_triangle_counts[vertex_index]--;
+				vertex_cache_access(p_timestamps, &time, vertex_index);
+			}
+		}
+
+		u32 next_vertex = ~0u;
+		i32 best_priority = -1;
+		for(u32 i = first_candidate; i < dead_end_count; ++i) {
+			u32 vertex_index = p_dead_end_stack[i];
+			u32 live_triangle_count = p_live_triangle_counts[vertex_index];
+			if(!live_triangle_count) continue;
+			i32 priority = 0;
+			u32 age = time - p_timestamps[vertex_index];
+			if(age + 2 * live_triangle_count <= MESH_OPTIMIZER_CACHE_SIZE) {
+				priority = (i32)age;
+			}
+			if(priority > best_priority) {
+				best_priority = priority;
+				next_vertex = vertex_index;
+			}
+		}
+		while(next_vertex == ~0u && dead_end_count) {
+			u32 vertex_index = p_dead_end_stack[--dead_end_count];
+			if(p_live_triangle_counts[vertex_index]) next_vertex = vertex_index;
+		}
+		if(next_vertex == ~0u) {
+			while(scan_vertex_index < vertex_count && !p_live_triangle_counts[scan_vertex_index]) scan_vertex_index++;
+			if(scan_vertex_index < vertex_count) next_vertex = scan_vertex_index;
+		}
+		fanning_vertex = next_vertex;
+	}
+	assert(output_count == triangle_count * 3);
+	memcpy(p_indices, p_output, output_count * sizeof(u32));
+
+	free(p_offsets);
+	free(p_adjacent_triangles);
+	free(p_live_triangle_counts);
+	free(p_timestamps);
+	free(p_dead_end_stack);
+	free(p_is_emitted);
+	free(p_output);
+	rmt_EndCPUSample();
+}
+
+//----------------------------------------  OVERDRAW  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+typedef struct ClusterSortKey {
+	f32 occlusion;
+	u32 cluster_index;
+} ClusterSortKey;
+
+static int compare_cluster_sort_keys(const void *p_a, const void *p_b) {
+	const ClusterSortKey *p_key_a = p_a;
+	const ClusterSortKey *p_key_b = p_b;
+	if(p_key_a->occlusion != p_key_b->occlusion) return (p_key_a->occlusion > p_key_b->occlusion) ? -1 : 1;
+	return (p_key_a->cluster_index < p_key_b->cluster_index) ? -1 : 1;
+}
+
+// Cuts the triangles into clusters, at every triangle that misses the cache with all of its vertices and wherever the
+// ACMR of a cluster so far is within MESH_OPTIMIZER_ACMR_THRESHOLD of the ACMR of the whole hard cluster. Returns the
+// cluster count, p_cluster_starts gets the first triangle of each.
+static u32 build_clusters(const u32 *p_indices, u32 triangle_count, u32 vertex_count, u32 *p_cluster_starts) {
+	u32 *p_timestamps = calloc(vertex_count, sizeof(u32));
+	u32 time = MESH_OPTIMIZER_CACHE_SIZE + 1;
+	u32 hard_cluster_count = 0;
+	for(u32 triangle_index = 0; triangle_index < triangle_count; ++triangle_index) {
+		u32 miss_count = 0;
+		for(u32 corner = 0; corner < 3; ++corner) {
+			miss_count += vertex_cache_access(p_timestamps, &time, p_indices[triangle_index * 3 + corner]);
+		}
+		if(triangle_index == 0 || miss_count == 3) {
+			p_cluster_starts[hard_cluster_count++] = triangle_index;
+		}
+	}
+
+	// soft cuts only ever split hard clusters
+	u32 *p_hard_cluster_starts = malloc(hard_cluster_count * sizeof(u32));
+	memcpy(p_hard_cluster_starts, p_cluster_starts, hard_cluster_count * sizeof(u32));
+	u32 cluster_count = 0;
+	for(u32 hard_cluster_index = 0; hard_cluster_index < hard_cluster_count; ++hard_cluster_index) {
+		u32 first_triangle = p_hard_cluster_starts[hard_cluster_index];
+		u32 end_triangle = (hard_cluster_index + 1 < hard_cluster_count) ? p_hard_cluster_starts[hard_cluster_index + 1] : triangle_count;
+		f32 threshold = mesh_get_acmr(p_indices + first_triangle * 3, (end_triangle - first_triangle) * 3, vertex_count) * MESH_OPTIMIZER_ACMR_THRESHOLD;
+
+		p_cluster_starts[cluster_count++] = first_triangle;
+		time += MESH_OPTIMIZER_CACHE_SIZE + 1; // flushes the cache
+		u32 miss_count = 0;
+		u32 cluster_triangle_count = 0;
+		for(u32 triangle_index = first_triangle; triangle_index < end_triangle; ++triangle_index) {
+			for(u32 corner = 0; corner < 3; ++corner) {
+				miss_count += vertex_cache_access(p_timestamps, &time, p_indices[triangle_index * 3 + corner]);
+			}
+			cluster_triangle_count++;
+			if(triangle_index + 1 < end_triangle && (f32)miss_count / cluster_triangle_count <= threshold) {
+				p_cluster_starts[cluster_count++] = triangle_index + 1;
+				time += MESH_OPTIMIZER_CACHE_SIZE + 1;
+				miss_count = 0;
+				cluster_triangle_count = 0;
+			}
+		}
+	}
+	free(p_hard_cluster_starts);
+	free(p_timestamps);
+	return cluster_count;
+}
+
+// Clusters whose area weighted normal points away from the mesh centroid are likely to occlude the others, they go first
+void mesh_optimize_overdraw(u32 *p_indices, u32 index_count, const f32 *p_positions, u32 position_stride, u32 vertex_count) {
+	rmt_BeginCPUSample(mesh_optimize_overdraw, 0);
+	u32 triangle_count = index_count / 3;
+	if(!triangle_count) {
+		rmt_EndCPUSample();
+		return;
+	}
+	u32 *p_cluster_starts = malloc(triangle_count * sizeof(u32));
+	u32 cluster_count = build_clusters(p_indices, triangle_count, vertex_count, p_cluster_starts);
+
+	// area weighted centroids and normals, the cross product's length is twice the area
+	v3f32 *p_cluster_centroids = calloc(cluster_count, sizeof(v3f32));
+	v3f32 *p_cluster_normals = calloc(cluster_count, sizeof(v3f32));
+	v3f32 mesh_centroid = { 0.f, 0.f, 0.f };
+	f32 mesh_area = 0.f;
+	for(u32 cluster_index = 0; cluster_index < cluster_count; ++cluster_index) {
+		u32 end_triangle = (cluster_index + 1 < cluster_count) ? p_cluster_starts[cluster_index + 1] : triangle_count;
+		v3f32 centroid = { 0.f, 0.f, 0.f };
+		v3f32 normal = { 0.f, 0.f, 0.f };
+		f32 cluster_area = 0.f;
+		for(u32 triangle_index = p_cluster_starts[cluster_index]; triangle_index < end_triangle; ++triangle_index) {
+			v3f32 p0 = v3f32_load_strided(p_positions, position_stride, p_indices[triangle_index * 3 + 0]);
+			v3f32 p1 = v3f32_load_strided(p_positions, position_stride, p_indices[triangle_index * 3 + 1]);
+			v3f32 p2 = v3f32_load_strided(p_positions, position_stride, p_indices[triangle_index * 3 + 2]);
+			v3f32 cross = v3f32_cross(v3f32_subtract_v3f32(p1, p0), v3f32_subtract_v3f32(p2, p0));
+			f32 area = v3f32_length(cross);
+			v3f32 triangle_centroid = v3f32_mul_f32(v3f32_add_v3f32(v3f32_add_v3f32(p0, p1), p2), 1.f / 3.f);
+			centroid = v3f32_add_v3f32(centroid, v3f32_mul_f32(triangle_centroid, area));
+			normal = v3f32_add_v3f32(normal, cross);
+			cluster_area += area;
+		}
+		mesh_centroid = v3f32_add_v3f32(mesh_centroid, centroid);
+		mesh_area += cluster_area;
+		p_cluster_centroids[cluster_index] = (cluster_area > 0.f) ? v3f32_mul_f32(centroid, 1.f / cluster_area) : centroid;
+		p_cluster_normals[cluster_index] = normal;
+	}
+	if(mesh_area > 0.f) {
+		mesh_centroid = v3f32_mul_f32(mesh_centroid, 1.f / mesh_area);
+	}
+
+	// the winding of the mesh is unknown, normals are flipped if they point inwards on the whole
+	ClusterSortKey *p_sort_keys = malloc(cluster_count * sizeof(ClusterSortKey));
+	f32 outwardness = 0.f;
+	for(u32 cluster_index = 0; cluster_index < cluster_count; ++cluster_index) {
+		v3f32 offset = v3f32_subtract_v3f32(p_cluster_centroids[cluster_index], mesh_centroid);
+		f32 normal_length = v3f32_length(p_cluster_normals[cluster_index]);
+		outwardness += v3f32_dot(offset, p_cluster_normals[cluster_index]);
+		p_sort_keys[cluster_index].occlusion = (normal_length > 0.f) ? v3f32_dot(offset, p_cluster_normals[cluster_index]) / normal_length : 0.f;
+		p_sort_keys[cluster_index].cluster_index = cluster_index;
+	}
+	if(outwardness < 0.f) {
+		for(u32 cluster_index = 0; cluster_index < cluster_count; ++cluster_index) {
+			p_sort_keys[cluster_index].occlusion = -p_sort_keys[cluster_index].occlusion;
+		}
+	}
+	qsort(p_sort_keys, cluster_count, sizeof(ClusterSortKey), compare_cluster_sort_keys);
+
+	u32 *p_output = malloc(triangle_count * 3 * sizeof(u32));
+	u32 output_count = 0;
+	for(u32 i = 0; i < cluster_count; ++i) {
+		u32 cluster_index = p_sort_keys[i].cluster_index;
+		u32 end_triangle = (cluster_index + 1 < cluster_count) ? p_cluster_starts[cluster_index + 1] : triangle_count;
+		u32 cluster_index_count = (end_triangle - p_cluster_starts[cluster_index]) * 3;
+		memcpy(p_output + output_count, p_indices + p_cluster_starts[cluster_index] * 3, cluster_index_count * sizeof(u32));
+		output_count += cluster_index_count;
+	}
+	memcpy(p_indices, p_output, output_count * sizeof(u32));
+
+	free(p_output);
+	free(p_sort_keys);
+	free(p_cluster_normals);
+	free(p_cluster_centroids);
+	free(p_cluster_starts);
+	rmt_EndCPUSample();
+}
+
+// Rasterizes a triangle with a less depth test, both faces, and counts the fragments that pass it
+static u64 rasterize_overdraw_triangle(v3f32 p0, v3f32 p1, v3f32 p2, f32 *p_depths) {
+	const i32 view_size = MESH_OPTIMIZER_OVERDRAW_VIEW_SIZE;
+	f32 area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+	if(area == 0.f) return 0;
+	if(area < 0.f) {
+		v3f32 swap = p1;
+		p1 = p2;
+		p2 = swap;
+		area = -area;
+	}
+	i32 min_x = MAX((i32)floorf(MIN3(p0.x, p1.x, p2.x)), 0);
+	i32 min_y = MAX((i32)floorf(MIN3(p0.y, p1.y, p2.y)), 0);
+	i32 max_x = MIN((i32)ceilf(MAX3(p0.x, p1.x, p2.x)), view_size - 1);
+	i32 max_y = MIN((i32)ceilf(MAX3(p0.y, p1.y, p2.y)), view_size - 1);
+	f32 one_over_area = 1.f / area;
+	u64 passed_fragment_count = 0;
+	for(i32 y = min_y; y <= max_y; ++y) {
+		for(i32 x = min_x; x <= max_x; ++x) {
+			f32 px = x + 0.5f;
+			f32 py = y + 0.5f;
+			f32 w0 = (p2.x - p1.x) * (py - p1.y) - (p2.y - p1.y) * (px - p1.x);
+			f32 w1 = (p0.x - p2.x) * (py - p2.y) - (p0.y - p2.y) * (px - p2.x);
+			f32 w2 = (p1.x - p0.x) * (py - p0.y) - (p1.y - p0.y) * (px - p0.x);
+			if(w0 < 0.f || w1 < 0.f || w2 < 0.f) continue;
+			f32 depth = (w0 * p0.z + w1 * p1.z + w2 * p2.z) * one_over_area;
+			f32 *p_depth = p_depths + y * view_size + x;
+			if(depth < *p_depth) {
+				*p_depth = depth;
+				passed_fragment_count++;
+			}
+		}
+	}
+	return passed_fragment_count;
+}
+
+// Orthographic views down both directions of every axis, each one stretched over the bounding box
+f32 mesh_get_overdraw(const u32 *p_indices, u32 index_count, const f32 *p_positions, u32 position_stride, u32 vertex_count) {
+	rmt_BeginCPUSample(mesh_get_overdraw, 0);
+	const u32 view_size = MESH_OPTIMIZER_OVERDRAW_VIEW_SIZE;
+	v3f32 min_position = { INFINITY, INFINITY, INFINITY };
+	v3f32 max_position = { -INFINITY, -INFINITY, -INFINITY };
+	for(u32 vertex_index = 0; vertex_index < vertex_count; ++vertex_index) {
+		v3f32 position = v3f32_load_strided(p_positions, position_stride, vertex_index);
+		for(u32 i = 0; i < 3; ++i) {
+			min_position.xyz[i] = MIN(min_position.xyz[i], position.xyz[i]);
+			max_position.xyz[i] = MAX(max_position.xyz[i], position.xyz[i]);
+		}
+	}
+
+	f32 *p_depths = malloc(view_size * view_size * sizeof(f32));
+	u64 passed_fragment_count = 0;
+	u64 covered_pixel_count = 0;
+	for(u32 view_index = 0; view_index < 6; ++view_index) {
+		u32 axis = view_index / 2;
+		u32 u_axis = (axis + 1) % 3;
+		u32 v_axis = (axis + 2) % 3;
+		f32 depth_sign = (view_index & 1) ? -1.f : 1.f;
+		f32 u_extent = max_position.xyz[u_axis] - min_position.xyz[u_axis];
+		f32 v_extent = max_position.xyz[v_axis] - min_position.xyz[v_axis];
+		f32 u_scale = (u_extent > 0.f) ? view_size / u_extent : 0.f;
+		f32 v_scale = (v_extent > 0.f) ? view_size / v_extent : 0.f;
+		for(u32 i = 0; i < view_size * view_size; ++i) {
+			p_depths[i] = INFINITY;
+		}
+		for(u32 i = 0; i + 2 < index_count; i += 3) {
+			v3f32 a_projected[3];
+			for(u32 corner = 0; corner < 3; ++corner) {
+				v3f32 position = v3f32_load_strided(p_positions, position_stride, p_indices[i + corner]);
+				a_projected[corner].x = (position.xyz[u_axis] - min_position.xyz[u_axis]) * u_scale;
+				a_projected[corner].y = (position.xyz[v_axis] - min_position.xyz[v_axis]) * v_scale;
+				a_projected[corner].z = position.xyz[axis] * depth_sign;
+			}
+			passed_fragment_count += rasterize_overdraw_triangle(a_projected[0], a_projected[1], a_projected[2], p_depths);
+		}
+		for(u32 i = 0; i < view_size * view_size; ++i) {
+			covered_pixel_count += p_depths[i] != INFINITY;
+		}
+	}
+	free(p_depths);
+	rmt_EndCPUSample();
+	return covered_pixel_count ? (f32)passed_fragment_count / covered_pixel_count : 0.f;
+}
+
+//----------------------------------------  VERTEX FETCH  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+u32 mesh_optimize_vertex_fetch(u32 *p_indices, u32 index_count, u32 vertex_count, u32 *p_remap) {
+	memset(p_remap, 0xFF, vertex_count * sizeof(u32));
+	u32 used_vertex_count = 0;
+	for(u32 i = 0; i < index_count; ++i) {
+		u32 vertex_index = p_indices[i];
+		if(p_remap[vertex_index] == ~0u) {
+			p_remap[vertex_index] = used_vertex_count++;
+		}
+		p_indices[i] = p_remap[vertex_index];
+	}
+	return used_vertex_count;
+}
+
+u32 mesh_optimize(u32 *p_indices, u32 index_count, const f32 *p_positions, u32 position_stride, u32 vertex_count, u32 *p_remap,
+	MeshOptimizationStats *p_stats) {
+	if(p_stats) {
+		p_stats->acmr_before = mesh_get_acmr(p_indices, index_count, vertex_count);
+		p_stats->overdraw_before = mesh_get_overdraw(p_indices, index_count, p_positions, position_stride, vertex_count);
+		p_stats->vertex_count_before = vertex_count;
+	}
+	mesh_optimize_vertex_cache(p_indices, index_count, vertex_count);
+	mesh_optimize_overdraw(p_indices, index_count, p_positions, position_stride, vertex_count);
+	// the vertex fetch order doesn't change either of them
+	if(p_stats) {
+		p_stats->acmr_after = mesh_get_acmr(p_indices, index_count, vertex_count);
+		p_stats->overdraw_after = mesh_get_overdraw(p_indices, index_count, p_positions, position_stride, vertex_count);
+	}
+	u32 used_vertex_count = mesh_optimize_vertex_fetch(p_indices, index_count, vertex_count, p_remap);
+	if(p_stats) {
+		p_stats->vertex_count_after = used_vertex_count;
+	}
+	return used_vertex_count;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "math.h"
+
+// Offline triangle and vertex reordering of indexed triangle lists, after Sander, Nehab and Barczak, "Fast Triangle
+// Reordering for Vertex Locality and Reduced Overdraw" (2007):
+//	1. Tipsify orders the triangles for a FIFO post-transform vertex cache.
+//	2. The result is cut into clusters wherever the cache locality allows it, and the clusters are sorted so the ones
+//	   that face away from the mesh center, the likely occluders, are drawn first.
+//	3. Vertices are renumbered in the order the indices first use them, so vertex fetches walk the streams forwards.
+
+#define MESH_OPTIMIZER_CACHE_SIZE			16		// of the simulated vertex cache
+#define MESH_OPTIMIZER_ACMR_THRESHOLD		1.05f	// how much a cluster cut may worsen the ACMR
+#define MESH_OPTIMIZER_OVERDRAW_VIEW_SIZE	256		// of the orthographic views overdraw is measured from
+
+typedef struct MeshOptimizationStats {
+	f32 acmr_before;		// average cache miss ratio, vertex shader invocations per triangle
+	f32 acmr_after;
+	f32 overdraw_before;	// fragments passing the depth test per covered pixel, averaged over 6 axis aligned views
+	f32 overdraw_after;
+	u32 vertex_count_before;
+	u32 vertex_count_after;	// unreferenced vertices are dropped
+} MeshOptimizationStats;
+
+// Reorders the triangles of p_indices in place
+void mesh_optimize_vertex_cache(u32 *p_indices, u32 index_count, u32 vertex_count);
+// Reorders the triangles of p_indices, already optimized for the vertex cache, in place
+void mesh_optimize_overdraw(u32 *p_indices, u32 index_count, const f32 *p_positions, u32 position_stride, u32 vertex_count);
+// Renumbers the vertices in the order of first use, p_remap[old vertex index] is the new index or ~0u if the vertex is
+// unused. Returns the new vertex count.
+u32 mesh_optimize_vertex_fetch(u32 *p_indices, u32 index_count, u32 vertex_count, u32 *p_remap);
+f32 mesh_get_acmr(const u32 *p_indices, u32 index_count, u32 vertex_count);
+f32 mesh_get_overdraw(const u32 *p_indices, u32 index_count, const f32 *p_positions, u32 position_stride, u32 vertex_count);
+// All three passes, p_positions are strided by position_stride bytes
+u32 mesh_optimize(u32 *p_indices, u32 index_count, const f32 *p_positions, u32 position_stride, u32 vertex_count, u32 *p_remap,
+	MeshOptimizationStats *p_stats);
@@ -0,0 +1,351 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh_simplifier.h"
+#include "external/Remotery/Remotery.h"
+
+//----------------------------------------  QUADRICS  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+// Sum of the squared distances to a set of planes, weighted by the areas of the triangles they come from:
+// Q(p) = p^T A p + 2 b^T p + c. Doubles, the sums of large meshes lose too much in floats.
+typedef struct Quadric {
+	f64 a00, a11, a22, a01, a02, a12;
+	f64 b0, b1, b2;
+	f64 c;
+	f64 weight;
+} Quadric;
+
+static void quadric_add_plane(Quadric *p_quadric, v3f32 normal, f32 distance, f32 weight) {
+	p_quadric->a00 += weight * normal.x * normal.x;
+	p_quadric->a11 += weight * normal.y * normal.y;
+	p_quadric->a22 += weight * normal.z * normal.z;
+	p_quadric->a01 += weight * normal.x * normal.y;
+	p_quadric->a02 += weight * normal.x * normal.z;
+	p_quadric->a12 += weight * normal.y * normal.z;
+	p_quadric->b0 += weight * normal.x * distance;
+	p_quadric->b1 += weight * normal.y * distance;
+	p_quadric->b2 += weight * normal.z * distance;
+	p_quadric->c += weight * distance * distance;
+	p_quadric->weight += weight;
+}
+
+static void quadric_add_quadric(Quadric *p_quadric, const Quadric *p_other) {
+	p_quadric->a00 += p_other->a00; p_quadric->a11 += p_other->a11; p_quadric->a22 += p_other->a22;
+	p_quadric->a01 += p_other->a01; p_quadric->a02 += p_other->a02; p_quadric->a12 += p_other->a12;
+	p_quadric->b0 += p_other->b0; p_quadric->b1 += p_other->b1; p_quadric->b2 += p_other->b2;
+	p_quadric->c += p_other->c;
+	p_quadric->weight += p_other->weight;
+}
+
+// The weighted mean squared distance of p to the planes of both quadrics
+static f32 get_collapse_error(const Quadric *p_q0, const Quadric *p_q1, v3f32 p) {
+	Quadric q = *p_q0;
+	quadric_add_quadric(&q, p_q1);
+	if(q.weight <= 0.0) return 0.f;
+	f64 error = q.a00 * p.x * p.x + q.a11 * p.y * p.y + q.a22 * p.z * p.z +
+		2.0 * (q.a01 * p.x * p.y + q.a02 * p.x * p.z + q.a12 * p.y * p.z) +
+		2.0 * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z) + q.c;
+	return (f32)(MAX(error, 0.0) / q.weight);
+}
+
+//----------------------------------------  TOPOLOGY  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+static u32 hash_u32(u32 key) {
+	key ^= key >> 16;
+	key *= 0x7feb352d;
+	key ^= key >> 15;
+	key *= 0x846ca68b;
+	key ^= key >> 16;
+	return key;
+}
+
+static u32 get_hash_table_size(u32 entry_count) {
+	u32 size = 1;
+	while(size < entry_count * 2) size *= 2;
+	return size;
+}
+
+// p_position_ids[v] is the first vertex with the position of v, vertices that only differ in other attributes share it
+static void build_position_ids(const f32 *p_positions, u32 position_stride, u32 vertex_count, u32 *p_position_ids) {
+	u32 table_size = get_hash_table_size(vertex_count);
+	u32 *p_table = malloc(table_size * sizeof(u32));
+	memset(p_table, 0xFF, table_size * sizeof(u32));
+	for(u32 vertex_index = 0; vertex_index < vertex_count; ++vertex_index) {
+		const u32 *p_key = (const u32*)((const u8*)p_positions + (u64)vertex_index * position_stride);
+		u32 slot = hash_u32(p_key[0] ^ hash_u32(p_key[1] ^ hash_u32(p_key[2]))) & (table_size - 1);
+		for(;;) {
+			if(p_table[slot] == ~0u) {
+				p_table[slot] = vertex_index;
+				p_position_ids[vertex_index] = vertex_index;
+				break;
+			}
+			const u32 *p_other_key = (const u32*)((const u8*)p_positions + (u64)p_table[slot] * position_stride);
+			if(memcmp(p_key, p_other_key, 3 * sizeof(u32)) == 0) {
+				p_position_ids[vertex_index] = p_table[slot];
+				break;
+			}
+			slot = (slot + 1) & (table_size - 1);
+		}
+	}
+	free(p_table);
+}
+
+// A vertex that shares its position with exactly one other vertex lies on a seam, p_twins[v] is that other vertex or ~0u.
+// Locks the vertices that share their position with more than one other vertex, and the ends of every edge without a
+// triangle on its other side. Edges are compared by position, so a seam isn't mistaken for a border.
+static void lock_seams_and_borders(const u32 *p_indices, u32 index_count, const u32 *p_position_ids, u32 vertex_count, u8 *p_is_locked,
+	u32 *p_twins) {
+	u32 *p_position_use_counts = calloc(vertex_count, sizeof(u32));
+	for(u32 vertex_index = 0; vertex_index < vertex_count; ++vertex_index) {
+		p_position_use_counts[p_position_ids[vertex_index]]++;
+	}
+	memset(p_twins, 0xFF, vertex_count * sizeof(u32));
+	for(u32 vertex_index = 0; vertex_index < vertex_count; ++vertex_index) {
+		u32 position_id = p_position_ids[vertex_index];
+		p_is_locked[vertex_index] = p_position_use_counts[position_id] > 2;
+		if(p_position_use_counts[position_id] == 2 && position_id != vertex_index) {
+			p_twins[vertex_index] = position_id;
+			p_twins[position_id] = vertex_index;
+		}
+	}
+	free(p_position_use_counts);
+
+	// a set of the directed edges, a border edge is missing its reverse
+	u32 table_size = get_hash_table_size(index_count);
+	u64 *p_edges = malloc(table_size * sizeof(u64));
+	memset(p_edges, 0xFF, table_size * sizeof(u64));
+	for(u32 pass = 0; pass < 2; ++pass) {
+		for(u32 i = 0; i < index_count; ++i) {
+			u32 v0 = p_position_ids[p_indices[i]];
+			u32 v1 = p_position_ids[p_indices[i - i % 3 + (i + 1) % 3]];
+			if(v0 == v1) continue;
+			u32 a = (pass == 0) ? v0 : v1;
+			u32 b = (pass == 0) ? v1 : v0;
+			u64 edge = (u64)a << 32 | b;
+			u32 slot = hash_u32(a ^ hash_u32(b)) & (table_size - 1);
+			while(p_edges[slot] != ~0ull && p_edges[slot] != edge) {
+				slot = (slot + 1) & (table_size - 1);
+			}
+			if(pass == 0) {
+				p_edges[slot] = edge;
+			}
+			else if(p_edges[slot] == ~0ull) {
+				p_is_locked[p_indices[i]] = 1;
+				p_is_locked[p_indices[i - i % 3 + (i + 1) % 3]] = 1;
+			}
+		}
+	}
+	free(p_edges);
+}
+
+//----------------------------------------  EDGE COLLAPSE  ----------------------------------------------------------------------------------------------------------------------------------------------------//
+
+typedef struct Collapse {
+	u32 source;	// moves onto target
+	u32 target;
+	f32 error;
+} Collapse;
+
+// A seam vertex only moves together with its twin, along an edge to another seam vertex, so that both sides of the seam
+// stay joined
+static bool can_collapse(const u8 *p_is_locked, const u32 *p_twins, u32 source, u32 target) {
+	if(p_is_locked[source]) return false;
+	if(p_twins[source] == ~0u) return true;
+	// borders are locked per vertex, the twin can be the one on the border
+	return !p_is_locked[p_twins[source]] && p_twins[target] != ~0u && p_twins[source] != target;
+}
+
+static Collapse get_collapse(const Quadric *p_quadrics, const u32 *p_twins, const f32 *p_positions, u32 position_stride, u32 source, u32 target) {
+	Quadric quadric = p_quadrics[source];
+	// a seam collapse is measured against the triangles on both sides of the seam
+	if(p_twins[source] != ~0u) {
+		quadric_add_quadric(&quadric, p_quadrics + p_twins[source]);
+		quadric_add_quadric(&quadric, p_quadrics + p_twins[target]);
+	}
+	Collapse collapse = { source, target, get_collapse_error(&quadric, p_quadrics + target, v3f32_load_strided(p_positions, position_stride, target)) };
+	return collapse;
+}
+
+static int compare_collapses(const void *p_a, const void *p_b) {
+	f32 a = ((const Collapse*)p_a)->error;
+	f32 b = ((const Collapse*)p_b)->error;
+	return (a > b) - (a < b);
+}
+
+// A collapse must not turn any of the triangles that stay around the source vertex over
+static bool does_collapse_flip(const u32 *p_indices, const u32 *p_adjacent_triangles, u32 adjacent_triangle_count, const f32 *p_positions,
+	u32 position_stride, u32 source, u32 target) {
+	v3f32 target_position = v3f32_load_strided(p_positions, position_stride, target);
+	for(u32 i = 0; i < adjacent_triangle_count; ++i) {
+		const u32 *p_triangle = p_indices + p_adjacent_triangles[i] * 3;
+		if(p_triangle[0] == target || p_triangle[1] == target || p_triangle[2] == target) continue;
+		v3f32 a_positions[3];
+		for(u32 vertex = 0; vertex < 3; ++vertex) {
+			a_positions[vertex] = v3f32_load_strided(p_positions, position_stride, p_triangle[vertex]);
+		}
+		v3f32 normal = v3f32_cross(v3f32_subtract_v3f32(a_positions[1], a_positions[0]), v3f32_subtract_v3f32(a_positions[2], a_positions[0]));
+		// a degenerate triangle has no side to turn over
+		if(v3f32_dot(normal, normal) == 0.f) continue;
+		for(u32 vertex = 0; vertex < 3; ++vertex) {
+			if(p_triangle[vertex] == source) a_positions[vertex] = target_position;
+		}
+		v3f32 collapsed_normal = v3f32_cross(v3f32_subtract_v3f32(a_positions[1], a_positions[0]), v3f32_subtract_v3f32(a_positions[2], a_positions[0]));
+		if(v3f32_dot(normal, collapsed_normal) <= 0.f) return true;
+	}
+	return false;
+}
+
+static bool does_any_triangle_use(const u32 *p_indices, const u32 *p_triangles, u32 triangle_count, u32 vertex) {
+	for(u32 i = 0; i < triangle_count; ++i) {
+		const u32 *p_triangle = p_indices + p_triangles[i] * 3;
+		if(p_triangle[0] == vertex || p_triangle[1] == vertex || p_triangle[2] == vertex) return true;
+	}
+	return false;
+}
+
+// Moves source onto target in the triangles around source and marks all of their vertices as touched, so none of the
+// pass's other collapses sees these triangles change. Returns how many of them lost an edge.
+static u32 apply_collapse(u32 *p_indices, const u32 *p_source_triangles, u32 source_triangle_count, u32 source, u32 target, u8 *p_is_touched) {
+	u32 removed_triangle_count = 0;
+	for(u32 i = 0; i < source_triangle_count; ++i) {
+		u32 *p_triangle = p_indices + p_source_triangles[i] * 3;
+		bool is_removed = false;
+		for(u32 vertex = 0; vertex < 3; ++vertex) {
+			is_removed |= (p_triangle[vertex] == target);
+			p_is_touched[p_triangle[vertex]] = 1;
+		}
+		removed_triangle_count += is_removed;
+	}
+	for(u32 i = 0; i < source_triangle_count; ++i) {
+		u32 *p_triangle = p_indices + p_source_triangles[i] * 3;
+		for(u32 vertex = 0; vertex < 3; ++vertex) {
+			if(p_triangle[vertex] == source) p_triangle[vertex] = target;
+		}
+	}
+	return removed_triangle_count;
+}
+
+// Every pass collects the collapses of all edges, sorts them by error and applies the cheapest ones whose neighbourhoods
+// don't overlap, so the adjacency and the errors a pass starts with stay valid until its end.
+u32 mesh_simplify(u32 *p_out_indices, const u32 *p_indices, u32 index_count, const f32 *p_positions, u32 position_stride, u32 vertex_count,
+	u32 target_index_count, f32 *p_error) {
+	rmt_BeginCPUSample(mesh_simplify, 0);
+	memmove(p_out_indices, p_indices, index_count * sizeof(u32));
+	u32 *p_indices_left = p_out_indices;
+
+	u32 *p_position_ids = malloc(vertex_count * sizeof(u32));
+	build_position_ids(p_positions, position_stride, vertex_count, p_position_ids);
+	u8 *p_is_locked = malloc(vertex_count);
+	u32 *p_twins = malloc(vertex_count * sizeof(u32));
+	lock_seams_and_borders(p_indices_left, index_count, p_position_ids, vertex_count, p_is_locked, p_twins);
+	free(p_position_ids);
+
+	Quadric *p_quadrics = calloc(vertex_count, sizeof(Quadric));
+	for(u32 triangle_index = 0; triangle_index < index_count / 3; ++triangle_index) {
+		const u32 *p_triangle = p_indices_left + triangle_index * 3;
+		v3f32 p0 = v3f32_load_strided(p_positions, position_stride, p_triangle[0]);
+		v3f32 normal = v3f32_cross(v3f32_subtract_v3f32(v3f32_load_strided(p_positions, position_stride, p_triangle[1]), p0),
+			v3f32_subtract_v3f32(v3f32_load_strided(p_positions, position_stride, p_triangle[2]), p0));
+		// the cross product's length is twice the area
+		f32 length = v3f32_length(normal);
+		if(length == 0.f) continue;
+		normal = v3f32_mul_f32(normal, 1.f / length);
+		for(u32 vertex = 0; vertex < 3; ++vertex) {
+			quadric_add_plane(p_quadrics + p_triangle[vertex], normal, -v3f32_dot(normal, p0), length * 0.5f);
+		}
+	}
+
+	Collapse *p_collapses = malloc(index_count * 2 * sizeof(Collapse));
+	u32 *p_offsets = malloc((vertex_count + 1) * sizeof(u32));
+	u32 *p_adjacent_triangles = malloc(index_count * sizeof(u32));
+	u8 *p_is_touched = malloc(vertex_count);
+	f32 max_error = 0.f;
+	while(index_count > target_index_count) {
+		u32 collapse_count = 0;
+		for(u32 i = 0; i < index_count; ++i) {
+			u32 v0 = p_indices_left[i];
+			u32 v1 = p_indices_left[i - i % 3 + (i + 1) % 3];
+			// interior edges are seen from both of their triangles, the second collapse finds its vertices touched
+			if(can_collapse(p_is_locked, p_twins, v0, v1)) {
+				p_collapses[collapse_count++] = get_collapse(p_quadrics, p_twins, p_positions, position_stride, v0, v1);
+			}
+			if(can_collapse(p_is_locked, p_twins, v1, v0)) {
+				p_collapses[collapse_count++] = get_collapse(p_quadrics, p_twins, p_positions, position_stride, v1, v0);
+			}
+		}
+		qsort(p_collapses, collapse_count, sizeof(Collapse), compare_collapses);
+
+		// adjacent triangles of vertex v are p_adjacent_triangles[p_offsets[v] .. p_offsets[v + 1])
+		memset(p_offsets, 0, (vertex_count + 1) * sizeof(u32));
+		for(u32 i = 0; i < index_count; ++i) {
+			p_offsets[p_indices_left[i] + 1]++;
+		}
+		for(u32 vertex_index = 0; vertex_index < vertex_count; ++vertex_index) {
+			p_offsets[vertex_index + 1] += p_offsets[vertex_index];
+		}
+		for(u32 i = 0; i < index_count; ++i) {
+			p_adjacent_triangles[p_offsets[p_indices_left[i]]++] = i / 3;
+		}
+		for(u32 vertex_index = vertex_count; vertex_index > 0; --vertex_index) {
+			p_offsets[vertex_index] = p_offsets[vertex_index - 1];
+		}
+		p_offsets[0] = 0;
+
+		// a collapse removes the triangles that share its edge
+		memset(p_is_touched, 0, vertex_count);
+		u32 removed_triangle_count = 0;
+		u32 applied_collapse_count = 0;
+		for(u32 collapse_index = 0; collapse_index < collapse_count && index_count - removed_triangle_count * 3 > target_index_count; ++collapse_index) {
+			Collapse collapse = p_collapses[collapse_index];
+			if(p_is_touched[collapse.source] || p_is_touched[collapse.target]) continue;
+			const u32 *p_source_triangles = p_adjacent_triangles + p_offsets[collapse.source];
+			u32 source_triangle_count = p_offsets[collapse.source + 1] - p_offsets[collapse.source];
+			if(does_collapse_flip(p_indices_left, p_source_triangles, source_triangle_count, p_positions, position_stride, collapse.source, collapse.target)) {
+				continue;
+			}
+			u32 source_twin = p_twins[collapse.source];
+			if(source_twin != ~0u) {
+				u32 target_twin = p_twins[collapse.target];
+				if(p_is_touched[source_twin] || p_is_touched[target_twin]) continue;
+				const u32 *p_twin_triangles = p_adjacent_triangles + p_offsets[source_twin];
+				u32 twin_triangle_count = p_offsets[source_twin + 1] - p_offsets[source_twin];
+				// the twins share an edge only if the collapse runs along the seam rather than across it
+				if(!does_any_triangle_use(p_indices_left, p_twin_triangles, twin_triangle_count, target_twin)) continue;
+				if(does_collapse_flip(p_indices_left, p_twin_triangles, twin_triangle_count, p_positions, position_stride, source_twin, target_twin)) {
+					continue;
+				}
+				removed_triangle_count += apply_collapse(p_indices_left, p_twin_triangles, twin_triangle_count, source_twin, target_twin, p_is_touched);
+				quadric_add_quadric(p_quadrics + target_twin, p_quadrics + source_twin);
+			}
+			removed_triangle_count += apply_collapse(p_indices_left, p_source_triangles, source_triangle_count, collapse.source, collapse.target, p_is_touched);
+			quadric_add_quadric(p_quadrics + collapse.target, p_quadrics + collapse.source);
+			max_error = MAX(max_error, collapse.error);
+			applied_collapse_count++;
+		}
+		if(!applied_collapse_count) break;
+
+		// drop the triangles that lost an edge
+		u32 kept_index_count = 0;
+		for(u32 i = 0; i < index_count; i += 3) {
+			u32 v0 = p_indices_left[i], v1 = p_indices_left[i + 1], v2 = p_indices_left[i + 2];
+			if(v0 == v1 || v1 == v2 || v2 == v0) continue;
+			p_indices_left[kept_index_count++] = v0;
+			p_indices_left[kept_index_count++] = v1;
+			p_indices_left[kept_index_count++] = v2;
+		}
+		index_count = kept_index_count;
+	}
+
+	free(p_collapses);
+	free(p_offsets);
+	free(p_adjacent_triangles);
+	free(p_is_touched);
+	free(p_quadrics);
+	free(p_is_locked);
+	free(p_twins);
+	*p_error = sqrtf(max_error);
+	rmt_EndCPUSample();
+	return index_count;
+}
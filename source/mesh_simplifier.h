@@ -0,0 +1,17 @@
+#pragma once
+
+#include "math.h"
+
+// Offline simplification of indexed triangle lists by edge collapse, after Garland and Heckbert, "Surface Simplification
+// Using Quadric Error Metrics" (1997). A vertex is only ever collapsed onto one of its neighbours, so the simplified
+// triangles index the original vertices and every level of detail of a mesh shares its vertex streams. Vertices on open
+// borders never move, and an attribute seam, where two vertices share a position, only collapses along itself with the
+// vertices of both sides moving together, which keeps the simplified surface free of cracks. Vertices shared by more than
+// two sides of a seam stay where they are.
+
+// Collapses the cheapest edges of the triangles of p_indices until at most target_index_count indices are left, or until
+// no edge can be collapsed without flipping a triangle. Writes the remaining triangles to p_out_indices, which has room
+// for index_count indices and can be p_indices, and returns their index count. *p_error gets the quadric estimate of how far
+// the simplified surface is from the original one, in the units of the positions.
+u32 mesh_simplify(u32 *p_out_indices, const u32 *p_indices, u32 index_count, const f32 *p_positions, u32 position_stride, u32 vertex_count,
+	u32 target_index_count, f32 *p_error);
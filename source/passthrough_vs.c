@@ -9,11 +9,9 @@ typedef struct Vs_Input {
 typedef struct Vs_Output {
 	v4f256 SV_POSITION;
 	v3f256 COLOR;
-	v2f256 UV;
-	f256 _pad[3];
 }Vs_Output;
 
-static void vs_main(const void *p_vertex_input_data, void *p_vertex_output_data, const void *p_constant_buffers, u32 vertex_id) {
+void passthrough_vs_main(const void *p_vertex_input_data, void *p_vertex_output_data, const void **pp_constant_buffers, const void **pp_shader_resource_views, const SamplerState **pp_samplers) {
 	Vs_Input *p_in = ((Vs_Input*)p_vertex_input_data);
 	Vs_Output *p_out = ((Vs_Output*)p_vertex_output_data);
 	
@@ -24,4 +22,4 @@ static void vs_main(const void *p_vertex_input_data, void *p_vertex_output_data,
 	p_out->COLOR = p_in->COLOR;
 }
 
-VertexShader passthrough_vs = { sizeof(Vs_Input), sizeof(Vs_Output),  vs_main };
+VertexShader passthrough_vs = { sizeof(Vs_Input), sizeof(Vs_Output), passthrough_vs_main };
@@ -0,0 +1,227 @@
+#include "common_shader_core.h"
+
+// Sampling kernels, one per (filter, texel format, address_u, address_v) combination. They are stamped out by the macros
+// below so that the addressing, fetching and filtering code of every kernel is resolved at compile time, with no
+// branches on the sampler desc and no per-lane scalar work. create_sampler_state picks the kernels for a desc.
+
+// Addressing of integer texel coordinates. Only TEXTURE_ADDRESS_BORDER can leave the texture, the lanes that do
+// are or'ed into p_is_outside and get a valid (clamped) coordinate, so the gathers never read out of bounds.
+
+static inline i256 address_wrap_x8(i256 s, i32 size, i256 *p_is_outside) {
+	i256 size_x8 = _mm256_set1_epi32(size);
+	i256 quotient = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(s), _mm256_set1_ps(1.f / size))));
+	s = _mm256_sub_epi32(s, _mm256_mullo_epi32(quotient, size_x8));
+	// the reciprocal can be off by one next to the multiples of size
+	s = _mm256_add_epi32(s, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), s), size_x8));
+	s = _mm256_sub_epi32(s, _mm256_andnot_si256(_mm256_cmpgt_epi32(size_x8, s), size_x8));
+	return s;
+}
+
+static inline i256 address_mirror_x8(i256 s, i32 size, i256 *p_is_outside) {
+	i256 period = address_wrap_x8(s, 2 * size, p_is_outside);
+	i256 mirrored = _mm256_sub_epi32(_mm256_set1_epi32(2 * size - 1), period);
+	return _mm256_blendv_epi8(period, mirrored, _mm256_cmpgt_epi32(period, _mm256_set1_epi32(size - 1)));
+}
+
+static inline i256 address_clamp_x8(i256 s, i32 size, i256 *p_is_outside) {
+	return _mm256_max_epi32(_mm256_min_epi32(s, _mm256_set1_epi32(size - 1)), _mm256_setzero_si256());
+}
+
+static inline i256 address_border_x8(i256 s, i32 size, i256 *p_is_outside) {
+	i256 is_outside = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), s), _mm256_cmpgt_epi32(s, _mm256_set1_epi32(size - 1)));
+	*p_is_outside = _mm256_or_si256(*p_is_outside, is_outside);
+	return address_clamp_x8(s, size, p_is_outside);
+}
+
+// Texel fetches, lanes that are off in the mask are not read and come back as zero
+
+static inline v4f256 fetch_unorm8_x8(Texture2D tex, i256 s, i256 t, i256 mask) {
+	i256 texels;
+	if(is_block_compressed(tex.format)) {
+		texels = fetch_block_compressed_unorm8_x8(tex, s, t, mask);
+	}
+	else {
+		i256 index = get_texel_index_x8(tex, s, t);
+		texels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), tex.p_data, index, mask, 4);
+	}
+	return decode_u32_as_color_x8(texels);
+}
+
+static inline v4f256 fetch_float4_x8(Texture2D tex, i256 s, i256 t, i256 mask) {
+	if(is_block_compressed(tex.format)) return fetch_block_compressed_float4_x8(tex, s, t, mask);
+	if(tex.format == TEXTURE_FORMAT_R16G16B16A16_FLOAT) return gather_r16g16b16a16_x8(tex.p_data, get_texel_index_x8(tex, s, t), mask);
+
+	i256 index = _mm256_slli_epi32(get_texel_index_x8(tex, s, t), 2);
+	f256 mask_f = _mm256_castsi256_ps(mask);
+	v4f256 texel;
+	texel.x = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), (f32*)tex.p_data + 0, index, mask_f, 4);
+	texel.y = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), (f32*)tex.p_data + 1, index, mask_f, 4);
+	texel.z = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), (f32*)tex.p_data + 2, index, mask_f, 4);
+	texel.w = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), (f32*)tex.p_data + 3, index, mask_f, 4);
+	return texel;
+}
+
+static inline v4f256 apply_border_color_x8(v4f256 texel, const SamplerState *p_sampler, i256 is_outside) {
+	f256 is_outside_f = _mm256_castsi256_ps(is_outside);
+	texel.x = _mm256_blendv_ps(texel.x, _mm256_set1_ps(p_sampler->desc.border_color[0]), is_outside_f);
+	texel.y = _mm256_blendv_ps(texel.y, _mm256_set1_ps(p_sampler->desc.border_color[1]), is_outside_f);
+	texel.z = _mm256_blendv_ps(texel.z, _mm256_set1_ps(p_sampler->desc.border_color[2]), is_outside_f);
+	texel.w = _mm256_blendv_ps(texel.w, _mm256_set1_ps(p_sampler->desc.border_color[3]), is_outside_f);
+	return texel;
+}
+
+#define FETCH_WITH_BORDER_X8(format, s, t, is_outside) \
+	apply_border_color_x8(fetch_##format##_x8(tex, s, t, _mm256_andnot_si256(is_outside, mask)), p_sampler, is_outside)
+
+// Filter bodies, v is flipped since row 0 of the textures is the top row
+
+#define SAMPLE_point(format, mode_u, mode_v) \
+	i256 is_outside = _mm256_setzero_si256(); \
+	i256 s = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(_mm256_set1_ps((f32)tex.width), u))); \
+	i256 t = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(_mm256_set1_ps((f32)tex.height), _mm256_sub_ps(_mm256_set1_ps(1.f), v)))); \
+	s = address_##mode_u##_x8(s, tex.width, &is_outside); \
+	t = address_##mode_v##_x8(t, tex.height, &is_outside); \
+	return FETCH_WITH_BORDER_X8(format, s, t, is_outside);
+
+#define SAMPLE_linear(format, mode_u, mode_v) \
+	f256 s_f32 = _mm256_fmadd_ps(_mm256_set1_ps((f32)tex.width), u, _mm256_set1_ps(-0.5f)); \
+	f256 t_f32 = _mm256_fmadd_ps(_mm256_set1_ps((f32)tex.height), _mm256_sub_ps(_mm256_set1_ps(1.f), v), _mm256_set1_ps(-0.5f)); \
+	f256 s_floor = _mm256_floor_ps(s_f32); \
+	f256 t_floor = _mm256_floor_ps(t_f32); \
+	f256 frac_s = _mm256_sub_ps(s_f32, s_floor); \
+	f256 frac_t = _mm256_sub_ps(t_f32, t_floor); \
+	i256 s = _mm256_cvttps_epi32(s_floor); \
+	i256 t = _mm256_cvttps_epi32(t_floor); \
+	i256 is_outside_s0 = _mm256_setzero_si256(), is_outside_s1 = _mm256_setzero_si256(); \
+	i256 is_outside_t0 = _mm256_setzero_si256(), is_outside_t1 = _mm256_setzero_si256(); \
+	i256 s0 = address_##mode_u##_x8(s, tex.width, &is_outside_s0); \
+	i256 s1 = address_##mode_u##_x8(_mm256_add_epi32(s, _mm256_set1_epi32(1)), tex.width, &is_outside_s1); \
+	i256 t0 = address_##mode_v##_x8(t, tex.height, &is_outside_t0); \
+	i256 t1 = address_##mode_v##_x8(_mm256_add_epi32(t, _mm256_set1_epi32(1)), tex.height, &is_outside_t1); \
+	v4f256 texel_00 = FETCH_WITH_BORDER_X8(format, s0, t0, _mm256_or_si256(is_outside_s0, is_outside_t0)); \
+	v4f256 texel_10 = FETCH_WITH_BORDER_X8(format, s1, t0, _mm256_or_si256(is_outside_s1, is_outside_t0)); \
+	v4f256 texel_0010 = v4f256_lerp(texel_00, texel_10, frac_s); \
+	v4f256 texel_01 = FETCH_WITH_BORDER_X8(format, s0, t1, _mm256_or_si256(is_outside_s0, is_outside_t1)); \
+	v4f256 texel_11 = FETCH_WITH_BORDER_X8(format, s1, t1, _mm256_or_si256(is_outside_s1, is_outside_t1)); \
+	v4f256 texel_0111 = v4f256_lerp(texel_01, texel_11, frac_s); \
+	return v4f256_lerp(texel_0010, texel_0111, frac_t);
+
+#define DEFINE_SAMPLE_KERNEL(filter, format, mode_u, mode_v) \
+static v4f256 sample_##filter##_##format##_##mode_u##_##mode_v##_x8(Texture2D tex, const SamplerState *p_sampler, f256 u, f256 v, i256 mask) { \
+	SAMPLE_##filter(format, mode_u, mode_v) \
+}
+
+#define DEFINE_SAMPLE_KERNELS_FOR_MODE_U(filter, format, mode_u) \
+	DEFINE_SAMPLE_KERNEL(filter, format, mode_u, wrap) \
+	DEFINE_SAMPLE_KERNEL(filter, format, mode_u, mirror) \
+	DEFINE_SAMPLE_KERNEL(filter, format, mode_u, clamp) \
+	DEFINE_SAMPLE_KERNEL(filter, format, mode_u, border)
+
+#define DEFINE_SAMPLE_KERNELS(filter, format) \
+	DEFINE_SAMPLE_KERNELS_FOR_MODE_U(filter, format, wrap) \
+	DEFINE_SAMPLE_KERNELS_FOR_MODE_U(filter, format, mirror) \
+	DEFINE_SAMPLE_KERNELS_FOR_MODE_U(filter, format, clamp) \
+	DEFINE_SAMPLE_KERNELS_FOR_MODE_U(filter, format, border)
+
+DEFINE_SAMPLE_KERNELS(point, unorm8)
+DEFINE_SAMPLE_KERNELS(linear, unorm8)
+DEFINE_SAMPLE_KERNELS(point, float4)
+DEFINE_SAMPLE_KERNELS(linear, float4)
+
+// Kernel tables indexed as [Filter][address_u][address_v], the order has to match the TextureAddressMode enum
+#define SAMPLE_KERNEL_ROW(filter, format, mode_u) { \
+	sample_##filter##_##format##_##mode_u##_wrap_x8, sample_##filter##_##format##_##mode_u##_mirror_x8, \
+	sample_##filter##_##format##_##mode_u##_clamp_x8, sample_##filter##_##format##_##mode_u##_border_x8 }
+
+#define SAMPLE_KERNEL_TABLE(filter, format) { \
+	SAMPLE_KERNEL_ROW(filter, format, wrap), SAMPLE_KERNEL_ROW(filter, format, mirror), \
+	SAMPLE_KERNEL_ROW(filter, format, clamp), SAMPLE_KERNEL_ROW(filter, format, border) }
+
+typedef v4f256(*SampleKernel)(Texture2D tex, const SamplerState *p_sampler, f256 u, f256 v, i256 mask);
+
+static const SampleKernel a_unorm8_sample_kernels[FILTER_COUNT][TEXTURE_ADDRESS_COUNT][TEXTURE_ADDRESS_COUNT] = {
+	SAMPLE_KERNEL_TABLE(point, unorm8),
+	SAMPLE_KERNEL_TABLE(linear, unorm8)
+};
+
+static const SampleKernel a_float4_sample_kernels[FILTER_COUNT][TEXTURE_ADDRESS_COUNT][TEXTURE_ADDRESS_COUNT] = {
+	SAMPLE_KERNEL_TABLE(point, float4),
+	SAMPLE_KERNEL_TABLE(linear, float4)
+};
+
+// Cube lookups: the major axis picks the face, the other two components divided by it give the face coordinates
+
+static inline void get_cube_face_coords_x8(v3f256 dir, i256 *p_face, f256 *p_u, f256 *p_v) {
+	const f256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	f256 abs_x = _mm256_and_ps(dir.x, abs_mask);
+	f256 abs_y = _mm256_and_ps(dir.y, abs_mask);
+	f256 abs_z = _mm256_and_ps(dir.z, abs_mask);
+	f256 is_x_major = _mm256_and_ps(_mm256_cmp_ps(abs_x, abs_y, _CMP_GE_OQ), _mm256_cmp_ps(abs_x, abs_z, _CMP_GE_OQ));
+	f256 is_y_major = _mm256_andnot_ps(is_x_major, _mm256_cmp_ps(abs_y, abs_z, _CMP_GE_OQ));
+
+	f256 major = _mm256_blendv_ps(_mm256_blendv_ps(dir.z, dir.y, is_y_major), dir.x, is_x_major);
+	f256 is_negative = _mm256_cmp_ps(major, _mm256_setzero_ps(), _CMP_LT_OQ);
+	f256 sign = _mm256_and_ps(major, _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000)));
+	f256 neg_y = _mm256_xor_ps(dir.y, _mm256_set1_ps(-0.f));
+
+	// +X: (-z, -y), -X: (z, -y), +Y: (x, z), -Y: (x, -z), +Z: (x, -y), -Z: (-x, -y)
+	f256 sc = _mm256_blendv_ps(_mm256_xor_ps(dir.x, sign), dir.x, is_y_major);
+	sc = _mm256_blendv_ps(sc, _mm256_xor_ps(_mm256_xor_ps(dir.z, sign), _mm256_set1_ps(-0.f)), is_x_major);
+	f256 tc = _mm256_blendv_ps(neg_y, _mm256_xor_ps(dir.z, sign), is_y_major);
+
+	f256 face = _mm256_blendv_ps(_mm256_set1_ps(4.f), _mm256_set1_ps(2.f), is_y_major);
+	face = _mm256_blendv_ps(face, _mm256_setzero_ps(), is_x_major);
+	face = _mm256_add_ps(face, _mm256_and_ps(is_negative, _mm256_set1_ps(1.f)));
+	*p_face = _mm256_cvttps_epi32(face);
+
+	f256 half_over_major = _mm256_div_ps(_mm256_set1_ps(0.5f), _mm256_and_ps(major, abs_mask));
+	*p_u = _mm256_fmadd_ps(sc, half_over_major, _mm256_set1_ps(0.5f));
+	*p_v = _mm256_fmadd_ps(tc, half_over_major, _mm256_set1_ps(0.5f));
+}
+
+static v4f256 sample_cube_point_x8(TextureCube tex, const SamplerState *p_sampler, v3f256 dir, i256 mask) {
+	i256 face; f256 u, v;
+	get_cube_face_coords_x8(dir, &face, &u, &v);
+	i256 is_outside = _mm256_setzero_si256();
+	f256 face_size = _mm256_set1_ps((f32)tex.face_size);
+	i256 s = address_clamp_x8(_mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(face_size, u))), tex.face_size, &is_outside);
+	i256 t = address_clamp_x8(_mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(face_size, v))), tex.face_size, &is_outside);
+	t = _mm256_add_epi32(t, _mm256_mullo_epi32(face, _mm256_set1_epi32(tex.face_size)));
+	return fetch_float4_x8(tex.faces, s, t, mask);
+}
+
+static v4f256 sample_cube_linear_x8(TextureCube tex, const SamplerState *p_sampler, v3f256 dir, i256 mask) {
+	i256 face; f256 u, v;
+	get_cube_face_coords_x8(dir, &face, &u, &v);
+	i256 is_outside = _mm256_setzero_si256();
+	f256 face_size = _mm256_set1_ps((f32)tex.face_size);
+	f256 s_f32 = _mm256_fmadd_ps(face_size, u, _mm256_set1_ps(-0.5f));
+	f256 t_f32 = _mm256_fmadd_ps(face_size, v, _mm256_set1_ps(-0.5f));
+	f256 s_floor = _mm256_floor_ps(s_f32);
+	f256 t_floor = _mm256_floor_ps(t_f32);
+	f256 frac_s = _mm256_sub_ps(s_f32, s_floor);
+	f256 frac_t = _mm256_sub_ps(t_f32, t_floor);
+	i256 s = _mm256_cvttps_epi32(s_floor);
+	i256 t = _mm256_cvttps_epi32(t_floor);
+	i256 face_offset = _mm256_mullo_epi32(face, _mm256_set1_epi32(tex.face_size));
+	i256 s0 = address_clamp_x8(s, tex.face_size, &is_outside);
+	i256 s1 = address_clamp_x8(_mm256_add_epi32(s, _mm256_set1_epi32(1)), tex.face_size, &is_outside);
+	i256 t0 = _mm256_add_epi32(address_clamp_x8(t, tex.face_size, &is_outside), face_offset);
+	i256 t1 = _mm256_add_epi32(address_clamp_x8(_mm256_add_epi32(t, _mm256_set1_epi32(1)), tex.face_size, &is_outside), face_offset);
+
+	v4f256 texel_0010 = v4f256_lerp(fetch_float4_x8(tex.faces, s0, t0, mask), fetch_float4_x8(tex.faces, s1, t0, mask), frac_s);
+	v4f256 texel_0111 = v4f256_lerp(fetch_float4_x8(tex.faces, s0, t1, mask), fetch_float4_x8(tex.faces, s1, t1, mask), frac_s);
+	return v4f256_lerp(texel_0010, texel_0111, frac_t);
+}
+
+static v4f256(*const a_sample_cube_kernels[FILTER_COUNT])(TextureCube tex, const SamplerState *p_sampler, v3f256 dir, i256 mask) = {
+	sample_cube_point_x8,
+	sample_cube_linear_x8
+};
+
+void create_sampler_state(const SamplerDesc *p_desc, SamplerState *p_sampler) {
+	p_sampler->desc = *p_desc;
+	p_sampler->sample_unorm8_x8 = a_unorm8_sample_kernels[p_desc->filter][p_desc->address_u][p_desc->address_v];
+	p_sampler->sample_float4_x8 = a_float4_sample_kernels[p_desc->filter][p_desc->address_u][p_desc->address_v];
+	p_sampler->sample_cube_x8 = a_sample_cube_kernels[p_desc->filter];
+}